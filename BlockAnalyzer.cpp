@@ -0,0 +1,297 @@
+#include "BlockAnalyzer.h"
+#include "logging.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <string>
+
+#ifdef _MSC_VER
+#pragma warning(disable:4996)
+#endif
+
+#define SECONDS_PER_DAY (60*60*24)
+
+namespace BLOCK_ANALYZER
+{
+	// In the order of BlockChain::KeyType
+	const char *keyTypeLabels[BlockChain::KT_LAST] =
+	{
+		"UNKNOWN",
+		"UNCOMPRESSED_PUBLIC_KEY",
+		"COMPRESSED_PUBLIC_KEY",
+		"RIPEMD160",
+		"TRUNCATED_COMPRESSED_KEY",
+		"MULTISIG",
+		"STEALTH",
+		"SCRIPT_HASH",
+		"ZERO_LENGTH"
+	};
+
+	bool isCoinbase(const BlockChain::BlockTransaction &t)
+	{
+		return t.inputCount == 1 && t.inputs[0].transactionIndex == 0xFFFFFFFF;
+	}
+
+	// Per day totals, indexed by the number of whole days since 1970 so blocks can arrive in any order
+	template <class T>
+	class DayTable
+	{
+	public:
+		T &getDay(uint32_t timeStamp)
+		{
+			uint32_t day = timeStamp / SECONDS_PER_DAY;
+			if (day >= mDays.size())
+			{
+				mDays.resize(day + 1);
+			}
+			return mDays[day];
+		}
+
+		std::vector< T >	mDays;
+	};
+
+	class DailyStatistics : public BlockAnalyzer
+	{
+	public:
+		DailyStatistics(const char *reportFileName, ReportWriter::Format format) : mReportFileName(reportFileName)
+			, mFormat(format)
+		{
+		}
+
+		virtual bool needsSpentOutputs(void) const override final
+		{
+			return true;
+		}
+
+		virtual void onBlock(const BlockChain::Block &block, const SpentOutput *spent) override final
+		{
+			Day &d = mTable.getDay(block.timeStamp);
+			d.mBlockCount++;
+			d.mTransactionCount += block.transactionCount;
+			for (uint32_t i = 0; i < block.transactionCount; i++)
+			{
+				const BlockChain::BlockTransaction &t = block.transactions[i];
+				uint64_t inputValue = 0;
+				for (uint32_t j = 0; j < t.inputCount; j++)
+				{
+					inputValue += spent[j].mValue;
+				}
+				spent += t.inputCount;
+				uint64_t outputValue = 0;
+				for (uint32_t j = 0; j < t.outputCount; j++)
+				{
+					const BlockChain::BlockOutput &o = t.outputs[j];
+					outputValue += o.value;
+					d.mKeyTypeCount[o.keyType < BlockChain::KT_LAST ? o.keyType : BlockChain::KT_UNKNOWN]++;
+				}
+				d.mInputCount += t.inputCount;
+				d.mOutputCount += t.outputCount;
+				d.mInputValue += inputValue;
+				d.mOutputValue += outputValue;
+				if (isCoinbase(t))
+				{
+					d.mNewCoins += outputValue;
+				}
+				else if (inputValue > outputValue)	// An input which couldn't be resolved would make the fee look negative
+				{
+					d.mFees += inputValue - outputValue;
+				}
+			}
+		}
+
+		virtual void end(void) override final
+		{
+			ReportWriter *report = ReportWriter::create(mReportFileName.c_str(), mFormat);
+			if (report == nullptr)
+			{
+				return;
+			}
+			logMessage("Writing the ingest daily statistics to '%s'\n", mReportFileName.c_str());
+			report->addColumn("Date", ReportWriter::CT_DATE);
+			report->addColumn("BlockCount", ReportWriter::CT_COUNT);
+			report->addColumn("TransactionCount", ReportWriter::CT_COUNT);
+			report->addColumn("InputCount", ReportWriter::CT_COUNT);
+			report->addColumn("OutputCount", ReportWriter::CT_COUNT);
+			report->addColumn("InputValue", ReportWriter::CT_BTC);
+			report->addColumn("OutputValue", ReportWriter::CT_BTC);
+			report->addColumn("Fees", ReportWriter::CT_BTC);
+			report->addColumn("NewCoins", ReportWriter::CT_BTC);
+			char label[256];
+			for (uint32_t i = 0; i < BlockChain::KT_LAST; i++)
+			{
+				snprintf(label, sizeof(label), "%s Outputs", keyTypeLabels[i]);
+				report->addColumn(label, ReportWriter::CT_COUNT);
+			}
+			for (uint32_t day = 0; day < uint32_t(mTable.mDays.size()); day++)
+			{
+				const Day &d = mTable.mDays[day];
+				if (d.mBlockCount == 0)
+				{
+					continue;
+				}
+				report->writeDate(day * SECONDS_PER_DAY);
+				report->writeCount(d.mBlockCount);
+				report->writeCount(d.mTransactionCount);
+				report->writeCount(d.mInputCount);
+				report->writeCount(d.mOutputCount);
+				report->writeSatoshis(d.mInputValue);
+				report->writeSatoshis(d.mOutputValue);
+				report->writeSatoshis(d.mFees);
+				report->writeSatoshis(d.mNewCoins);
+				for (uint32_t i = 0; i < BlockChain::KT_LAST; i++)
+				{
+					report->writeCount(d.mKeyTypeCount[i]);
+				}
+				report->endRow();
+			}
+			report->release();
+		}
+
+		virtual void release(void) override final
+		{
+			delete this;
+		}
+
+	private:
+		class Day
+		{
+		public:
+			Day(void)
+			{
+				memset(this, 0, sizeof(*this));
+			}
+			uint64_t	mBlockCount;
+			uint64_t	mTransactionCount;
+			uint64_t	mInputCount;
+			uint64_t	mOutputCount;
+			uint64_t	mInputValue;
+			uint64_t	mOutputValue;
+			uint64_t	mFees;						// Inputs less outputs of every transaction but the coinbase
+			uint64_t	mNewCoins;					// The outputs of the coinbase transactions
+			uint64_t	mKeyTypeCount[BlockChain::KT_LAST];
+		};
+
+		std::string				mReportFileName;
+		ReportWriter::Format	mFormat;
+		DayTable< Day >			mTable;
+	};
+
+	class OutputValues : public BlockAnalyzer
+	{
+	public:
+		// Bucket 0 is outputs of no value, bucket n is values from 10^(n-1) up to 10^n satoshis
+		static const uint32_t BUCKET_COUNT = 21;
+
+		OutputValues(const char *reportFileName, ReportWriter::Format format) : mReportFileName(reportFileName)
+			, mFormat(format)
+		{
+		}
+
+		virtual bool needsSpentOutputs(void) const override final
+		{
+			return false;
+		}
+
+		virtual void onBlock(const BlockChain::Block &block, const SpentOutput * /*spent*/) override final
+		{
+			Day &d = mTable.getDay(block.timeStamp);
+			for (uint32_t i = 0; i < block.transactionCount; i++)
+			{
+				const BlockChain::BlockTransaction &t = block.transactions[i];
+				for (uint32_t j = 0; j < t.outputCount; j++)
+				{
+					uint32_t bucket = 0;
+					for (uint64_t v = t.outputs[j].value; v; v /= 10)
+					{
+						bucket++;
+					}
+					d.mCount[bucket]++;
+				}
+			}
+		}
+
+		virtual void end(void) override final
+		{
+			ReportWriter *report = ReportWriter::create(mReportFileName.c_str(), mFormat);
+			if (report == nullptr)
+			{
+				return;
+			}
+			logMessage("Writing the ingest output values to '%s'\n", mReportFileName.c_str());
+			// Only the buckets any output ever fell in are listed
+			uint32_t bucketCount = 1;
+			for (auto i = mTable.mDays.begin(); i != mTable.mDays.end(); ++i)
+			{
+				for (uint32_t j = bucketCount; j < BUCKET_COUNT; j++)
+				{
+					if ((*i).mCount[j])
+					{
+						bucketCount = j + 1;
+					}
+				}
+			}
+			report->addColumn("Date", ReportWriter::CT_DATE);
+			report->addColumn("Zero", ReportWriter::CT_COUNT);
+			char label[256];
+			for (uint32_t i = 1; i < bucketCount; i++)
+			{
+				snprintf(label, sizeof(label), "1e%d satoshis", i - 1);
+				report->addColumn(label, ReportWriter::CT_COUNT);
+			}
+			for (uint32_t day = 0; day < uint32_t(mTable.mDays.size()); day++)
+			{
+				const Day &d = mTable.mDays[day];
+				uint64_t total = 0;
+				for (uint32_t i = 0; i < bucketCount; i++)
+				{
+					total += d.mCount[i];
+				}
+				if (total == 0)
+				{
+					continue;
+				}
+				report->writeDate(day * SECONDS_PER_DAY);
+				for (uint32_t i = 0; i < bucketCount; i++)
+				{
+					report->writeCount(d.mCount[i]);
+				}
+				report->endRow();
+			}
+			report->release();
+		}
+
+		virtual void release(void) override final
+		{
+			delete this;
+		}
+
+	private:
+		class Day
+		{
+		public:
+			Day(void)
+			{
+				memset(mCount, 0, sizeof(mCount));
+			}
+			uint64_t	mCount[BUCKET_COUNT];
+		};
+
+		std::string				mReportFileName;
+		ReportWriter::Format	mFormat;
+		DayTable< Day >			mTable;
+	};
+
+} // end of BLOCK_ANALYZER namespace
+
+BlockAnalyzer *BlockAnalyzer::createDailyStatistics(const char *reportFileName, ReportWriter::Format format)
+{
+	BLOCK_ANALYZER::DailyStatistics *ret = new BLOCK_ANALYZER::DailyStatistics(reportFileName, format);
+	return static_cast<BlockAnalyzer *>(ret);
+}
+
+BlockAnalyzer *BlockAnalyzer::createOutputValues(const char *reportFileName, ReportWriter::Format format)
+{
+	BLOCK_ANALYZER::OutputValues *ret = new BLOCK_ANALYZER::OutputValues(reportFileName, format);
+	return static_cast<BlockAnalyzer *>(ret);
+}
@@ -0,0 +1,51 @@
+#ifndef BLOCK_ANALYZER_H
+
+#define BLOCK_ANALYZER_H
+
+#include <stdint.h>
+
+#include "BlockChain.h"
+#include "ReportWriter.h"
+
+// Computes a report from the blocks as they are ingested, while each decoded block is still in hand, so the report
+// is ready at the end of the same run that builds the database rather than needing another pass over
+// TransactionFile.bin.  Analyzers are registered with PublicKeyDatabase::addBlockAnalyzer and see every block added
+// after that, in order.
+class BlockAnalyzer
+{
+public:
+	// The output an input spends, as the public key database resolved it
+	class SpentOutput
+	{
+	public:
+		uint64_t	mValue;					// Zero for a coinbase input
+		uint32_t	mKeyIndex;				// The public key index of the output; 0xFFFFFFFF for a coinbase input
+		uint32_t	mTimeStamp;				// When the output was created; the block time for a coinbase input
+	};
+
+	// Daily block, transaction, input and output counts and totals, fees and the outputs of each key type
+	static BlockAnalyzer *createDailyStatistics(const char *reportFileName,ReportWriter::Format format);
+
+	// The number of outputs each day in each power of ten of satoshis
+	static BlockAnalyzer *createOutputValues(const char *reportFileName,ReportWriter::Format format);
+
+	// True if onBlock needs the outputs the inputs of the block spend.  Looking them up is part of adding the block
+	// to the database anyway; they are only gathered up if some analyzer asks for them.
+	virtual bool needsSpentOutputs(void) const = 0;
+
+	// 'spent' has one entry for every input of every transaction of the block, in order, if needsSpentOutputs;
+	// otherwise it is nullptr
+	virtual void onBlock(const BlockChain::Block &block,const SpentOutput *spent) = 0;
+
+	// Called after the last block; writes the report
+	virtual void end(void) = 0;
+
+	virtual void release(void) = 0;
+
+protected:
+	virtual ~BlockAnalyzer(void)
+	{
+	}
+};
+
+#endif
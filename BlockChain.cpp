@@ -7,6 +7,7 @@
 #include <string>
 #include <vector>
 #include <unordered_set>
+#include <unordered_map>
 
 #include "BlockChain.h"			// The header for this system
 #include "Base58.h"				// A helper interface to
@@ -14,6 +15,7 @@
 #include "RIPEMD160.h"
 #include "SHA256.h"
 #include "logging.h"
+#include "FileInterface.h"
 
 //
 // Written by John W. Ratcliff : mailto: jratcliffscarab@gmail.com
@@ -246,6 +248,16 @@ namespace BLOCK_CHAIN
 		uint64_t	mWord3;
 	};
 
+	struct BlockPrefix
+	{
+		uint32_t	mVersion;					// The block version number.
+		uint8_t		mPreviousBlock[32];			// The 32 byte (256 bit) hash of the previous block in the blockchain
+		uint8_t		mMerkleRoot[32];			// The 32 bye merkle root hash
+		uint32_t	mTimeStamp;					// The block time stamp
+		uint32_t	mBits;						// The block bits field.
+		uint32_t	mNonce;						// The block random number 'nonce' field.
+	};
+
 	class BlockHeader : public Hash256
 	{
 	public:
@@ -254,6 +266,8 @@ namespace BLOCK_CHAIN
 			mFileIndex = 0;
 			mFileOffset = 0;
 			mBlockLength = 0;
+			mTransactionCount = 0;
+			memset(&mPrefix, 0, sizeof(mPrefix));
 		}
 
 		BlockHeader(const Hash256 &h) : Hash256(h)
@@ -261,6 +275,8 @@ namespace BLOCK_CHAIN
 			mFileIndex = 0;
 			mFileOffset = 0;
 			mBlockLength = 0;
+			mTransactionCount = 0;
+			memset(&mPrefix, 0, sizeof(mPrefix));
 		}
 
 		// Here the == operator is used to see if the hash values match
@@ -274,9 +290,192 @@ namespace BLOCK_CHAIN
 		uint32_t	mFileIndex;
 		uint32_t	mFileOffset;
 		uint32_t	mBlockLength;
-		uint8_t		mPreviousBlockHash[32];
+		uint32_t	mTransactionCount;
+		BlockPrefix	mPrefix;					// The 80 byte block header as it is stored in the file
 	};
 
+	// A 256 bit unsigned integer, least significant word first; just enough arithmetic to add up the work of a chain
+	class ChainWork
+	{
+	public:
+		ChainWork(void)
+		{
+			memset(mWords, 0, sizeof(mWords));
+		}
+
+		// The expected number of hashes it took to find a block meeting the target encoded in 'bits'; 2^256 / (target+1),
+		// worked out as ~target / (target+1) + 1 so it fits in 256 bits.  A negative, zero or overflowing target is no work.
+		static ChainWork fromBits(uint32_t bits)
+		{
+			ChainWork ret;
+			uint32_t size = bits >> 24;
+			uint32_t mantissa = bits & 0x007FFFFF;
+			if (mantissa == 0 || (bits & 0x00800000) || size > 34 || (size == 34 && mantissa > 0xFF) || (size == 33 && mantissa > 0xFFFF))
+			{
+				return ret;
+			}
+			ChainWork target;
+			if (size <= 3)
+			{
+				target.mWords[0] = mantissa >> (8 * (3 - size));
+				if (target.mWords[0] == 0)
+				{
+					return ret;
+				}
+			}
+			else
+			{
+				target.mWords[0] = mantissa;
+				target.shiftLeft(8 * (size - 3));
+			}
+			ChainWork numerator;
+			for (uint32_t i = 0; i < WORD_COUNT; i++)
+			{
+				numerator.mWords[i] = ~target.mWords[i];
+			}
+			ChainWork one;
+			one.mWords[0] = 1;
+			target += one;
+			ret = numerator.divide(target);
+			ret += one;
+			return ret;
+		}
+
+		ChainWork &operator+=(const ChainWork &w)
+		{
+			uint64_t carry = 0;
+			for (uint32_t i = 0; i < WORD_COUNT; i++)
+			{
+				uint64_t sum = carry + mWords[i] + w.mWords[i];
+				mWords[i] = uint32_t(sum);
+				carry = sum >> 32;
+			}
+			return *this;
+		}
+
+		bool operator<(const ChainWork &w) const
+		{
+			for (uint32_t i = WORD_COUNT; i-- > 0;)
+			{
+				if (mWords[i] != w.mWords[i])
+				{
+					return mWords[i] < w.mWords[i];
+				}
+			}
+			return false;
+		}
+
+		// The approximate work as a double; for logging
+		double getDouble(void) const
+		{
+			double ret = 0;
+			for (uint32_t i = WORD_COUNT; i-- > 0;)
+			{
+				ret = ret * 4294967296.0 + mWords[i];
+			}
+			return ret;
+		}
+
+	private:
+		enum
+		{
+			WORD_COUNT = 8
+		};
+
+		uint32_t getBitCount(void) const
+		{
+			for (uint32_t i = WORD_COUNT; i-- > 0;)
+			{
+				for (uint32_t bit = 32; bit-- > 0;)
+				{
+					if (mWords[i] & (1U << bit))
+					{
+						return i * 32 + bit + 1;
+					}
+				}
+			}
+			return 0;
+		}
+
+		void shiftLeft(uint32_t shift)
+		{
+			uint32_t words = shift / 32;
+			uint32_t bits = shift % 32;
+			for (uint32_t i = WORD_COUNT; i-- > 0;)
+			{
+				uint32_t value = 0;
+				if (i >= words)
+				{
+					value = mWords[i - words] << bits;
+					if (bits && i > words)
+					{
+						value |= mWords[i - words - 1] >> (32 - bits);
+					}
+				}
+				mWords[i] = value;
+			}
+		}
+
+		void shiftRightOne(void)
+		{
+			for (uint32_t i = 0; i < WORD_COUNT; i++)
+			{
+				mWords[i] = (mWords[i] >> 1) | (i + 1 < WORD_COUNT ? mWords[i + 1] << 31 : 0);
+			}
+		}
+
+		void subtract(const ChainWork &w)
+		{
+			uint64_t borrow = 0;
+			for (uint32_t i = 0; i < WORD_COUNT; i++)
+			{
+				uint64_t difference = uint64_t(mWords[i]) - w.mWords[i] - borrow;
+				mWords[i] = uint32_t(difference);
+				borrow = (difference >> 32) & 1;
+			}
+		}
+
+		// Long division; shifts the divisor up under the numerator and subtracts it wherever it fits
+		ChainWork divide(const ChainWork &divisor) const
+		{
+			ChainWork ret;
+			ChainWork numerator = *this;
+			ChainWork d = divisor;
+			uint32_t numeratorBits = numerator.getBitCount();
+			uint32_t divisorBits = d.getBitCount();
+			if (divisorBits == 0 || divisorBits > numeratorBits)
+			{
+				return ret;
+			}
+			uint32_t shift = numeratorBits - divisorBits;
+			d.shiftLeft(shift);
+			for (uint32_t bit = shift + 1; bit-- > 0;)
+			{
+				if (!(numerator < d))
+				{
+					numerator.subtract(d);
+					ret.mWords[bit / 32] |= 1U << (bit % 32);
+				}
+				d.shiftRightOne();
+			}
+			return ret;
+		}
+
+		uint32_t	mWords[WORD_COUNT];
+	};
+
+	// A scanned block header and where it hangs in the tree of every header seen
+	class HeaderNode
+	{
+	public:
+		BlockHeader	mHeader;
+		uint32_t	mParent;				// The node of the previous block; NO_PARENT for the genesis block or while it is unknown
+		uint32_t	mHeight;
+		ChainWork	mChainWork;				// The work of this block and every block before it
+	};
+
+	const uint32_t NO_PARENT = 0xFFFFFFFF;
+
 	class FileLocation : public Hash256
 	{
 	public:
@@ -307,29 +506,27 @@ namespace BLOCK_CHAIN
 		uint32_t	mTransactionIndex;
 	};
 
-	struct BlockPrefix
-	{
-		uint32_t	mVersion;					// The block version number.
-		uint8_t		mPreviousBlock[32];			// The 32 byte (256 bit) hash of the previous block in the blockchain
-		uint8_t		mMerkleRoot[32];			// The 32 bye merkle root hash
-		uint32_t	mTimeStamp;					// The block time stamp
-		uint32_t	mBits;						// The block bits field.
-		uint32_t	mNonce;						// The block random number 'nonce' field.
-	};
-
 #define MAGIC_ID 0xD9B4BEF9
+#define HEADER_FILE_NAME "BlockHeaders.bin"
+#define HEADER_FILE_MAGIC "B21HDRS"
+
+	// The slot of the headers file hash table a block hash starts looking in
+	inline uint32_t getHeaderFileSlot(const uint8_t *blockHash, uint32_t tableSize)
+	{
+		return *(const uint32_t *)blockHash & (tableSize - 1);
+	}
 #define ONE_BTC 100000000
 #define ONE_MBTC (ONE_BTC/1000)
 
 } // end of BLOCK_CHAIN namespace
 
-// A template to compute the hash value for a BlockHeader
+// A template to compute the hash value for a Hash256
 namespace std
 {
 	template <>
-	struct hash<BLOCK_CHAIN::BlockHeader>
+	struct hash<BLOCK_CHAIN::Hash256>
 	{
-		std::size_t operator()(const BLOCK_CHAIN::BlockHeader &k) const
+		std::size_t operator()(const BLOCK_CHAIN::Hash256 &k) const
 		{
 			return std::size_t(k.getHash());
 		}
@@ -1035,8 +1232,9 @@ class BlockChainImpl : public BlockChain
 public:
 
 	typedef std::vector< FILE * > FILEVector;
-	typedef std::vector< BlockHeader *> BlockHeaderVector;
-	typedef std::unordered_set< BlockHeader > BlockHeaderSet;
+	typedef std::vector< HeaderNode > HeaderNodeVector;
+	typedef std::unordered_map< Hash256, uint32_t > HeaderNodeMap;
+	typedef std::unordered_multimap< Hash256, uint32_t > PendingHeaderMap;
 	typedef std::unordered_set< FileLocation > FileLocationSet;
 
 	BlockChainImpl(const char *rootDir,uint32_t maxBlocks)
@@ -1055,7 +1253,11 @@ public:
 		mBlockIndex = 0;
 		mFileLength = 0;
 		mCurrentBlockData = mBlockDataBuffer;	// scratch buffer to read up to 3 blocks
-		mBlockChainHeaders = nullptr;
+		mHeaderFileMap = nullptr;
+		mHeaderFile = nullptr;
+		mHeaders = nullptr;
+		mReorganizeCount = 0;
+		mResumeBlockIndex = 0;
 		bitcoinAsciiToAddress(gDummyKeyAscii, gDummyKey);
 		bitcoinAsciiToAddress(gZeroByteAscii, gZeroByte);
 		openBlock();
@@ -1073,7 +1275,7 @@ public:
 		{
 			fclose(mTextReport);
 		}
-		delete[]mBlockChainHeaders;
+		closeHeaderFile();
 	}
 
 	// Initial scan of the blockchain to build the hash table of valid blocks; skipping orphan blocks
@@ -1094,9 +1296,9 @@ public:
 	// Initial scan of the blockchain to build the hash table of blocks in forward order.
 	// Contrary to what you might think, or expect, the blocks in the file are not in the order of 
 	// 0,1,2,3,4 etc.  The reason for this is that sometimes, while the client is connected to the network, orphan blocks get written
-	// out.  So, the only way to know the correct blockchain is to sequentally scan to the last block found.  For each block we compute it's
-	// hash and store it into a hash-table.  Then, to build the correct version of the blockchain we have to walk the linked-list backwards from
-	// the last block to the first; leaving orphans out of it.
+	// out.  So, the only way to know the correct blockchain is to sequentally scan every block found.  For each block we compute it's
+	// hash and hang it under its previous block in a tree of headers (see addHeader); the correct version of the blockchain is the
+	// path from the genesis block to the tip with the most work, leaving orphans out of it.
 	bool readBlockHeader(void)
 	{
 		bool ret = false;
@@ -1190,15 +1392,12 @@ public:
 						if (r == 1)
 						{
 							Hash256 *blockHash = static_cast<Hash256 *>(&header);
-							memcpy(header.mPreviousBlockHash, prefix.mPreviousBlock, 32);
+							header.mPrefix = prefix;
 							computeSHA256((uint8_t *)&prefix, sizeof(prefix), (uint8_t *)blockHash);
 							computeSHA256((uint8_t *)blockHash, 32, (uint8_t *)blockHash);
-							uint32_t currentFileOffset = ftell(fph); // get the current file offset.
-							uint32_t advance = header.mBlockLength - sizeof(BlockPrefix);
-							currentFileOffset += advance;
-							fseek(fph, currentFileOffset, SEEK_SET); // skip past the block to get to the next header.
-							mLastBlockHeader = header;
-							mBlockHeaderSet.insert(header);
+							header.mTransactionCount = readTransactionCount(fph);
+							fseek(fph, header.mFileOffset + header.mBlockLength, SEEK_SET); // skip past the block to get to the next header.
+							addHeader(header);
 							ret = true;
 						}
 					}
@@ -1209,6 +1408,27 @@ public:
 		return ret;
 	}
 
+	// Reads the variable length transaction count which follows the block header
+	uint32_t readTransactionCount(FILE *fph)
+	{
+		uint8_t c = 0;
+		if (fread(&c, sizeof(c), 1, fph) != 1)
+		{
+			return 0;
+		}
+		uint64_t count = c;
+		if (c >= 0xFD)
+		{
+			uint32_t length = c == 0xFD ? 2 : c == 0xFE ? 4 : 8;
+			count = 0;
+			if (fread(&count, length, 1, fph) != 1)
+			{
+				return 0;
+			}
+		}
+		return uint32_t(count);
+	}
+
 	// Opens the FILE associated with the next section of blocks (blk?????.dat) sequence
 	bool openBlock(void)
 	{
@@ -1244,41 +1464,184 @@ public:
 		delete this;
 	}
 
-	// Once scanning is completed, we build the blockchain by traversing, as a linked list, the last block to every previous block.
-	// This will allow it to successfully skip orphaned blocks.  Return value is the last valid block number encountered.
+	// Adds a scanned header to the tree of headers.  If its previous block is already in the tree it hangs under it,
+	// along with any headers which were waiting for it; otherwise it waits in mPendingHeaders for its previous block.
+	void addHeader(const BlockHeader &header)
+	{
+		const Hash256 &hash = header;
+		if (mHeaderNodeMap.find(hash) != mHeaderNodeMap.end())
+		{
+			return;
+		}
+		uint32_t node = uint32_t(mHeaderNodes.size());
+		HeaderNode n;
+		n.mHeader = header;
+		n.mParent = NO_PARENT;
+		n.mHeight = 0;
+		mHeaderNodes.push_back(n);
+		mHeaderNodeMap[hash] = node;
+		Hash256 previous(header.mPrefix.mPreviousBlock);
+		if (previous == Hash256())
+		{
+			connectHeader(node, NO_PARENT);
+		}
+		else
+		{
+			HeaderNodeMap::iterator found = mHeaderNodeMap.find(previous);
+			if (found == mHeaderNodeMap.end())
+			{
+				mPendingHeaders.insert(std::make_pair(previous, node));
+			}
+			else if (isConnected((*found).second))
+			{
+				connectHeader(node, (*found).second);
+			}
+			else
+			{
+				mPendingHeaders.insert(std::make_pair(previous, node));
+			}
+		}
+	}
+
+	// True if the node hangs from the genesis block
+	bool isConnected(uint32_t node) const
+	{
+		const HeaderNode &n = mHeaderNodes[node];
+		return n.mParent != NO_PARENT || Hash256(n.mHeader.mPrefix.mPreviousBlock) == Hash256();
+	}
+
+	// Hangs 'node' under 'parent', then every header which was waiting on it in turn
+	void connectHeader(uint32_t node, uint32_t parent)
+	{
+		std::vector< std::pair< uint32_t, uint32_t > > stack;
+		stack.push_back(std::make_pair(node, parent));
+		while (!stack.empty())
+		{
+			node = stack.back().first;
+			parent = stack.back().second;
+			stack.pop_back();
+			HeaderNode &n = mHeaderNodes[node];
+			n.mParent = parent;
+			n.mChainWork = ChainWork::fromBits(n.mHeader.mPrefix.mBits);
+			if (parent != NO_PARENT)
+			{
+				const HeaderNode &p = mHeaderNodes[parent];
+				n.mHeight = p.mHeight + 1;
+				n.mChainWork += p.mChainWork;
+			}
+			// A tip only takes over with strictly more work, so of two equal branches the one seen first is kept
+			if (mActiveChain.empty() || mHeaderNodes[mActiveChain.back()].mChainWork < n.mChainWork)
+			{
+				setTip(node);
+			}
+			std::pair< PendingHeaderMap::iterator, PendingHeaderMap::iterator > waiting = mPendingHeaders.equal_range(n.mHeader);
+			for (PendingHeaderMap::iterator i = waiting.first; i != waiting.second; ++i)
+			{
+				stack.push_back(std::make_pair((*i).second, node));
+			}
+			mPendingHeaders.erase(waiting.first, waiting.second);
+		}
+	}
+
+	// Makes 'node' the tip of the active chain.  Only the blocks back to where its branch meets the active chain are
+	// walked, so extending the chain costs one step and a reorganization costs the depth of the fork.
+	void setTip(uint32_t node)
+	{
+		mBranch.clear();
+		uint32_t i = node;
+		while (i != NO_PARENT)
+		{
+			const HeaderNode &n = mHeaderNodes[i];
+			if (n.mHeight < mActiveChain.size() && mActiveChain[n.mHeight] == i)
+			{
+				break;
+			}
+			mBranch.push_back(i);
+			i = n.mParent;
+		}
+		uint32_t forkHeight = i == NO_PARENT ? 0 : mHeaderNodes[i].mHeight + 1;
+		if (forkHeight < mActiveChain.size())
+		{
+			mReorganizeCount++;
+		}
+		mActiveChain.resize(forkHeight);
+		for (uint32_t j = uint32_t(mBranch.size()); j-- > 0;)
+		{
+			mActiveChain.push_back(mBranch[j]);
+		}
+	}
+
+	// Once scanning is completed, the chain is the branch of the tree of headers with the most work, which has been
+	// kept up to date as the headers were scanned.  Blocks on any other branch are skipped as orphans.  Return value is
+	// the number of blocks in the chain.  Scanning more headers afterwards extends the tree and the chain, and building
+	// again just saves the chain as it stands.
 	virtual uint32_t buildBlockChain(void)
 	{
 		uint32_t blockCount = 0;
 		if (mScanCount)
 		{
 
-			uint32_t btotal = uint32_t(mBlockHeaderSet.size());
+			uint32_t btotal = uint32_t(mHeaderNodes.size());
 			logMessage("Found %s block headers total.\r\n", formatNumber(btotal));
 
 			logMessage("Building complete block-chain.\r\n");
-			// need to count the total number of blocks...
-
-			BlockHeaderSet::iterator found = mBlockHeaderSet.find(mLastBlockHeader);
-			while (found != mBlockHeaderSet.end() )
+			blockCount = uint32_t(mActiveChain.size());
+			logMessage("Found %s blocks and skipped %s orphan blocks.\r\n", formatNumber(blockCount), formatNumber(btotal - blockCount));
+			if (!mPendingHeaders.empty())
 			{
-				blockCount++;
-				BlockHeader temp((*found).mPreviousBlockHash);
-				found = mBlockHeaderSet.find(temp);
+				logMessage("%s block headers never connected to the genesis block.\r\n", formatNumber(uint32_t(mPendingHeaders.size())));
+			}
+			if (blockCount)
+			{
+				logMessage("The chain has %g total work; the best tip changed branches %s times while scanning.\r\n", mHeaderNodes[mActiveChain.back()].mChainWork.getDouble(), formatNumber(mReorganizeCount));
 			}
-			logMessage("Found %s blocks and skipped %s orphan blocks.\r\n", formatNumber(blockCount), formatNumber(btotal - blockCount));
 
-			mBlockChainHeaders = new BlockHeader[blockCount];
-			// Now that we know how many blocks are available, we add them to the list
+			// The headers file image is laid out in memory, saved and then used straight out of the memory mapped file
+			closeHeaderFile();
+			uint32_t tableSize = 16;
+			while (tableSize < blockCount * 2)
+			{
+				tableSize *= 2;
+			}
+			uint64_t tableOffset = sizeof(HeaderFileHeader) + sizeof(HeaderFileEntry)*uint64_t(blockCount);
+			mHeaderFileImage.resize(size_t(tableOffset + sizeof(uint32_t)*uint64_t(tableSize)));
+			HeaderFileHeader *fileHeader = (HeaderFileHeader *)&mHeaderFileImage[0];
+			memset(fileHeader, 0, sizeof(HeaderFileHeader));
+			strcpy(fileHeader->mMagic, HEADER_FILE_MAGIC);
+			fileHeader->mVersion = HEADER_FILE_VERSION;
+			fileHeader->mBlockCount = blockCount;
+			fileHeader->mTableSize = tableSize;
+			fileHeader->mTableOffset = tableOffset;
+			HeaderFileEntry *entries = (HeaderFileEntry *)(fileHeader + 1);
 			logMessage("Gathering %s block headers.\r\n", formatNumber(blockCount));
-			uint32_t index = blockCount - 1;
-			found = mBlockHeaderSet.find(mLastBlockHeader);
-			while (found != mBlockHeaderSet.end())
+			uint64_t transactionTotal = 0;
+			uint32_t *table = (uint32_t *)&mHeaderFileImage[size_t(tableOffset)];
+			for (uint32_t i = 0; i < tableSize; i++)
 			{
-				mBlockChainHeaders[index] = (*found);
-				index--;
-				BlockHeader temp((*found).mPreviousBlockHash);
-				found = mBlockHeaderSet.find(temp);
+				table[i] = HEADER_FILE_EMPTY_SLOT;
 			}
+			for (uint32_t i = 0; i < blockCount; i++)
+			{
+				const BlockHeader &h = mHeaderNodes[mActiveChain[i]].mHeader;
+				HeaderFileEntry &e = entries[i];
+				memcpy(e.mHeader, &h.mPrefix, sizeof(e.mHeader));
+				memcpy(e.mHash, &h.mWord0, sizeof(e.mHash));
+				e.mFileIndex = h.mFileIndex;
+				e.mFileOffset = h.mFileOffset;
+				e.mBlockLength = h.mBlockLength;
+				e.mTransactionCount = h.mTransactionCount;
+				e.mTransactionTotal = transactionTotal;
+				transactionTotal += e.mTransactionCount;
+				uint32_t slot = getHeaderFileSlot(e.mHash, tableSize);
+				while (table[slot] != HEADER_FILE_EMPTY_SLOT)
+				{
+					slot = (slot + 1) & (tableSize - 1);
+				}
+				table[slot] = i;
+			}
+			mHeaderFile = fileHeader;
+			mHeaders = entries;
+			saveHeaderFile();
 			mBlockCount = blockCount;
 
 			mScanCount = 0;
@@ -1286,6 +1649,51 @@ public:
 		return blockCount;
 	}
 
+	void closeHeaderFile(void)
+	{
+		if (mHeaderFileMap)
+		{
+			fi_fclose(mHeaderFileMap);
+			mHeaderFileMap = nullptr;
+		}
+		mHeaderFile = nullptr;
+		mHeaders = nullptr;
+	}
+
+	// Writes BlockHeaders.bin and switches over to the memory mapped copy of it, so the in memory image can be freed
+	void saveHeaderFile(void)
+	{
+		FILE *fph = fopen(HEADER_FILE_NAME, "wb");
+		if (fph == nullptr)
+		{
+			logMessage("Failed to open file '%s' for write access.\r\n", HEADER_FILE_NAME);
+			return;
+		}
+		size_t r = fwrite(&mHeaderFileImage[0], mHeaderFileImage.size(), 1, fph);
+		fclose(fph);
+		if (r != 1)
+		{
+			logMessage("Failed to write the block headers to '%s'.\r\n", HEADER_FILE_NAME);
+			return;
+		}
+		mHeaderFileMap = fi_fopen(HEADER_FILE_NAME, "rb", nullptr, 0, true);
+		uint64_t length = 0;
+		const uint8_t *base = mHeaderFileMap ? (const uint8_t *)fi_getMemBuffer(mHeaderFileMap, &length) : nullptr;
+		if (base == nullptr || length != mHeaderFileImage.size())
+		{
+			if (mHeaderFileMap)
+			{
+				fi_fclose(mHeaderFileMap);
+				mHeaderFileMap = nullptr;
+			}
+			return;
+		}
+		mHeaderFile = (const HeaderFileHeader *)base;
+		mHeaders = (const HeaderFileEntry *)(mHeaderFile + 1);
+		std::vector< uint8_t >().swap(mHeaderFileImage);
+		logMessage("Saved %s block headers to '%s'\r\n", formatNumber(mHeaderFile->mBlockCount), HEADER_FILE_NAME);
+	}
+
 	virtual const Block *readBlock(uint32_t blockIndex)
 	{
 		Block *ret = nullptr;
@@ -1296,12 +1704,28 @@ public:
 		return ret;
 	}
 
+	virtual const Block *readBlockByHash(const uint8_t *blockHash)
+	{
+		uint32_t blockIndex = getBlockHeight(blockHash);
+		return blockIndex == 0xFFFFFFFF ? nullptr : readBlock(blockIndex);
+	}
+
+	virtual uint32_t getBlockHeight(const uint8_t *blockHash) const
+	{
+		return mHeaderFile ? findBlockHeight(mHeaderFile, blockHash) : 0xFFFFFFFF;
+	}
+
+	virtual uint32_t getTransactionBlockHeight(uint64_t transactionOrdinal) const
+	{
+		return mHeaderFile ? findTransactionBlockHeight(mHeaderFile, transactionOrdinal) : 0xFFFFFFFF;
+	}
+
 	virtual bool readBlock(BlockImpl &block, uint32_t blockIndex)
 	{
 		bool ret = false;
 
 		if (blockIndex >= mBlockCount) return false;
-		BlockHeader &header = mBlockChainHeaders[blockIndex];
+		const HeaderFileEntry &header = mHeaders[blockIndex];
 		FILE *fph = mBlockDataFiles[header.mFileIndex];
 		if (fph)
 		{
@@ -1319,8 +1743,7 @@ public:
 
 			if (blockIndex < (mBlockCount - 2))
 			{
-				BlockHeader *nextNext = &mBlockChainHeaders[blockIndex + 2];
-				block.nextBlockHash = nextNext->mPreviousBlockHash;
+				block.nextBlockHash = mHeaders[blockIndex + 1].mHash;
 			}
 
 			uint8_t *blockData = mBlockDataBuffer;
@@ -1426,6 +1849,11 @@ public:
 		mSearchForText = textLen;
 	}
 
+	virtual void setResumeBlockIndex(uint32_t blockIndex)
+	{
+		mResumeBlockIndex = blockIndex;
+	}
+
 	virtual const BlockTransaction *processSingleTransaction(const void *transactionData,uint32_t transactionLength)
 	{
 		const BlockTransaction *ret = NULL;
@@ -1641,7 +2069,9 @@ public:
 					Hash256 thash(input.transactionHash);
 					FileLocation key(thash,0,0,0,0);
 					FileLocationSet::iterator found = mTransactionSet.find(key);
-					if ( found == mTransactionSet.end() )
+					// A resumed run only holds the transactions read since the checkpoint, so a miss there may simply be
+					// an older transaction; those inputs are checked by the public key database against its full set
+					if ( found == mTransactionSet.end() && mResumeBlockIndex == 0 )
 					{
 						block.warning = true;
 						logMessage("Failed to find transaction!\r\n");
@@ -1666,20 +2096,75 @@ public:
 	uint32_t					mBlockIndex;						// Index of current file we are processing
 	uint32_t					mFileLength;						// Length of the current file we have open...
 	FILEVector					mBlockDataFiles;						// The array of files
-	BlockHeader					mLastBlockHeader;					// last block header we processed.
-	BlockHeaderSet				mBlockHeaderSet;
+	HeaderNodeVector			mHeaderNodes;						// Every block header scanned, in the order they were found
+	HeaderNodeMap				mHeaderNodeMap;						// The node of each block hash
+	PendingHeaderMap			mPendingHeaders;					// Headers whose previous block hasn't been scanned yet, by that block's hash
+	std::vector< uint32_t >		mActiveChain;						// The nodes of the chain with the most work, indexed by height
+	std::vector< uint32_t >		mBranch;							// Scratch space for switching the active chain over to a new tip
+	uint32_t					mReorganizeCount;					// How many times a tip on another branch took over
 	uint32_t					mBlockCount;						// Number of total blocks in the blockchain
-	BlockHeader					*mBlockChainHeaders;				// Headers for every single block in the blockchain
+	std::vector< uint8_t >		mHeaderFileImage;					// BlockHeaders.bin as it is built; kept if the file can't be mapped
+	FILE_INTERFACE				*mHeaderFileMap;					// The memory mapped BlockHeaders.bin
+	const HeaderFileHeader		*mHeaderFile;						// The headers file, mapped or in memory
+	const HeaderFileEntry		*mHeaders;							// Headers for every single block in the blockchain, indexed by height
 	BlockImpl					mSingleReadBlock;
 	BlockImpl					mSingleTransactionBlock;
 	uint32_t					mTransactionCount;
 	FILE						*mTextReport;
 	uint8_t						mTransactionBlockBuffer[MAX_BLOCK_SIZE];
 	FileLocationSet				mTransactionSet;
+	uint32_t					mResumeBlockIndex;					// Blocks before this one were not read by this run
 };
 
 } // end of BLOCK_CHAIN namespace
 
+uint32_t BlockChain::findBlockHeight(const HeaderFileHeader *file,const uint8_t *blockHash)
+{
+	const HeaderFileEntry *entries = (const HeaderFileEntry *)(file + 1);
+	const uint32_t *table = (const uint32_t *)((const uint8_t *)file + file->mTableOffset);
+	uint32_t slot = BLOCK_CHAIN::getHeaderFileSlot(blockHash, file->mTableSize);
+	for (uint32_t i = 0; i < file->mTableSize; i++)
+	{
+		uint32_t height = table[slot];
+		if (height == HEADER_FILE_EMPTY_SLOT)
+		{
+			break;
+		}
+		if (memcmp(entries[height].mHash, blockHash, sizeof(entries[height].mHash)) == 0)
+		{
+			return height;
+		}
+		slot = (slot + 1) & (file->mTableSize - 1);
+	}
+	return 0xFFFFFFFF;
+}
+
+uint32_t BlockChain::findTransactionBlockHeight(const HeaderFileHeader *file,uint64_t transactionOrdinal)
+{
+	const HeaderFileEntry *entries = (const HeaderFileEntry *)(file + 1);
+	uint32_t count = file->mBlockCount;
+	if (count == 0 || transactionOrdinal >= entries[count - 1].mTransactionTotal + entries[count - 1].mTransactionCount)
+	{
+		return 0xFFFFFFFF;
+	}
+	// The last block whose first transaction is at or before the ordinal
+	uint32_t low = 0;
+	uint32_t high = count;
+	while (high - low > 1)
+	{
+		uint32_t middle = low + (high - low) / 2;
+		if (entries[middle].mTransactionTotal <= transactionOrdinal)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return low;
+}
+
 BlockChain *BlockChain::createBlockChain(const char *rootPath,uint32_t maxBlocks)
 {
 	BLOCK_CHAIN::BlockChainImpl *b = new BLOCK_CHAIN::BlockChainImpl(rootPath, maxBlocks);
@@ -186,6 +186,48 @@ public:
 		bool			warning;					// there was a warning issued while processing this block.
 	};
 
+	enum
+	{
+		HEADER_FILE_VERSION = 1,
+		HEADER_FILE_EMPTY_SLOT = 0xFFFFFFFF
+	};
+
+	// buildBlockChain saves the finished chain to BlockHeaders.bin so that it can be memory mapped, by this process or any
+	// other, and used in place.  It starts with a HeaderFileHeader, followed by one HeaderFileEntry per block indexed by
+	// height, followed by a hash table of mTableSize uint32 heights used to find a block by its hash.  A block's slot
+	// is the first four bytes of its hash (little endian) masked by mTableSize-1; a taken slot moves on to the next one,
+	// wrapping around, and a slot of HEADER_FILE_EMPTY_SLOT ends the search.  findBlockHeight and
+	// findTransactionBlockHeight do the lookups on a mapped file.
+	class HeaderFileHeader
+	{
+	public:
+		char		mMagic[8];				// "B21HDRS"
+		uint32_t	mVersion;				// HEADER_FILE_VERSION
+		uint32_t	mBlockCount;
+		uint32_t	mTableSize;				// Slots in the hash table; a power of two at least twice mBlockCount
+		uint32_t	mReserved;
+		uint64_t	mTableOffset;			// Where the hash table starts in the file
+	};
+
+	class HeaderFileEntry
+	{
+	public:
+		uint8_t		mHeader[80];			// The block header exactly as it is stored in the blk?????.dat file
+		uint8_t		mHash[32];				// The hash of the block
+		uint32_t	mFileIndex;				// Which blk?????.dat file the block is in
+		uint32_t	mFileOffset;			// Where the block header starts in that file
+		uint32_t	mBlockLength;
+		uint32_t	mTransactionCount;		// Transactions in this block
+		uint64_t	mTransactionTotal;		// Transactions in all of the blocks before this one
+	};
+
+	// The height of the block with this hash in the mapped BlockHeaders.bin 'file'; 0xFFFFFFFF if it is not on the chain
+	static uint32_t findBlockHeight(const HeaderFileHeader *file,const uint8_t *blockHash);
+
+	// The height of the block holding transaction 'transactionOrdinal', counting every transaction of the chain in order
+	// from zero; 0xFFFFFFFF if the chain has fewer transactions than that
+	static uint32_t findTransactionBlockHeight(const HeaderFileHeader *file,uint64_t transactionOrdinal);
+
 	// Set the search for ASCII text length.  If this value is non-zero, then the parsing code will
 	// scan each block for significant amounts of ASCII text (textLen or >) and write the results to a file on disk called
 	// AsciiTextReport.txt
@@ -194,18 +236,33 @@ public:
 	// Initial scan of the blockchain to build the hash table of blocks in forward order.
 	// Contrary to what you might think, or expect, the blocks in the file are not in the order of 
 	// 0,1,2,3,4 etc.  The reason for this is that sometimes, while the client is connected to the network, orphan blocks get written
-	// out.  So, the only way to know the correct blockchain is to sequentially scan to the last block found.  For each block we compute it's
-	// hash and store it into a hash-table.  Then, to build the correct version of the blockchain we have to walk the linked-list backwards from
-	// the last block to the first; leaving orphans out of it.
+	// out.  So, the only way to know the correct blockchain is to sequentially scan every block found.  For each block we compute it's
+	// hash and hang it under its previous block in a tree of headers, keeping track of the tip with the most work as we go; the
+	// correct version of the blockchain is the path from the genesis block to that tip, leaving orphans out of it.
 	virtual bool scanBlockChain(uint32_t &lastBlockRead) = 0;
 
-	// Once scanning is completed, we build the blockchain by traversing, as a linked list, the last block to every previous block.
-	// This will allow it to successfully skip orphaned blocks.  Return value is the last valid block number encountered.
+	// Once scanning is completed, the blockchain is the branch of scanned headers with the most cumulative proof of work
+	// (from the 'bits' of each header), which skips the orphaned blocks.  Return value is the number of blocks in it.
+	// The chain is saved to BlockHeaders.bin (see HeaderFileHeader).  Headers scanned afterwards extend the chain, and
+	// calling this again saves the chain as it then stands.
 	virtual uint32_t buildBlockChain(void) = 0;
 
 	// Read this block in
 	virtual const Block *readBlock(uint32_t blockIndex) = 0;
 
+	// Reads in the block of the chain with this hash; nullptr if it is not on the chain
+	virtual const Block *readBlockByHash(const uint8_t *blockHash) = 0;
+
+	// The height of the block with this hash; 0xFFFFFFFF if it is not on the chain built by buildBlockChain
+	virtual uint32_t getBlockHeight(const uint8_t *blockHash) const = 0;
+
+	// The height of the block holding transaction 'transactionOrdinal' of the chain; see findTransactionBlockHeight
+	virtual uint32_t getTransactionBlockHeight(uint64_t transactionOrdinal) const = 0;
+
+	// When resuming a previous run, the blocks before this index are never read; so inputs which spend transactions from
+	// those blocks cannot be validated against the transactions this parser has seen.
+	virtual void setResumeBlockIndex(uint32_t blockIndex) = 0;
+
 	// print the contents of this block
 	virtual void printBlock(const Block *b) = 0;
 
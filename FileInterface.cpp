@@ -9,6 +9,13 @@
 
 #ifdef _MSC_VER
 #include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <sys/types.h>
 #endif
 
 #pragma warning(disable:4267)
@@ -618,6 +625,35 @@ bool                fi_deleteFile(const char *fname)
     {
         ret = true;
     }
+#else
+    if (remove(fname) == 0)
+    {
+        ret = true;
+    }
+#endif
+
+    return ret;
+}
+
+bool                fi_truncateFile(const char *fname,uint64_t length)
+{
+    bool ret = false;
+
+#ifdef _MSC_VER
+    int fd = -1;
+    if (_sopen_s(&fd, fname, _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) == 0)
+    {
+        if (_chsize_s(fd, int64_t(length)) == 0)
+        {
+            ret = true;
+        }
+        _close(fd);
+    }
+#else
+    if (truncate(fname, off_t(length)) == 0)
+    {
+        ret = true;
+    }
 #endif
 
     return ret;
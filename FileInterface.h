@@ -26,6 +26,7 @@ void *				fi_getMemBuffer(FILE_INTERFACE *fph,uint64_t *outputLength);  // retur
 bool				fi_usesMemoryMappedFile(FILE_INTERFACE *fph);
 void *				fi_getCurrentMemoryLocation(FILE_INTERFACE *fph); // only valid for memory based files; but will return the address in memory of the current file location
 bool                fi_deleteFile(const char *fname);
+bool                fi_truncateFile(const char *fname,uint64_t length); // shrinks (or extends) the named file on disk to exactly 'length' bytes
 
 
 #endif
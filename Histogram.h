@@ -0,0 +1,213 @@
+#ifndef HISTOGRAM_H
+
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// An integer histogram with log-linear buckets, in the style of an HDR histogram.  Values below 2^(precisionBits+1)
+// each get a bucket of their own; above that every power of two is split into 2^precisionBits equal buckets, so a
+// value is always counted to within 1 part in 2^precisionBits of itself whatever its magnitude.  Finding the bucket
+// of a value is a bit scan and a shift rather than a search, so the precision costs memory but not time.
+//
+// The buckets are only allocated up to the highest one used, and histograms with the same precision can be merged,
+// so each thread of a parallel pass can fill in its own and fold them together afterwards.
+class Histogram
+{
+public:
+	Histogram(uint32_t precisionBits=4) : mPrecisionBits(precisionBits)
+	{
+		assert(precisionBits >= 1 && precisionBits <= 16);
+		clear();
+	}
+
+	void clear(void)
+	{
+		mCounts.clear();
+		mCount = 0;
+		mTotal = 0;
+		mMin = ~uint64_t(0);
+		mMax = 0;
+	}
+
+	uint32_t getPrecisionBits(void) const
+	{
+		return mPrecisionBits;
+	}
+
+	// The bucket this value is counted in
+	uint32_t getIndex(uint64_t value) const
+	{
+		uint64_t subBuckets = uint64_t(1) << mPrecisionBits;
+		if (value < subBuckets * 2)
+		{
+			return uint32_t(value);
+		}
+		uint32_t shift = getHighestBit(value) - mPrecisionBits;
+		return uint32_t(shift * subBuckets + (value >> shift));
+	}
+
+	// The smallest value counted in this bucket
+	uint64_t getBucketLow(uint32_t index) const
+	{
+		uint32_t subBuckets = 1U << mPrecisionBits;
+		if (index < subBuckets * 2)
+		{
+			return index;
+		}
+		uint32_t shift = index / subBuckets - 1;
+		return uint64_t(index - shift * subBuckets) << shift;
+	}
+
+	// The largest value counted in this bucket
+	uint64_t getBucketHigh(uint32_t index) const
+	{
+		uint32_t subBuckets = 1U << mPrecisionBits;
+		if (index < subBuckets * 2)
+		{
+			return index;
+		}
+		uint32_t shift = index / subBuckets - 1;
+		return ((uint64_t(index - shift * subBuckets) + 1) << shift) - 1;
+	}
+
+	void add(uint64_t value, uint64_t count=1)
+	{
+		uint32_t index = getIndex(value);
+		if (index >= mCounts.size())
+		{
+			mCounts.resize(index + 1, 0);
+		}
+		mCounts[index] += count;
+		mCount += count;
+		mTotal += value * count;
+		if (value < mMin)
+		{
+			mMin = value;
+		}
+		if (value > mMax)
+		{
+			mMax = value;
+		}
+	}
+
+	// Folds in the counts of a histogram with the same precision
+	void merge(const Histogram &other)
+	{
+		assert(other.mPrecisionBits == mPrecisionBits);
+		if (other.mCount == 0)
+		{
+			return;
+		}
+		if (other.mCounts.size() > mCounts.size())
+		{
+			mCounts.resize(other.mCounts.size(), 0);
+		}
+		for (size_t i = 0; i < other.mCounts.size(); i++)
+		{
+			mCounts[i] += other.mCounts[i];
+		}
+		mCount += other.mCount;
+		mTotal += other.mTotal;
+		if (other.mMin < mMin)
+		{
+			mMin = other.mMin;
+		}
+		if (other.mMax > mMax)
+		{
+			mMax = other.mMax;
+		}
+	}
+
+	// Number of values added
+	uint64_t getCount(void) const
+	{
+		return mCount;
+	}
+
+	// The sum of the values added
+	uint64_t getTotal(void) const
+	{
+		return mTotal;
+	}
+
+	uint64_t getMin(void) const
+	{
+		return mCount ? mMin : 0;
+	}
+
+	uint64_t getMax(void) const
+	{
+		return mMax;
+	}
+
+	double getMean(void) const
+	{
+		return mCount ? double(mTotal) / double(mCount) : 0;
+	}
+
+	// The value 'percentile' (0 to 100) percent of the values are at or below, to the precision of the buckets.  The
+	// top of the bucket it falls in is returned, within the smallest and largest values actually added.
+	uint64_t getValueAtPercentile(double percentile) const
+	{
+		if (mCount == 0)
+		{
+			return 0;
+		}
+		uint64_t target = uint64_t(percentile / 100.0 * double(mCount) + 0.5);
+		if (target < 1)
+		{
+			target = 1;
+		}
+		uint64_t seen = 0;
+		for (uint32_t i = 0; i < uint32_t(mCounts.size()); i++)
+		{
+			seen += mCounts[i];
+			if (seen >= target)
+			{
+				uint64_t value = getBucketHigh(i);
+				return value < mMin ? mMin : value > mMax ? mMax : value;
+			}
+		}
+		return mMax;
+	}
+
+	// Number of buckets allocated; every bucket past these is empty
+	uint32_t getBucketCount(void) const
+	{
+		return uint32_t(mCounts.size());
+	}
+
+	uint64_t getBucketValueCount(uint32_t index) const
+	{
+		return index < mCounts.size() ? mCounts[index] : 0;
+	}
+
+private:
+	// The index of the highest set bit; 'value' must not be zero
+	static uint32_t getHighestBit(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return uint32_t(index);
+#else
+		return uint32_t(63 - __builtin_clzll(value));
+#endif
+	}
+
+	uint32_t				mPrecisionBits;
+	std::vector< uint64_t >	mCounts;		// The number of values in each bucket
+	uint64_t				mCount;
+	uint64_t				mTotal;
+	uint64_t				mMin;
+	uint64_t				mMax;
+};
+
+#endif
@@ -2,16 +2,30 @@
 #include "BitcoinAddress.h"
 #include "FileInterface.h"
 #include "logging.h"
-#include "HeapSort.h"
+#include "Sort.h"
+#include "ThreadPool.h"
+#include "Histogram.h"
+#include "ReportWriter.h"
+#include "BlockAnalyzer.h"
 
 #include "CRC32.h"
 
 #include <stdio.h>
 #include <vector>
+#include <string>
 #include <unordered_set>
 #include <unordered_map>
+#include <algorithm>
+#include <queue>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <assert.h>
 #include <time.h>
+#if defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#endif
 
 #define ONE_BTC 100000000
 #define ONE_MBTC (ONE_BTC/1000)
@@ -27,6 +41,17 @@
 
 namespace PUBLIC_KEY_DATABASE
 {
+	// Hints that 'address' is about to be read; only a hint, so a no-op where there is no way to give it
+	inline void prefetch(const void *address)
+	{
+#if defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+		_mm_prefetch((const char *)address, _MM_HINT_T0);
+#elif defined(__GNUC__)
+		__builtin_prefetch(address);
+#else
+		(void)address;
+#endif
+	}
 
 	enum ValueType
 	{
@@ -45,54 +70,6 @@ namespace PUBLIC_KEY_DATABASE
 		VT_LAST_ENTRY
 	};
 
-	double getValueTypeValue(ValueType t)
-	{
-		double ret = 0;
-		switch ( t )
-		{
-			case VT_MICRO_BIT:    // 0.0001
-				ret = 0.0001;
-				break;
-			case VT_MILI_BIT:     // 0.001
-				ret = 0.001;
-				break;
-			case VT_CENTI_BIT:    // 0.01
-				ret = 0.01;
-				break;
-			case VT_TENTH:		 // 0.1
-				ret = 0.1;
-				break;
-			case VT_QUARTER:		 // 0.25
-				ret = 0.25;
-				break;
-			case VT_BTC:			 // 1
-				ret = 1;
-				break;
-			case VT_TEN_BTC:		 // 10
-				ret = 10;
-				break;
-			case VT_HUNDRED_BTC:  // 100
-				ret = 100;
-				break;
-			case VT_THOUSAND_BTC: // 1000
-				ret = 1000;
-				break;
-			case VT_TEN_THOUSAND_BTC:
-				ret = 10000;
-				break;
-            case VT_ONE_HUNDRED_THOUSAND_BTC:
-                ret = 100000;
-                break;
-            case VT_ONE_MILLION_BTC:
-                ret = 1000000;
-                break;
-            default:
-                assert(0);
-                break;
-		}
-		return ret;
-	}
-
 	const char * getValueTypeLabel(ValueType type)
 	{
 		const char *ret = "UNKNOWN";
@@ -142,283 +119,324 @@ namespace PUBLIC_KEY_DATABASE
 		return ret;
 	}
 
-	struct ValueEntry
+	// Which value range a transaction value, in satoshis, falls into.  Each range runs from the value of the one before
+	// it up to (but not including) its own value; anything larger than that ends up in the last range.
+	ValueType getValueType(uint64_t value)
 	{
-		void init(ValueType t)
+		static const uint64_t limits[VT_LAST_ENTRY - 1] =
 		{
-			mType = t;
-			mCount = 0;
-			mTotalValue = 0;
-			mValue = getValueTypeValue(mType);
-			mLabel = getValueTypeLabel(mType);
+			ONE_BTC / 10000,
+			ONE_BTC / 1000,
+			ONE_BTC / 100,
+			ONE_BTC / 10,
+			ONE_BTC / 4,
+			ONE_BTC,
+			uint64_t(ONE_BTC) * 10,
+			uint64_t(ONE_BTC) * 100,
+			uint64_t(ONE_BTC) * 1000,
+			uint64_t(ONE_BTC) * 10000,
+			uint64_t(ONE_BTC) * 100000
+		};
+		for (uint32_t i = 0; i < (VT_LAST_ENTRY - 1); i++)
+		{
+			if (value < limits[i])
+			{
+				return ValueType(i);
+			}
 		}
+		return VT_ONE_MILLION_BTC;
+	}
+
+	enum AgeRank
+	{
+		AR_ONE_DAY,
+		AR_ONE_WEEK,			// 2- 7 days
+		AR_ONE_MONTH,			// 2 to 4 weeks
+		AR_THREE_MONTHS,		// one month to three months
+		AR_SIX_MONTHS,			// six months to one year
+		AR_ONE_YEAR,			// one-to-two years
+		AR_TWO_YEARS,			// two to three years
+		AR_THREE_YEARS,
+		AR_FOUR_YEARS,
+		AR_ZOMBIE,				// over 3 years
+		AR_LAST
+	};
+
 
-		void addValue(uint64_t v)
+	// The oldest an unspent output can be, in days, and still fall into this age range
+	uint32_t getAgeRankDays(AgeRank r)
+	{
+		uint32_t ret = 0;
+		switch (r)
 		{
-			double dv = double(v) / ONE_BTC;
-			addValue(v);
+			case AR_ONE_DAY:
+				ret = 1;
+				break;
+			case AR_ONE_WEEK:
+				ret = 7;
+				break;
+			case AR_ONE_MONTH:
+				ret = 30;
+				break;
+			case AR_THREE_MONTHS:
+				ret = 365 / 4;
+				break;
+			case AR_SIX_MONTHS:
+				ret = 365 / 2;
+				break;
+			case AR_ONE_YEAR:
+				ret = 365;
+				break;
+			case AR_TWO_YEARS:
+				ret = 365 * 2;
+				break;
+			case AR_THREE_YEARS:
+				ret = 365 * 3;
+				break;
+			case AR_FOUR_YEARS:
+				ret = 365 * 4;
+				break;
+			case AR_ZOMBIE:
+				ret = 365 * 1000;
+				break;
+			default:
+				assert(0);
+				break;
 		}
+		return ret;
+	}
 
-
-		void addValue(double v)
+	const char *getAgeRankLabel(AgeRank r)
+	{
+		const char *ret = "UNKNOWN";
+		switch (r)
 		{
-			mCount++;
-			mTotalValue += v;
+			case AR_ONE_DAY:
+				ret = "One Day";
+				break;
+			case AR_ONE_WEEK:
+				ret = "Past Week";
+				break;
+			case AR_ONE_MONTH:
+				ret = "Past Month";
+				break;
+			case AR_THREE_MONTHS:
+				ret = "One to Three Months";
+				break;
+			case AR_SIX_MONTHS:
+				ret = "Four to Six Months";
+				break;
+			case AR_ONE_YEAR:
+				ret = "Six Months to One Year";
+				break;
+			case AR_TWO_YEARS:
+				ret = "One to Two Years";
+				break;
+			case AR_THREE_YEARS:
+				ret = "Two to Three Years";
+				break;
+			case AR_FOUR_YEARS:
+				ret = "Three to Four Years";
+				break;
+			case AR_ZOMBIE:
+				ret = "Over Four Years";
+				break;
+			default:
+				assert(0);
+				break;
 		}
+		return ret;
+	}
 
-		ValueType	mType;				// type of value
-		double		mValue;				// amount of value
-		uint32_t	mCount;				// number of transactions within this value range
-		double		mTotalValue;		// total value of transactions within this range
-		const char	*mLabel;
+	// The per day totals; mSums[DS_INPUT_VALUE + ...] and so on.  Metrics with one entry per key type, value range or
+	// age range occupy a run of consecutive columns.
+	enum DailySum
+	{
+		DS_BLOCK_COUNT,								// Number of blocks on this day
+		DS_TRANSACTION_COUNT,						// How many transactions happened on this day
+		DS_TRANSACTION_SIZE,						// Size of all transactions on this day
+		DS_INPUT_COUNT,								// Total number of inputs in all transactions
+		DS_INPUT_VALUE,								// Total value of all inputs, in satoshis
+		DS_INPUT_SCRIPT_LENGTH,						// Total size of all input scripts
+		DS_OUTPUT_COUNT,							// Total number of outputs in all transactions
+		DS_OUTPUT_VALUE,							// Total value of all outputs, in satoshis
+		DS_OUTPUT_SCRIPT_LENGTH,					// Total size of all output scripts
+		DS_DUST_COUNT,								// Number of dust inputs spent on this day
+		DS_ZOMBIE_INPUT_COUNT,						// Number of inputs spent which were more than ZOMBIE_TIME days old
+		DS_ZOMBIE_INPUT_VALUE,						// Their total value, in satoshis
+		DS_UTXO_COUNT,								// Unspent transaction outputs at the end of the day
+		DS_UTXO_VALUE,								// Their total value, in satoshis
+		DS_EARLY_COUNT,								// The unspent transaction outputs from 2009-2010
+		DS_EARLY_VALUE,
+		DS_KEY_TYPE_COUNT,							// Outputs of each BlockChain::KeyType
+		DS_VALUE_COUNT = DS_KEY_TYPE_COUNT + BlockChain::KT_LAST,	// Transactions in each ValueType range
+		DS_VALUE_TOTAL = DS_VALUE_COUNT + VT_LAST_ENTRY,			// The value of those transactions, in satoshis
+		DS_AGE_COUNT = DS_VALUE_TOTAL + VT_LAST_ENTRY,				// Unspent transaction outputs in each AgeRank
+		DS_AGE_VALUE = DS_AGE_COUNT + AR_LAST,						// Their value, in satoshis
+		DS_LAST = DS_AGE_VALUE + AR_LAST
+	};
+
+	// The per day maxima
+	enum DailyMax
+	{
+		DM_BLOCK_TRANSACTION_COUNT,					// Most transactions in a block
+		DM_TRANSACTION_SIZE,						// Largest transaction
+		DM_INPUT_COUNT,								// Most inputs on a transaction
+		DM_INPUT_VALUE,								// Largest input value, in satoshis
+		DM_INPUT_SCRIPT_LENGTH,
+		DM_OUTPUT_COUNT,							// Most outputs on a transaction
+		DM_OUTPUT_VALUE,							// Largest output value, in satoshis
+		DM_OUTPUT_SCRIPT_LENGTH,
+		DM_INPUT_AGE,								// Oldest input spent, in days
+		DM_LAST
 	};
 
-	struct ValueEntryTable
+	// The daily statistics for the whole history of the blockchain, stored as one array per metric indexed by day
+	// (see getAgeInDays).  The arrays grow as days are added, so there is no limit on how far the chain goes, and
+	// accumulating a transaction only touches the arrays it updates.  Values are summed in satoshis.  Tables built over
+	// separate runs of blocks can be merged; no block may be split between two tables.
+	class DailyStatisticsTable
 	{
-		ValueEntryTable(void)
+	public:
+		DailyStatisticsTable(void) : mCurrentBlock(0xFFFFFFFF)
+			, mBlockTransactionCount(0)
 		{
-			init();
 		}
 
-		void init(void)
+		void clear(void)
 		{
-			mTable[VT_MICRO_BIT].init(VT_MICRO_BIT);
-			mTable[VT_MILI_BIT].init(VT_MILI_BIT);
-			mTable[VT_CENTI_BIT].init(VT_CENTI_BIT);
-			mTable[VT_TENTH].init(VT_TENTH);
-			mTable[VT_QUARTER].init(VT_QUARTER);
-			mTable[VT_BTC].init(VT_BTC);
-			mTable[VT_TEN_BTC].init(VT_TEN_BTC);
-			mTable[VT_HUNDRED_BTC].init(VT_HUNDRED_BTC);
-			mTable[VT_THOUSAND_BTC].init(VT_THOUSAND_BTC);
-			mTable[VT_TEN_THOUSAND_BTC].init(VT_TEN_THOUSAND_BTC);
-            mTable[VT_ONE_HUNDRED_THOUSAND_BTC].init(VT_ONE_HUNDRED_THOUSAND_BTC);
-            mTable[VT_ONE_MILLION_BTC].init(VT_ONE_MILLION_BTC);
+			resize(0);
+			mCurrentBlock = 0xFFFFFFFF;
+			mBlockTransactionCount = 0;
 		}
 
-		void addValue(uint64_t v)
+		uint32_t getDayCount(void) const
 		{
-			double dv = double(v) / ONE_BTC;
-			addValue(dv);
+			return uint32_t(mTimeStamp.size());
 		}
 
-		void addValue(double v)
+		// Grows every column to hold 'day'
+		void addDay(uint32_t day)
 		{
-			bool found = false;
-			double prev = 0;
-			for (uint32_t i = 0; i < (VT_LAST_ENTRY-1); i++)
-			{
-				if (v >= prev && v < mTable[i].mValue)
-				{
-					found = true;
-					mTable[i].addValue(v);
-					break;
-				}
-				prev = mTable[i].mValue;
-			}
-			if (!found)
+			if (day >= getDayCount())
 			{
-				assert(v >= 1000000);
-				mTable[VT_ONE_MILLION_BTC].addValue(v);
+				resize(day + 1);
 			}
 		}
 
-		void outputHeader(FILE_INTERFACE *fph)
+		// True if there were any transactions on this day
+		bool hasDay(uint32_t day) const
 		{
-			for (uint32_t i = 0; i < VT_LAST_ENTRY; i++)
-			{
-				fi_fprintf(fph, "\"%s count\",", mTable[i].mLabel);
-			}
-			for (uint32_t i = 0; i < VT_LAST_ENTRY; i++)
-			{
-				fi_fprintf(fph, "\"%s value\",", mTable[i].mLabel);
-			}
+			return day < getDayCount() && mTimeStamp[day] != 0;
 		}
 
-		void outputValue(FILE_INTERFACE *fph)
+		// Counts this transaction towards the block it is in; returns true if it starts a new block
+		bool addBlockTransaction(uint32_t day, uint32_t blockNumber)
 		{
-			for (uint32_t i = 0; i < VT_LAST_ENTRY; i++)
-			{
-				fi_fprintf(fph, "%d,", mTable[i].mCount);
-			}
-			for (uint32_t i = 0; i < VT_LAST_ENTRY; i++)
+			bool ret = blockNumber != mCurrentBlock;
+			if (ret)
 			{
-				fi_fprintf(fph, "%f,", mTable[i].mTotalValue);
+				mCurrentBlock = blockNumber;
+				mBlockTransactionCount = 0;
+				mSums[DS_BLOCK_COUNT][day]++;
 			}
+			mBlockTransactionCount++;
+			setMax(DM_BLOCK_TRANSACTION_COUNT, day, mBlockTransactionCount);
+			return ret;
 		}
 
-
-		ValueEntry	mTable[VT_LAST_ENTRY];
-	};
-
-
-
-#define MAXIMUM_DAYS (365*10)	// Leave room for 10 years of days
-
-	enum AgeRank
-	{
-		AR_ONE_DAY,
-		AR_ONE_WEEK,			// 2- 7 days
-		AR_ONE_MONTH,			// 2 to 4 weeks
-		AR_THREE_MONTHS,		// one month to three months
-		AR_SIX_MONTHS,			// six months to one year
-		AR_ONE_YEAR,			// one-to-two years
-		AR_TWO_YEARS,			// two to three years
-		AR_THREE_YEARS,
-		AR_FOUR_YEARS,
-		AR_ZOMBIE,				// over 3 years
-		AR_LAST
-	};
-
-
-	class AgeStat
-	{
-	public:
-		void init(AgeRank r)
+		uint64_t getSum(uint32_t column, uint32_t day) const
 		{
-			switch (r)
-			{
-				case AR_ONE_DAY:
-					mDays = 1;
-					mLabel = "One Day";
-					mCount = 0;
-					mValue = 0;
-					break;
-				case AR_ONE_WEEK:
-					mDays = 7;
-					mLabel = "Past Week";
-					mCount = 0;
-					mValue = 0;
-					break;
-				case AR_ONE_MONTH:
-					mDays = 30;
-					mLabel = "Past Month";
-					mCount = 0;
-					mValue = 0;
-					break;
-				case AR_THREE_MONTHS:
-					mDays = 365 / 4;
-					mLabel = "One to Three Months";
-					mCount = 0;
-					mValue = 0;
-					break;
-				case AR_SIX_MONTHS:
-					mDays = 365 / 2;
-					mLabel = "Four to Six Months";
-					mCount = 0;
-					mValue = 0;
-					break;
-				case AR_ONE_YEAR:
-					mDays = 365;
-					mLabel = "Six Months to One Year";
-					mCount = 0;
-					mValue = 0;
-					break;
-				case AR_TWO_YEARS:
-					mDays = 365 * 2;
-					mLabel = "One to Two Years";
-					mCount = 0;
-					mValue = 0;
-					break;
-				case AR_THREE_YEARS:
-					mDays = 365 * 3;
-					mLabel = "Two to Three Years";
-					mCount = 0;
-					mValue = 0;
-					break;
-				case AR_FOUR_YEARS:
-					mDays = 365 * 4;
-					mLabel = "Three to Four Years";
-					mCount = 0;
-					mValue = 0;
-					break;
-				case AR_ZOMBIE:
-					mDays = 365 * 1000;
-					mLabel = "Over Four Years";
-					mCount = 0;
-					mValue = 0;
-					break;
-			}
+			return mSums[column][day];
 		}
 
-		AgeRank		mRank;
-		uint32_t	mDays;
-		const char *mLabel;
-		uint32_t	mCount;
-		double		mValue;
-	};
-	class DailyStatistics
-	{
-	public:
-
-		DailyStatistics(void)
+		void addSum(uint32_t column, uint32_t day, uint64_t value)
 		{
-			memset(this, sizeof(DailyStatistics), 0);
-			for (uint32_t i = 0; i < AR_LAST; i++)
-			{
-				mAgeStats[i].init((AgeRank)i);
-			}
-			mValueEntryTable.init();
+			mSums[column][day] += value;
 		}
 
-		uint32_t getMeanInputCount(void) const
+		void setSum(uint32_t column, uint32_t day, uint64_t value)
 		{
-			return mTransactionCount ? mInputCount / mTransactionCount : 0;
+			mSums[column][day] = value;
 		}
 
-		uint32_t getMeanOutputCount(void) const
+		uint64_t getMax(DailyMax column, uint32_t day) const
 		{
-			return mTransactionCount ? mOutputCount / mTransactionCount : 0;
+			return mMaxima[column][day];
 		}
 
-		uint32_t getMeanTransactionSize(void) const
+		void setMax(DailyMax column, uint32_t day, uint64_t value)
 		{
-			return mTransactionCount ? mTransactionSize / mTransactionCount : 0;
+			uint64_t &m = mMaxima[column][day];
+			if (value > m)
+			{
+				m = value;
+			}
 		}
 
-		uint32_t	mTimeStamp;								// The time stamp for this day
-		uint32_t	mTransactionCount;						// How many transactions happened on this day
-		uint32_t	mInputCount;							// Total number of inputs in all transactions
-		uint32_t	mOutputCount;							// Total number of outputs in all transactions
-		uint32_t	mMaxInputCount;							// Largest number of transaction inputs on this day
-		uint32_t	mMaxOutputCount;						// Largest number of transaction outputs on this day
-		uint32_t	mTransactionSize;						// Size of all transactions on this day
-		uint32_t	mMaxTransactionSize;					// Maximum transaction size on this day
-		uint32_t	mKeyTypeCounts[BlockChain::KT_LAST];	// Counts of various types of keys
-
-		double		mTotalInputValue;						// Total value of all inputs for this day
-		uint64_t	mMaxInputValue;							// Maximum input value for this day
-		uint32_t	mTotalInputScriptLength;				// Total size of all input scripts for this day
-		uint32_t	mMaxInputScriptLength;					// Maximum input script length on this day
-
-		double		mTotalOutputValue;						// Total value of all outputs for this day
-		uint64_t	mMaxOutputValue;						// Maximum output value for this day
-		uint32_t	mTotalOutputScriptLength;				// Total size of all output scripts for this day
-		uint32_t	mMaxOutputScriptLength;					// Maximum output script length on this day
-
-		uint32_t	mCurrentBlock;							// The current block for this day
-		uint32_t	mTransactionBlockCount;					// How many transactions are in the current block
-		uint32_t	mBlockCount;							// Number of blocks on this day
-		uint32_t	mMaxTransactionBlockCount;				// Maximum number of transactions in a block
-
-		uint32_t	mMaxInputAge;							// old input for this day.
-
-		uint32_t	mDustCount;								// number of dust transactions on this day
-
-		uint32_t	mZombieInputCount;						// Number of times an input more than 3 years old was encountered
-		double		mZombieInputValue;						// Total value in BTC that was more than 3 years old
-		double		mZombieScore;
-
-		uint32_t	mUTXOCount;					// total number of unspent transaction outputs
-		double		mUTXOValue;					// total value of all unspent transaction outputs
-
-		uint32_t	mEarlyCount;		// Number of unspent transaction outputs from 2009-2010
-		double		mEarlyValue;		// Total vaule of unspent transaction outputs from 2009-2010
+		// Folds in the statistics from a table built over a different run of blocks
+		void merge(const DailyStatisticsTable &other)
+		{
+			uint32_t dayCount = other.getDayCount();
+			if (dayCount == 0)
+			{
+				return;
+			}
+			addDay(dayCount - 1);
+			for (uint32_t day = 0; day < dayCount; day++)
+			{
+				uint32_t t = other.mTimeStamp[day];
+				if (t && (mTimeStamp[day] == 0 || t < mTimeStamp[day]))
+				{
+					mTimeStamp[day] = t;
+				}
+			}
+			for (uint32_t c = 0; c < DS_LAST; c++)
+			{
+				uint64_t *dest = &mSums[c][0];
+				const uint64_t *source = &other.mSums[c][0];
+				for (uint32_t day = 0; day < dayCount; day++)
+				{
+					dest[day] += source[day];
+				}
+			}
+			for (uint32_t c = 0; c < DM_LAST; c++)
+			{
+				uint64_t *dest = &mMaxima[c][0];
+				const uint64_t *source = &other.mMaxima[c][0];
+				for (uint32_t day = 0; day < dayCount; day++)
+				{
+					dest[day] = std::max(dest[day], source[day]);
+				}
+			}
+			for (uint32_t day = 0; day < dayCount; day++)
+			{
+				mZombieScore[day] += other.mZombieScore[day];
+			}
+		}
 
-		AgeStat		mAgeStats[AR_LAST];			// UTXO by age stats
+		std::vector< uint32_t >		mTimeStamp;				// The time of the first transaction on each day; zero if there were none
+		std::vector< double >		mZombieScore;			// Sum of the age in days squared times the value in BTC of each input
 
+	private:
+		void resize(uint32_t dayCount)
+		{
+			mTimeStamp.resize(dayCount);
+			mZombieScore.resize(dayCount);
+			for (uint32_t c = 0; c < DS_LAST; c++)
+			{
+				mSums[c].resize(dayCount);
+			}
+			for (uint32_t c = 0; c < DM_LAST; c++)
+			{
+				mMaxima[c].resize(dayCount);
+			}
+		}
 
-		ValueEntryTable	mValueEntryTable;
+		std::vector< uint64_t >		mSums[DS_LAST];
+		std::vector< uint64_t >		mMaxima[DM_LAST];
+		uint32_t					mCurrentBlock;			// The block the last transaction added was in
+		uint32_t					mBlockTransactionCount;	// How many transactions of it have been added so far
 	};
 
 
@@ -453,20 +471,12 @@ namespace PUBLIC_KEY_DATABASE
 	}
 
 
+	const uint32_t EARLY_END_DATE = 1293840000;	// 2011-01-01 00:00:00 UTC
+
+	// True if this time stamp is from 2009 or 2010
 	bool isEarly(uint32_t timeStamp)
 	{
-		bool ret = false;
-
-		static char scratch[1024];
-		time_t t(timeStamp);
-		struct tm *gtm = gmtime(&t);
-		uint32_t year = gtm->tm_year + 1900;
-		if (year == 2009 || year == 2010 )
-		{
-			ret = true;
-		}
-
-		return ret;
+		return timeStamp < EARLY_END_DATE;
 	}
 
 	typedef std::vector< uint64_t > TransactionVector;
@@ -565,17 +575,14 @@ namespace PUBLIC_KEY_DATABASE
 	// First, is it a spend or a receive transaction
 	// How much value is involved
 	// What is the timestamp
+	// Plus the running totals for the key as of this transaction, so historical lookups are a binary search by time
 	// Must be exact multiple of 16 bytes
 	class PublicKeyTransaction
 	{
 	public:
-		PublicKeyTransaction(void) : mTransactionOffset(0)
-			, mValue(0)
-			, mTimeStamp(0)
-			, mSpend(false)
-			, mCoinbase(false)
-			, mChange(false)
+		PublicKeyTransaction(void)
 		{
+			memset(this, 0, sizeof(*this));	// zero the padding bytes too, so the records file is identical from build to build
 		}
 		uint64_t	mTransactionOffset;		//  8 : The file offset location to the full transaction details
 		uint64_t	mValue;					// 16 : How much value is in this spend/receive transaction
@@ -583,15 +590,41 @@ namespace PUBLIC_KEY_DATABASE
 		bool		mSpend : 1;				// 24 : is it a spend transaction?
 		bool		mCoinbase : 1;			// is it a coinbase transaction
 		bool		mChange : 1;			// Whether or not this receive was change (came from ourselves)
-		uint64_t	mBalance;				// 8  : 
+		uint64_t	mBalance;				// 32 : Balance of the key after this transaction
+		uint64_t	mTotalReceive;			// 40 : Total value received by the key up to and including this transaction
+		uint32_t	mLastSendTime;			// 44 : Time of the most recent spend up to and including this transaction
+		uint32_t	mLastReceiveTime;		// 48 : Time of the most recent receive up to and including this transaction
 	};
 
 	typedef std::vector< PublicKeyTransaction > PublicKeyTransactionVector;
 
+	// How many transaction slots to reserve on disk for a record holding 'count' transactions.  Most keys are
+	// used once and never again so small records get no slack; busier keys get 25% room to grow in place
+	// when new blocks are added incrementally.
+	uint32_t getRecordCapacity(uint32_t count)
+	{
+		return count + count / 4;
+	}
+
+	// Writes 'count' zeroed transaction slots; the unused tail of a record's capacity
+	void writeEmptyTransactions(FILE_INTERFACE *fph, uint32_t count)
+	{
+		PublicKeyTransaction empty;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			fi_fwrite(&empty, sizeof(empty), 1, fph);
+		}
+	}
+
 	// This class represents the collection of all transactions associated with a particular public key
 	class PublicKeyRecord
 	{
 	public:
+		PublicKeyRecord(void) : mKeyType(BlockChain::KT_LAST)	// KT_LAST until an output to this key is seen
+			, mIndex(0)
+		{
+		}
+
 		void save(FILE_INTERFACE *fph)
 		{
 			fi_fwrite(&mKeyType, sizeof(mKeyType), 1, fph);
@@ -599,18 +632,59 @@ namespace PUBLIC_KEY_DATABASE
 			uint32_t count = uint32_t(mTransactions.size());
 			fi_fwrite(&count, sizeof(count), 1, fph);
 			uint32_t padding = 0;
-			uint64_t padding64 = 0;
-			fi_fwrite(&padding, sizeof(padding), 1, fph);
+			fi_fwrite(&padding, sizeof(padding), 1, fph);		// Will be the DaysOld field in PublicKeyRecordFile
+
+			// The summary fields are computed here so the analysis tools do not have to derive them for every key
+			computeRunningTotals(nullptr);
+			PublicKeyTransaction last;
+			if (count)
+			{
+				last = mTransactions[count - 1];
+			}
+			fi_fwrite(&last.mBalance, sizeof(last.mBalance), 1, fph);
+			fi_fwrite(&last.mLastSendTime, sizeof(last.mLastSendTime), 1, fph);
+			fi_fwrite(&last.mLastReceiveTime, sizeof(last.mLastReceiveTime), 1, fph);
 
-			fi_fwrite(&padding64, sizeof(padding64), 1, fph);	// Will be the balance field in PublicKeyRecordFile
-			fi_fwrite(&padding, sizeof(padding), 1, fph);		// Will be the LastSendTime field in the PublicKeyRecordFile
-			fi_fwrite(&padding, sizeof(padding), 1, fph);		// Will be the LastReceiveTime field in the PublicKeyRecordFile
+			uint32_t capacity = getRecordCapacity(count);
+			fi_fwrite(&capacity, sizeof(capacity), 1, fph);
+			fi_fwrite(&padding, sizeof(padding), 1, fph);
 			if (count)
 			{
 				PublicKeyTransaction *p = &mTransactions[0];
 				fi_fwrite(p, sizeof(PublicKeyTransaction)*count, 1, fph);
 			}
+			writeEmptyTransactions(fph, capacity - count);
+		}
+
+		// Fills in the running balance, total received and last send/receive times on each transaction.
+		// 'previous' is the last transaction already stored for this key when appending to an existing record.
+		void computeRunningTotals(const PublicKeyTransaction *previous)
+		{
+			uint64_t balance = previous ? previous->mBalance : 0;
+			uint64_t totalReceive = previous ? previous->mTotalReceive : 0;
+			uint32_t lastSendTime = previous ? previous->mLastSendTime : 0;
+			uint32_t lastReceiveTime = previous ? previous->mLastReceiveTime : 0;
+			for (auto i = mTransactions.begin(); i != mTransactions.end(); ++i)
+			{
+				PublicKeyTransaction &t = (*i);
+				if (t.mSpend)
+				{
+					balance -= t.mValue;
+					lastSendTime = t.mTimeStamp;
+				}
+				else
+				{
+					balance += t.mValue;
+					totalReceive += t.mValue;
+					lastReceiveTime = t.mTimeStamp;
+				}
+				t.mBalance = balance;
+				t.mTotalReceive = totalReceive;
+				t.mLastSendTime = lastSendTime;
+				t.mLastReceiveTime = lastReceiveTime;
+			}
 		}
+
 		BlockChain::KeyType			mKeyType;			// What type of bitcoin key is this?  Standard, MultiSig, Pay2Hash, Stealth?
 		uint32_t					mIndex;				// The array index for this public key (needed after pointer sorting)
 		PublicKeyTransactionVector	mTransactions;		// all transactions in chronological order relative to this public key
@@ -623,113 +697,61 @@ namespace PUBLIC_KEY_DATABASE
 	{
 	public:
 
-		uint64_t getBalance(uint32_t endTime=0xFFFFFFFF) const
+		// Returns the transaction holding the running totals as of 'endTime'; null if the key had no transactions by then.
+		// Transactions are in chronological order so this is a binary search rather than a scan.
+		const PublicKeyTransaction *getTransactionAtTime(uint32_t endTime) const
 		{
-			uint64_t ret = 0;
-			for (uint32_t i = 0; i < mCount; i++)
+			uint32_t low = 0;
+			uint32_t high = mCount;
+			while (low < high)
 			{
-				const PublicKeyTransaction &t = mTransactions[i];
-				if (t.mTimeStamp > endTime)
+				uint32_t middle = low + (high - low) / 2;
+				if (mTransactions[middle].mTimeStamp > endTime)
 				{
-					break;
-				}
-				if (t.mSpend)
-				{
-					ret -= t.mValue;
+					high = middle;
 				}
 				else
 				{
-					ret += t.mValue;
+					low = middle + 1;
 				}
 			}
-			return ret;
+			return low ? &mTransactions[low - 1] : nullptr;
+		}
+
+		// The balance after the last transaction; what getBalance() returns without having to search for it
+		uint64_t getCurrentBalance(void) const
+		{
+			return mCount ? mTransactions[mCount - 1].mBalance : 0;
+		}
+
+		uint64_t getBalance(uint32_t endTime=0xFFFFFFFF) const
+		{
+			const PublicKeyTransaction *t = getTransactionAtTime(endTime);
+			return t ? t->mBalance : 0;
 		}
 
 		uint64_t getTotalSend(uint32_t endTime=0xFFFFFFFF) const
 		{
-			uint64_t ret = 0;
-			for (uint32_t i = 0; i < mCount; i++)
-			{
-				const PublicKeyTransaction &t = mTransactions[i];
-				if (t.mTimeStamp > endTime)
-				{
-					break;
-				}
-				if (t.mSpend)
-				{
-					ret += t.mValue;
-				}
-			}
-			return ret;
+			const PublicKeyTransaction *t = getTransactionAtTime(endTime);
+			return t ? t->mTotalReceive - t->mBalance : 0;
 		}
 
 		uint64_t getTotalReceive(uint32_t endTime=0xFFFFFFFF) const
 		{
-			uint64_t ret = 0;
-			for (uint32_t i = 0; i < mCount; i++)
-			{
-				const PublicKeyTransaction &t = mTransactions[i];
-				if (t.mTimeStamp > endTime)
-				{
-					break;
-				}
-				if (!t.mSpend)
-				{
-					ret += t.mValue;
-				}
-			}
-			return ret;
+			const PublicKeyTransaction *t = getTransactionAtTime(endTime);
+			return t ? t->mTotalReceive : 0;
 		}
 
 		uint32_t getLastSendTime(uint32_t endTime=0xFFFFFFFF) const
 		{
-			uint32_t ret = 0;
-
-			uint32_t count = mCount;
-			if (count)
-			{
-				uint32_t index = count - 1;
-				for (uint32_t i = 0; i < count; i++, index--)
-				{
-					const PublicKeyTransaction &t = mTransactions[index];
-					if (t.mTimeStamp > endTime)
-					{
-						continue;
-					}
-					if (t.mSpend)
-					{
-						ret = t.mTimeStamp;
-						break;
-					}
-				}
-			}
-			return ret;
-		}
-
+			const PublicKeyTransaction *t = getTransactionAtTime(endTime);
+			return t ? t->mLastSendTime : 0;
+		}
 
 		uint32_t getLastReceiveTime(uint32_t endTime=0xFFFFFFFF) const
 		{
-			uint32_t ret = 0;
-
-			uint32_t count = mCount;
-			if (count)
-			{
-				uint32_t index = count - 1;
-				for (uint32_t i = 0; i < count; i++, index--)
-				{
-					const PublicKeyTransaction &t = mTransactions[index];
-					if (t.mTimeStamp > endTime)
-					{
-						continue;
-					}
-					if (!t.mSpend)
-					{
-						ret = t.mTimeStamp;
-						break;
-					}
-				}
-			}
-			return ret;
+			const PublicKeyTransaction *t = getTransactionAtTime(endTime);
+			return t ? t->mLastReceiveTime : 0;
 		}
 
 		uint32_t getAge(void)
@@ -763,10 +785,45 @@ namespace PUBLIC_KEY_DATABASE
 		uint64_t					mBalance;			// 8 bytes Balance.
 		uint32_t					mLastSendTime;		// compute the time of last sent transaction
 		uint32_t					mLastReceiveTime;	// compute the time of the last receive transaction
+		uint32_t					mCapacity;			// Number of transaction slots reserved on disk; mCount can grow up to this in place
+		uint32_t					mReserved;			// Keeps the transactions 8 byte aligned
 
 		PublicKeyTransaction		mTransactions[1];	// This is a bit of a fake; we are accessing this via a memory mapped file so there will be 'mCount' number of actual transactions
 	};
 
+	// The size of the fixed portion of a PublicKeyRecordFile; the transactions follow immediately after it
+	const uint32_t publicKeyRecordHeaderSize = uint32_t(sizeof(PublicKeyRecordFile) - sizeof(PublicKeyTransaction));
+
+	// processTransaction hands each per-key transaction to one of these.  The full build streams them through an
+	// external sort, while the incremental update only collects the keys touched by the newly appended transactions.
+	class PublicKeyRecordSink
+	{
+	public:
+		virtual ~PublicKeyRecordSink(void)
+		{
+		}
+
+		// 'keyType' is KT_LAST for spends, which don't tell us anything about the type of key
+		virtual void addPublicKeyTransaction(uint32_t index, BlockChain::KeyType keyType, const PublicKeyTransaction &pt) = 0;
+	};
+
+	class PublicKeyRecordMap : public PublicKeyRecordSink
+	{
+	public:
+		virtual void addPublicKeyTransaction(uint32_t index, BlockChain::KeyType keyType, const PublicKeyTransaction &pt) override final
+		{
+			PublicKeyRecord &r = mRecords[index];
+			r.mIndex = index;
+			if (keyType != BlockChain::KT_LAST)
+			{
+				r.mKeyType = keyType;
+			}
+			r.mTransactions.push_back(pt);
+		}
+
+		std::unordered_map< uint32_t, PublicKeyRecord >	mRecords;
+	};
+
 	class TransactionHash : public Hash256
 	{
 	public:
@@ -856,17 +913,22 @@ namespace PUBLIC_KEY_DATABASE
 	class TransactionInput
 	{
 	public:
-		TransactionInput(void)
+		TransactionInput(void) : mTransactionFileOffset(0)
+			, mTransactionIndex(0xFFFFFFFF)
+			, mResponseScriptLength(0)
+			, mInputValue(0)
+			, mTimeStamp(0)
+			, mKeyIndex(0xFFFFFFFF)
 		{
-
 		}
-		TransactionInput(const BlockChain::BlockInput &bi, uint64_t fileOffset,uint32_t timeStamp,uint64_t inputValue)
+		TransactionInput(const BlockChain::BlockInput &bi, uint64_t fileOffset,uint32_t timeStamp,uint64_t inputValue,uint32_t keyIndex)
 		{
 			mTransactionFileOffset	= fileOffset;
 			mTransactionIndex		= bi.transactionIndex;
 			mInputValue				= inputValue;
 			mResponseScriptLength = bi.responseScriptLength;
 			mTimeStamp = timeStamp;
+			mKeyIndex = keyIndex;
 		}
 
 		TransactionInput(FILE_INTERFACE *fph)
@@ -876,6 +938,7 @@ namespace PUBLIC_KEY_DATABASE
 			fi_fread(&mInputValue, sizeof(mInputValue), 1, fph);
 			fi_fread(&mResponseScriptLength, sizeof(mResponseScriptLength), 1, fph);
 			fi_fread(&mTimeStamp, sizeof(mTimeStamp), 1, fph);
+			fi_fread(&mKeyIndex, sizeof(mKeyIndex), 1, fph);
 		}
 
 		void save(FILE_INTERFACE *fph)
@@ -885,6 +948,7 @@ namespace PUBLIC_KEY_DATABASE
 			fi_fwrite(&mInputValue, sizeof(mInputValue), 1, fph);
 			fi_fwrite(&mResponseScriptLength, sizeof(mResponseScriptLength), 1, fph);
 			fi_fwrite(&mTimeStamp, sizeof(mTimeStamp), 1, fph);
+			fi_fwrite(&mKeyIndex, sizeof(mKeyIndex), 1, fph);
 		}
 
 		void echo(void)
@@ -897,6 +961,7 @@ namespace PUBLIC_KEY_DATABASE
 		uint32_t	mResponseScriptLength;			// The length of the response script
 		uint64_t	mInputValue;					// The input value
 		uint32_t	mTimeStamp;
+		uint32_t	mKeyIndex;						// The public key index of the output being spent (0xFFFFFFFF for coinbase); saves re-reading the previous transaction
 	};
 
 	typedef std::vector< TransactionInput > TransactionInputVector;
@@ -983,9 +1048,9 @@ namespace PUBLIC_KEY_DATABASE
 			}
 		}
 
-		void addInput(const BlockChain::BlockInput &bi, uint64_t fileOffset,uint32_t timeStamp,uint64_t inputValue)
+		void addInput(const BlockChain::BlockInput &bi, uint64_t fileOffset,uint32_t timeStamp,uint64_t inputValue,uint32_t keyIndex)
 		{
-			TransactionInput ti(bi, fileOffset,timeStamp,inputValue);
+			TransactionInput ti(bi, fileOffset,timeStamp,inputValue,keyIndex);
 			mInputs.push_back(ti);
 		}
 
@@ -1021,13 +1086,143 @@ namespace PUBLIC_KEY_DATABASE
 		uint8_t						mTransactionHash[32];				// The transaction hash
 		uint32_t					mBlockNumber;						// Which block this transaction resides in
 		uint32_t					mTransactionVersionNumber;			// The transaction version number
-		uint32_t					mTransactionTime;					// The time of the transaction (approximate, based on the block time stamp this transaction was contained in)
+		uint32_t					mTransactionTime;					// The time of the transaction (approximate, based on the block time stamp this transaction was contained in; see addBlock)
 		uint32_t					mLockTime;							// The lock time
 		uint32_t					mTransactionSize;					// The size of the transaction (in bytes)
 		TransactionInputVector		mInputs;							// The total number of inputs in the transaction
 		TransactionOutputVector		mOutputs;							// The total number of outputs in the transaction
 	};
 
+	// An output which was more than ZOMBIE_TIME days old when it was spent; everything ZombieReport.csv needs is recorded
+	// when it is found, so the report never has to go back to the transaction which created it.  Packed to 20 bytes,
+	// since there is one for every zombie input in the blockchain.
+#pragma pack(push, 4)
+	class ZombieInput
+	{
+	public:
+		ZombieInput(void)
+		{
+		}
+		ZombieInput(const TransactionInput &input, uint32_t spendTime) : mValue(input.mInputValue)
+			, mKeyIndex(input.mKeyIndex)
+			, mOriginTime(input.mTimeStamp)
+			, mSpendTime(spendTime)
+		{
+		}
+		uint64_t	mValue;				// The value of the output, in satoshis
+		uint32_t	mKeyIndex;			// The public key it paid to
+		uint32_t	mOriginTime;		// When the output was created
+		uint32_t	mSpendTime;			// When it was spent
+	};
+#pragma pack(pop)
+
+	typedef std::vector< ZombieInput > ZombieInputVector;
+
+	// A transaction read in place from the memory mapped TransactionFile.bin, in the layout written by Transaction::save.
+	// Nothing is copied until an input or output is asked for, so passes which only need a few fields skip the rest.
+	class TransactionView
+	{
+	public:
+		static const uint32_t HEADER_SIZE = 32 + sizeof(uint32_t) * 5;		// Hash, block number, version, time, lock time and size
+		static const uint32_t INPUT_SIZE = sizeof(uint64_t) * 2 + sizeof(uint32_t) * 4;
+		static const uint32_t OUTPUT_SIZE = sizeof(uint64_t) + sizeof(uint32_t) * 2 + sizeof(BlockChain::KeyType);
+
+		// Points the view at the transaction at 'offset' in the file mapped at 'base'; false if it doesn't end by 'end'
+		bool read(const uint8_t *base, uint64_t offset, uint64_t end)
+		{
+			uint64_t length = end - offset;
+			if (offset >= end || length < HEADER_SIZE + sizeof(uint32_t))
+			{
+				return false;
+			}
+			mData = base + offset;
+			mOffset = offset;
+			mInputCount = get<uint32_t>(HEADER_SIZE);
+			mOutputs = HEADER_SIZE + sizeof(uint32_t) + uint64_t(mInputCount) * INPUT_SIZE;
+			if (length < mOutputs + sizeof(uint32_t))
+			{
+				return false;
+			}
+			mOutputCount = get<uint32_t>(mOutputs);
+			mOutputs += sizeof(uint32_t);
+			mSize = mOutputs + uint64_t(mOutputCount) * OUTPUT_SIZE;
+			return mSize <= length;
+		}
+
+		// Bytes the transaction takes up in the file
+		uint64_t getSize(void) const
+		{
+			return mSize;
+		}
+
+		// Where the transaction starts in the file
+		uint64_t getOffset(void) const
+		{
+			return mOffset;
+		}
+
+		uint32_t getBlockNumber(void) const
+		{
+			return get<uint32_t>(32);
+		}
+
+		uint32_t getTransactionTime(void) const
+		{
+			return get<uint32_t>(32 + sizeof(uint32_t) * 2);
+		}
+
+		uint32_t getTransactionSize(void) const
+		{
+			return get<uint32_t>(32 + sizeof(uint32_t) * 4);
+		}
+
+		uint32_t getInputCount(void) const
+		{
+			return mInputCount;
+		}
+
+		uint32_t getOutputCount(void) const
+		{
+			return mOutputCount;
+		}
+
+		void getInput(uint32_t index, TransactionInput &input) const
+		{
+			uint64_t offset = HEADER_SIZE + sizeof(uint32_t) + uint64_t(index) * INPUT_SIZE;
+			input.mTransactionFileOffset = get<uint64_t>(offset);
+			input.mTransactionIndex = get<uint32_t>(offset + 8);
+			input.mInputValue = get<uint64_t>(offset + 12);
+			input.mResponseScriptLength = get<uint32_t>(offset + 20);
+			input.mTimeStamp = get<uint32_t>(offset + 24);
+			input.mKeyIndex = get<uint32_t>(offset + 28);
+		}
+
+		void getOutput(uint32_t index, TransactionOutput &output) const
+		{
+			uint64_t offset = mOutputs + uint64_t(index) * OUTPUT_SIZE;
+			output.mValue = get<uint64_t>(offset);
+			output.mIndex = get<uint32_t>(offset + 8);
+			output.mKeyType = get<BlockChain::KeyType>(offset + 12);
+			output.mScriptLength = get<uint32_t>(offset + 12 + sizeof(BlockChain::KeyType));
+		}
+
+	private:
+		template <typename T>
+		T get(uint64_t offset) const
+		{
+			T ret;
+			memcpy(&ret, mData + offset, sizeof(ret));	// The file is packed, so fields are not aligned
+			return ret;
+		}
+
+		const uint8_t	*mData;
+		uint64_t		mOffset;
+		uint32_t		mInputCount;
+		uint32_t		mOutputCount;
+		uint64_t		mOutputs;		// Offset of the outputs
+		uint64_t		mSize;
+	};
+
 
 } // end of PUBLIC_KEY_DATABASE namespace
 
@@ -1078,6 +1273,20 @@ public:
 	uint64_t	mInputIndex;			// The index number of this output
 };
 
+// What we need to know about an unspent output at the moment it is spent
+class UTXOValue
+{
+public:
+	UTXOValue(void) : mValue(0), mKeyIndex(0xFFFFFFFF)
+	{
+	}
+	UTXOValue(uint64_t value, uint32_t keyIndex) : mValue(value), mKeyIndex(keyIndex)
+	{
+	}
+	uint64_t	mValue;				// The value of this output
+	uint32_t	mKeyIndex;			// The public key index this output pays to
+};
+
 class UTXOSTAT
 {
 public:
@@ -1114,154 +1323,1944 @@ namespace PUBLIC_KEY_DATABASE
 #define TRANSACTION_FILE_NAME			"TransactionFile.bin"
 #define PUBLIC_KEY_FILE_NAME			"PublicKeys.bin"
 #define PUBLIC_KEY_RECORDS_FILE_NAME	"PublicKeyRecords.bin"
+#define CHECKPOINT_FILE_NAME			"Checkpoint.bin"
+#define CHECKPOINT_TEMP_FILE_NAME		"Checkpoint.tmp"
+#define PUBLIC_KEY_RECORDS_TEMP_FILE_NAME	"PublicKeyRecords.tmp"
+#define PUBLIC_KEY_RUNS_FILE_NAME		"PublicKeyRuns%u.tmp"		// One per key range being built
+#define PUBLIC_KEY_SEGMENT_FILE_NAME	"PublicKeyRecords%u.tmp"	// The records for one key range, before they are concatenated
+#define BALANCE_SNAPSHOTS_FILE_NAME		"BalanceSnapshots.bin"
+#define PUBLIC_KEY_INDEX_FILE_NAME		"PublicKeyIndex.bin"
+#define PUBLIC_KEY_CLUSTERS_FILE_NAME	"PublicKeyClusters.bin"
+
+#define DEFAULT_MEMORY_BUDGET			(uint64_t(2048)*1024*1024)	// Memory the records build may use for sorting before it spills to disk
+
+#define PUBLIC_KEY_RECORDS_VERSION		3	// Bump whenever the layout of PublicKeyRecords.bin changes
+#define PUBLIC_KEY_RECORDS_GARBAGE_RATIO	4	// Compact the records file once more than 1/4 of it is space abandoned by relocated records
+#define BALANCE_SNAPSHOTS_VERSION		1	// Bump whenever the layout of BalanceSnapshots.bin changes
+#define PUBLIC_KEY_INDEX_VERSION		1	// Bump whenever the layout of PublicKeyIndex.bin changes
+#define PUBLIC_KEY_CLUSTERS_VERSION		1	// Bump whenever the layout of PublicKeyClusters.bin changes
+#define TOP_BALANCES_KEYS_PER_THREAD	65536	// Fewest public keys worth handing to each thread when selecting the top balances
+#define BALANCE_SNAPSHOT_PAGE_SIZE		4096	// Each snapshot column starts on a page boundary so it can be used straight out of the memory map
+#define ADDRESS_QUERY_PREFETCH_DISTANCE	8		// How many queries ahead the batch address query walk prefetches each stage of a record
+#define ADDRESS_QUERY_ROWS_PER_TASK		65536	// Queries decoded or summarized by each task of a batch address query
+#define ADDRESS_SUMMARY_BATCH			(1024*1024)	// Public keys summarized in parallel between writes of the address summary report
+#define ANALYZER_BATCH_SIZE				4096	// Fewest transactions in each batch the analyzer scan hands to the analyzers
+#define ANALYZER_BATCHES_IN_FLIGHT		64		// How many batches the analyzer scan may run ahead of the slowest analyzer
+#define DAILY_HISTOGRAM_PRECISION_BITS	4		// The daily distributions count each value to within 1/16th of itself
 
 	typedef std::unordered_set< PublicKey >			PublicKeySet;			// The unordered set of all public keys
 	typedef std::unordered_set< TransactionHash >	TransactionHashSet;		// The unordered set of all transactions; only contains the file seek offset
-	typedef std::unordered_map< UTXO, uint64_t > UTXOMap;
+	typedef std::unordered_map< UTXO, UTXOValue > UTXOMap;
 	typedef std::unordered_map< UTXO, UTXOSTAT > UTXOStatMap;
 
-	const char *magicID = "0123456789ABCDE";
-
-// Sorting classes
-	class SortByBalance : public HeapSortPointers
+	// The unspent transaction outputs grouped by the day they were created on (see getAgeInDays), kept up to date as
+	// outputs are created and spent.  The daily UTXO age statistics are then one pass over the creation days rather
+	// than over every unspent output; ages are measured in whole days between the creation day and the current day.
+	class UTXOAgeHistogram
 	{
 	public:
-		// -1 less, 0 equal, +1 greater.
-		virtual int32_t compare(void *p1, void *p2) override final
+		UTXOAgeHistogram(void)
+		{
+			reset();
+		}
+
+		void reset(void)
+		{
+			mDays.clear();
+			mCount = 0;
+			mValue = 0;
+			mEarlyCount = 0;
+			mEarlyValue = 0;
+		}
+
+		void add(const UTXOSTAT &stat)
+		{
+			uint32_t day = getAgeInDays(stat.mTimeStamp);
+			if (day >= mDays.size())
+			{
+				mDays.resize(day + 1);
+			}
+			CreationDay &c = mDays[day];
+			c.mCount++;
+			c.mValue += stat.mValue;
+			mCount++;
+			mValue += stat.mValue;
+			if (isEarly(stat.mTimeStamp))
+			{
+				mEarlyCount++;
+				mEarlyValue += stat.mValue;
+			}
+		}
+
+		void remove(const UTXOSTAT &stat)
 		{
-			PublicKeyRecordFile *pkr1 = (PublicKeyRecordFile *)p1;
-			PublicKeyRecordFile *pkr2 = (PublicKeyRecordFile *)p2;
-			if (pkr1->mBalance < pkr2->mBalance)
+			CreationDay &c = mDays[getAgeInDays(stat.mTimeStamp)];
+			c.mCount--;
+			c.mValue -= stat.mValue;
+			mCount--;
+			mValue -= stat.mValue;
+			if (isEarly(stat.mTimeStamp))
 			{
-				return 1;
+				mEarlyCount--;
+				mEarlyValue -= stat.mValue;
 			}
-			if (pkr1->mBalance > pkr2->mBalance)
+		}
+
+		// Fills in the UTXO totals, early coins and age ranges of the statistics for 'day', as of the day 'currentDay'
+		void accumulate(DailyStatisticsTable &d, uint32_t day, uint32_t currentDay) const
+		{
+			d.addDay(day);
+			d.setSum(DS_UTXO_COUNT, day, mCount);
+			d.setSum(DS_UTXO_VALUE, day, mValue);
+			d.setSum(DS_EARLY_COUNT, day, mEarlyCount);
+			d.setSum(DS_EARLY_VALUE, day, mEarlyValue);
+			// Walk from the newest creation day to the oldest, so the age only ever moves up through the ranges
+			uint32_t rank = 0;
+			uint32_t maxAge = getAgeRankDays(AgeRank(rank));
+			for (uint32_t creationDay = uint32_t(mDays.size()); creationDay-- > 0;)
 			{
-				return -1;
+				const CreationDay &c = mDays[creationDay];
+				if (c.mCount == 0)
+				{
+					continue;
+				}
+				uint32_t age = currentDay > creationDay ? currentDay - creationDay : 0;
+				while (rank < AR_LAST - 1 && age > maxAge)
+				{
+					rank++;
+					maxAge = getAgeRankDays(AgeRank(rank));
+				}
+				d.addSum(DS_AGE_COUNT + rank, day, c.mCount);
+				d.addSum(DS_AGE_VALUE + rank, day, c.mValue);
 			}
-			return 0;
 		}
+
+	private:
+		class CreationDay
+		{
+		public:
+			CreationDay(void) : mCount(0)
+				, mValue(0)
+			{
+			}
+			uint32_t	mCount;
+			uint64_t	mValue;
+		};
+
+		std::vector< CreationDay >	mDays;			// Indexed by creation day, up to the newest one seen
+		uint32_t					mCount;			// Every unspent output
+		uint64_t					mValue;
+		uint32_t					mEarlyCount;	// The unspent outputs created in 2009 or 2010
+		uint64_t					mEarlyValue;
 	};
 
+	// One metric computed from a chronological scan of TransactionFile.bin.  TransactionAnalyzerDriver feeds every
+	// analyzer added to it the same stream of transactions in a single scan, each analyzer on its own thread, so a new
+	// metric costs another thread rather than another pass over the file.  Since the file is decoded, and progress
+	// logged, on the calling thread while they run, analyzers must not log.
+	class TransactionAnalyzer
+	{
+	public:
+		virtual ~TransactionAnalyzer(void)
+		{
+		}
 
+		// Called on the analyzer's thread before the first transaction
+		virtual void begin(void)
+		{
+		}
 
-	class PublicKeyDatabaseImpl : public PublicKeyDatabase
+		virtual void onTransaction(const TransactionView &t) = 0;
+
+		// Called before the first transaction of a day (see getAgeInDays) later than any seen so far; 'lastDay' is the
+		// latest day seen before it, or zero
+		virtual void onDayBoundary(uint32_t /*lastDay*/, uint32_t /*day*/)
+		{
+		}
+
+		// Called once every transaction has been seen, and every shard merged
+		virtual void end(void)
+		{
+		}
+
+		// Analyzers whose results don't depend on the order of the blocks may return a new, empty analyzer of the same
+		// kind.  The driver then splits the blocks between the original and its shards, which each see whole blocks in
+		// order along with the day boundaries among them, and hands each shard back to mergeShard once the scan is done.
+		virtual TransactionAnalyzer *createShard(void)
+		{
+			return nullptr;
+		}
+
+		// Folds in the results of a shard; the driver deletes it afterwards
+		virtual void mergeShard(TransactionAnalyzer * /*shard*/)
+		{
+		}
+	};
+
+	typedef std::vector< TransactionAnalyzer * > TransactionAnalyzerVector;
+
+	// Runs a set of analyzers over TransactionFile.bin in one scan.  The calling thread walks the memory mapped file,
+	// cutting it into batches of whole blocks, and every analyzer's thread works through the same batches; a batch is
+	// reused once every thread has finished with it, so the scan never runs more than ANALYZER_BATCHES_IN_FLIGHT
+	// batches ahead of the slowest analyzer.
+	class TransactionAnalyzerDriver
 	{
 	public:
-		PublicKeyDatabaseImpl(bool analyze) : mPublicKeyCount(0)
-			, mTransactionFile(nullptr)
-			, mPublicKeyFile(nullptr)
-			, mAnalyze(analyze)
-			, mAddresses(nullptr)
-			, mAddressFile(nullptr)
-			, mPublicKeyRecordFile(nullptr)
-			, mPublicKeyRecordBaseAddress(nullptr)
-			, mPublicKeyRecordOffsets(nullptr)
-			, mPublicKeyRecordSorted(nullptr)
-			, mTransactionFileCountSeekLocation(0)
-			, mPublicKeyFileCountSeekLocation(0)
-			, mTransactionCount(0)
-			, mDailyStatistics(nullptr)
-			, mFirstTransactionOffset(0)
+		void addAnalyzer(TransactionAnalyzer *analyzer)
 		{
-			if (analyze)
+			mAnalyzers.push_back(analyzer);
+		}
+
+		// Scans the transactions in [first,last) of the file mapped at 'base'.  'threadCount' (zero means one per
+		// hardware thread) decides how many shards the analyzers which can be sharded are split into; every analyzer
+		// always gets at least one thread of its own.
+		void run(const uint8_t *base, uint64_t first, uint64_t last, uint32_t threadCount)
+		{
+			if (threadCount == 0)
 			{
-				openTransactionsFile();
-				loadPublicKeyFile();
-				loadPublicKeyRecordsFile();
+				threadCount = ThreadPool::getHardwareThreadCount();
 			}
-			else
+			// Analyzers which can be sharded share whatever threads are left over once every other analyzer has one
+			uint32_t shardable = 0;
+			std::vector< TransactionAnalyzer * > firstShards;
+			for (auto i = mAnalyzers.begin(); i != mAnalyzers.end(); ++i)
 			{
-				uint32_t key = 'y';
-				FILE_INTERFACE *fph = fi_fopen(TRANSACTION_FILE_NAME, "rb", 0, 0, false);
-				if (fph)
+				firstShards.push_back((*i)->createShard());
+				shardable += firstShards.back() ? 1 : 0;
+			}
+			uint32_t ordered = uint32_t(mAnalyzers.size()) - shardable;
+			uint32_t shardCount = shardable && threadCount > ordered ? std::max(1U, (threadCount - ordered) / shardable) : 1;
+
+			// One consumer per analyzer, plus one per extra shard of the analyzers which can be split
+			mConsumers.clear();
+			for (size_t i = 0; i < mAnalyzers.size(); i++)
+			{
+				Consumer c;
+				c.mAnalyzer = mAnalyzers[i];
+				c.mOwner = nullptr;
+				c.mStride = firstShards[i] ? shardCount : 1;
+				c.mPhase = 0;
+				c.mNextBatch = 0;
+				mConsumers.push_back(c);
+				if (firstShards[i] && shardCount == 1)
 				{
-					fi_fclose(fph);
-					logMessage("A pre-processed transactions database already exists!\n");
-					logMessage("Are you sure you want to delete it and start over?\n");
-					logMessage("Press 'y' to continue, any other key to cancel.\n");
-					key = getKey();
+					delete firstShards[i];
 				}
-				if (key == 'y')
+				for (c.mPhase = 1; c.mPhase < c.mStride; c.mPhase++)
 				{
-					fi_deleteFile(PUBLIC_KEY_RECORDS_FILE_NAME);
-					mTransactionFile = fi_fopen(TRANSACTION_FILE_NAME, "wb+", nullptr, 0, false);
-					if (mTransactionFile)
-					{
-						size_t slen = strlen(magicID);
-						fi_fwrite(magicID, slen + 1, 1, mTransactionFile);
-						mTransactionFileCountSeekLocation = uint32_t(fi_ftell(mTransactionFile));
-						fi_fwrite(&mTransactionCount, sizeof(mTransactionCount), 1, mTransactionFile); // save the number of transactions
-						fi_fflush(mTransactionFile);
-						mPublicKeyFile = fi_fopen(PUBLIC_KEY_FILE_NAME, "wb+", nullptr, 0, false);
-						if (mPublicKeyFile)
-						{
-							size_t slen = strlen(magicID);
-							fi_fwrite(magicID, slen + 1, 1, mPublicKeyFile);
-							mPublicKeyFileCountSeekLocation = uint32_t(fi_ftell(mPublicKeyFile));
-							fi_fwrite(&mPublicKeyCount, sizeof(mPublicKeyCount), 1, mPublicKeyFile); // save the number of transactions
-							fi_fflush(mPublicKeyFile);
-						}
-						else
-						{
-							logMessage("Failed to open file '%s' for write access.\n", PUBLIC_KEY_FILE_NAME);
-						}
-					}
-					else
-					{
-						logMessage("Failed to open file '%s' for write access.\n", TRANSACTION_FILE_NAME);
-					}
+					c.mAnalyzer = c.mPhase == 1 ? firstShards[i] : mAnalyzers[i]->createShard();
+					c.mOwner = mAnalyzers[i];
+					mConsumers.push_back(c);
 				}
 			}
-		}
+			mBatches.resize(ANALYZER_BATCHES_IN_FLIGHT);
+			mProduced = 0;
+			mFinished = false;
+			uint32_t consumerCount = uint32_t(mConsumers.size());
+
+			// Every consumer must be running at once, or the scan would wait forever for one which never started
+			ThreadPool *pool = ThreadPool::create(consumerCount);
+			for (uint32_t i = 0; i < consumerCount; i++)
+			{
+				pool->addTask([this, i]()
+				{
+					consume(mConsumers[i]);
+				});
+			}
+			produce(base, first, last);
+			pool->waitForTasks();
+			pool->release();
 
-		virtual ~PublicKeyDatabaseImpl(void)
-		{
-			logMessage("~PublicKeyDatabaseImpl destructor\n");
-			delete[]mDailyStatistics;
-			if (mTransactionFile)
+			for (auto i = mConsumers.begin(); i != mConsumers.end(); ++i)
 			{
-				fi_fclose(mTransactionFile);
+				if ((*i).mOwner)
+				{
+					(*i).mAnalyzer->end();
+				}
 			}
-			if (mPublicKeyRecordFile)
+			for (auto i = mConsumers.begin(); i != mConsumers.end(); ++i)
 			{
-				fi_fclose(mPublicKeyRecordFile);
+				if ((*i).mOwner)
+				{
+					(*i).mOwner->mergeShard((*i).mAnalyzer);
+					delete (*i).mAnalyzer;
+				}
 			}
-			if (mAddressFile)
+			for (auto i = mAnalyzers.begin(); i != mAnalyzers.end(); ++i)
 			{
-				fi_fclose(mAddressFile);
+				(*i)->end();
 			}
+			mConsumers.clear();
+			mBatches.clear();
 		}
 
-		virtual void addBlock(const BlockChain::Block *b) override final
+	private:
+		class DayBoundary
 		{
-			if (!mTransactionFile || mAnalyze )
-			{
-				return;
-			}
-
-			for (uint32_t i = 0; i < b->transactionCount; i++)
-			{
-				uint64_t fileOffset = uint64_t(fi_ftell(mTransactionFile)); // the file offset for this transaction data
-				const BlockChain::BlockTransaction &bt = b->transactions[i];
+		public:
+			uint32_t	mTransaction;		// Index in the batch of the first transaction of the new day
+			uint32_t	mLastDay;
+			uint32_t	mDay;
+		};
 
-				Transaction t(bt,b->timeStamp,b->blockIndex);
+		class Batch
+		{
+		public:
+			std::vector< TransactionView >	mTransactions;
+			std::vector< DayBoundary >		mDayBoundaries;
+		};
 
-				for (uint32_t i = 0; i < bt.inputCount; i++)
+		class Consumer
+		{
+		public:
+			TransactionAnalyzer	*mAnalyzer;
+			TransactionAnalyzer	*mOwner;		// The analyzer this is a shard of; nullptr for the analyzer itself
+			uint32_t			mStride;		// This consumer handles the batches whose number modulo mStride is mPhase
+			uint32_t			mPhase;
+			uint64_t			mNextBatch;		// The next batch this consumer will look at
+		};
+
+		void produce(const uint8_t *base, uint64_t first, uint64_t last)
+		{
+			uint32_t lastDay = 0;
+			uint32_t lastBlock = 0xFFFFFFFF;
+			uint32_t transactionCount = 0;
+			TransactionView t;
+			uint64_t offset = first;
+			while (offset < last)
+			{
+				// Wait for the slowest consumer to finish with the batch which is about to be reused
 				{
-					const BlockChain::BlockInput &bi = bt.inputs[i];
-					Hash256 h(bi.transactionHash);
-					TransactionHash th(h);
-					TransactionHashSet::iterator found = mTransactions.find(th);
-					uint64_t fileOffset = 0;
-					uint32_t timeStamp = 0;
-					uint64_t inputValue = 0;
-					if (found == mTransactions.end())
+					std::unique_lock< std::mutex > lock(mMutex);
+					mBatchDone.wait(lock, [this]()
 					{
-						timeStamp = b->timeStamp; // if it's a coinbase transaction, we just use the block time as the timestamp
-						if (bi.transactionIndex != 0xFFFFFFFF) // If it is not a coinbase transaction, then assert
+						return mProduced - getSlowestBatch() < ANALYZER_BATCHES_IN_FLIGHT;
+					});
+				}
+				Batch &b = mBatches[mProduced % ANALYZER_BATCHES_IN_FLIGHT];
+				b.mTransactions.clear();
+				b.mDayBoundaries.clear();
+				while (offset < last && t.read(base, offset, last))
+				{
+					// Batches only ever end between blocks
+					if (b.mTransactions.size() >= ANALYZER_BATCH_SIZE && t.getBlockNumber() != lastBlock)
+					{
+						break;
+					}
+					lastBlock = t.getBlockNumber();
+					uint32_t day = getAgeInDays(t.getTransactionTime());
+					if (day > lastDay)
+					{
+						DayBoundary d;
+						d.mTransaction = uint32_t(b.mTransactions.size());
+						d.mLastDay = lastDay;
+						d.mDay = day;
+						b.mDayBoundaries.push_back(d);
+						lastDay = day;
+						// Logged here rather than by the analyzers; they run on the consumer threads and must not log
+						logMessage("Processing the transactions of %s\r\n", getDateString(t.getTransactionTime()));
+					}
+					b.mTransactions.push_back(t);
+					offset += t.getSize();
+					transactionCount++;
+					if ((transactionCount % 10000) == 0)
+					{
+						logMessage("Processing transaction %s\n", formatNumber(transactionCount));
+					}
+				}
+				if (b.mTransactions.empty())
+				{
+					break;
+				}
+				std::lock_guard< std::mutex > lock(mMutex);
+				mProduced++;
+				mBatchReady.notify_all();
+			}
+			std::lock_guard< std::mutex > lock(mMutex);
+			mFinished = true;
+			mBatchReady.notify_all();
+		}
+
+		void consume(Consumer &c)
+		{
+			c.mAnalyzer->begin();
+			for (;;)
+			{
+				{
+					std::unique_lock< std::mutex > lock(mMutex);
+					mBatchReady.wait(lock, [this, &c]()
+					{
+						return c.mNextBatch < mProduced || mFinished;
+					});
+					if (c.mNextBatch >= mProduced)
+					{
+						break;
+					}
+				}
+				if ((c.mNextBatch % c.mStride) == c.mPhase)
+				{
+					const Batch &b = mBatches[c.mNextBatch % ANALYZER_BATCHES_IN_FLIGHT];
+					auto boundary = b.mDayBoundaries.begin();
+					for (uint32_t i = 0; i < uint32_t(b.mTransactions.size()); i++)
+					{
+						if (boundary != b.mDayBoundaries.end() && (*boundary).mTransaction == i)
+						{
+							c.mAnalyzer->onDayBoundary((*boundary).mLastDay, (*boundary).mDay);
+							++boundary;
+						}
+						c.mAnalyzer->onTransaction(b.mTransactions[i]);
+					}
+				}
+				std::lock_guard< std::mutex > lock(mMutex);
+				c.mNextBatch++;
+				mBatchDone.notify_all();
+			}
+		}
+
+		// Called with mMutex held
+		uint64_t getSlowestBatch(void) const
+		{
+			uint64_t ret = mProduced;
+			for (auto i = mConsumers.begin(); i != mConsumers.end(); ++i)
+			{
+				ret = std::min(ret, (*i).mNextBatch);
+			}
+			return ret;
+		}
+
+		TransactionAnalyzerVector	mAnalyzers;
+		std::vector< Consumer >		mConsumers;
+		std::vector< Batch >		mBatches;		// Used round robin; batch n is in mBatches[n % ANALYZER_BATCHES_IN_FLIGHT]
+		uint64_t					mProduced;		// Batches handed to the consumers so far
+		bool						mFinished;		// The scan has reached the end of the transactions
+		std::mutex					mMutex;
+		std::condition_variable		mBatchReady;
+		std::condition_variable		mBatchDone;
+	};
+
+	// The per day transaction, input and output totals and maxima
+	class DailyTransactionAnalyzer : public TransactionAnalyzer
+	{
+	public:
+		virtual void onTransaction(const TransactionView &t) override final
+		{
+			DailyStatisticsTable &d = mTable;
+			uint32_t transactionTime = t.getTransactionTime();
+			uint32_t day = getAgeInDays(transactionTime);
+			uint32_t inputCount = t.getInputCount();
+			uint32_t outputCount = t.getOutputCount();
+			d.addDay(day);
+			d.addBlockTransaction(day, t.getBlockNumber());
+			d.addSum(DS_TRANSACTION_COUNT, day, 1);
+			d.addSum(DS_TRANSACTION_SIZE, day, t.getTransactionSize());
+			d.addSum(DS_INPUT_COUNT, day, inputCount);
+			d.addSum(DS_OUTPUT_COUNT, day, outputCount);
+			d.setMax(DM_INPUT_COUNT, day, inputCount);
+			d.setMax(DM_OUTPUT_COUNT, day, outputCount);
+			d.setMax(DM_TRANSACTION_SIZE, day, t.getTransactionSize());
+			// iterate through all of the inputs on this transaction and accumulate daily stats
+			TransactionInput input;
+			for (uint32_t i = 0; i < inputCount; i++)
+			{
+				t.getInput(i, input);
+				if (input.mTransactionIndex != 0xFFFFFFFF && input.mInputValue < DUST_VALUE)
+				{
+					d.addSum(DS_DUST_COUNT, day, 1);
+				}
+				d.addSum(DS_INPUT_SCRIPT_LENGTH, day, input.mResponseScriptLength);
+				d.addSum(DS_INPUT_VALUE, day, input.mInputValue);
+				d.setMax(DM_INPUT_SCRIPT_LENGTH, day, input.mResponseScriptLength);
+				d.setMax(DM_INPUT_VALUE, day, input.mInputValue);
+				d.setMax(DM_INPUT_AGE, day, getAgeInDays(input.mTimeStamp, transactionTime));
+			}
+			TransactionOutput output;
+			for (uint32_t i = 0; i < outputCount; i++)
+			{
+				t.getOutput(i, output);
+				d.addSum(DS_OUTPUT_SCRIPT_LENGTH, day, output.mScriptLength);
+				d.addSum(DS_OUTPUT_VALUE, day, output.mValue);
+				d.setMax(DM_OUTPUT_SCRIPT_LENGTH, day, output.mScriptLength);
+				d.setMax(DM_OUTPUT_VALUE, day, output.mValue);
+				d.addSum(DS_KEY_TYPE_COUNT + output.mKeyType, day, 1);
+			}
+			if (d.mTimeStamp[day] == 0 || transactionTime < d.mTimeStamp[day])
+			{
+				d.mTimeStamp[day] = transactionTime;
+			}
+		}
+
+		virtual TransactionAnalyzer *createShard(void) override final
+		{
+			return new DailyTransactionAnalyzer;
+		}
+
+		virtual void mergeShard(TransactionAnalyzer *shard) override final
+		{
+			mTable.merge(static_cast<DailyTransactionAnalyzer *>(shard)->mTable);
+		}
+
+		DailyStatisticsTable	mTable;
+	};
+
+	// How many transactions fall in each ValueType range.  The smaller of two outputs (most likely the payment rather
+	// than the change) is counted, and otherwise the largest output.
+	class ValueDistributionAnalyzer : public TransactionAnalyzer
+	{
+	public:
+		virtual void onTransaction(const TransactionView &t) override final
+		{
+			uint32_t day = getAgeInDays(t.getTransactionTime());
+			uint32_t outputCount = t.getOutputCount();
+			TransactionOutput output;
+			uint64_t value = 0;
+			for (uint32_t i = 0; i < outputCount; i++)
+			{
+				t.getOutput(i, output);
+				if (i == 0 || (outputCount == 2 ? output.mValue < value : output.mValue > value))
+				{
+					value = output.mValue;
+				}
+			}
+			assert(outputCount); // should never happen!?
+			if (outputCount)
+			{
+				ValueType type = getValueType(value);
+				mTable.addDay(day);
+				mTable.addSum(DS_VALUE_COUNT + type, day, 1);
+				mTable.addSum(DS_VALUE_TOTAL + type, day, value);
+			}
+		}
+
+		virtual TransactionAnalyzer *createShard(void) override final
+		{
+			return new ValueDistributionAnalyzer;
+		}
+
+		virtual void mergeShard(TransactionAnalyzer *shard) override final
+		{
+			mTable.merge(static_cast<ValueDistributionAnalyzer *>(shard)->mTable);
+		}
+
+		DailyStatisticsTable	mTable;
+	};
+
+	// The inputs spent more than ZOMBIE_TIME days after they were created, and the zombie score of each day.  The
+	// zombie inputs are listed in the order they were spent, so this one is not sharded.
+	class ZombieAnalyzer : public TransactionAnalyzer
+	{
+	public:
+		virtual void onTransaction(const TransactionView &t) override final
+		{
+			uint32_t transactionTime = t.getTransactionTime();
+			uint32_t day = getAgeInDays(transactionTime);
+			mTable.addDay(day);
+			TransactionInput input;
+			for (uint32_t i = 0; i < t.getInputCount(); i++)
+			{
+				t.getInput(i, input);
+				uint32_t age = getAgeInDays(input.mTimeStamp, transactionTime);
+				if (age > ZOMBIE_TIME)
+				{
+					mZombies.push_back(ZombieInput(input, transactionTime));
+					mTable.addSum(DS_ZOMBIE_INPUT_COUNT, day, 1);
+					mTable.addSum(DS_ZOMBIE_INPUT_VALUE, day, input.mInputValue);
+				}
+				mTable.mZombieScore[day] += (double)(age*age)*(double(input.mInputValue) / ONE_BTC);
+			}
+		}
+
+		DailyStatisticsTable	mTable;
+		ZombieInputVector		mZombies;
+	};
+
+	// The unspent transaction outputs as of the start of each day, their total, the early coins among them and how
+	// old they are.  Depends on seeing the transactions in order, so this one is not sharded.
+	class UTXOAgeAnalyzer : public TransactionAnalyzer
+	{
+	public:
+		virtual void onDayBoundary(uint32_t lastDay, uint32_t day) override final
+		{
+			mAges.accumulate(mTable, lastDay, day);
+		}
+
+		virtual void onTransaction(const TransactionView &t) override final
+		{
+			TransactionInput input;
+			for (uint32_t i = 0; i < t.getInputCount(); i++)
+			{
+				t.getInput(i, input);
+				if (input.mTransactionIndex != 0xFFFFFFFF)
+				{
+					UTXOStatMap::iterator found = mOutputs.find(UTXO(input.mTransactionFileOffset, input.mTransactionIndex));
+					assert(found != mOutputs.end());
+					if (found != mOutputs.end())
+					{
+						mAges.remove((*found).second);
+						mOutputs.erase(found);
+					}
+				}
+			}
+			uint32_t transactionTime = t.getTransactionTime();
+			TransactionOutput output;
+			for (uint32_t i = 0; i < t.getOutputCount(); i++)
+			{
+				t.getOutput(i, output);
+				UTXOSTAT stat(output.mValue, transactionTime);
+				auto inserted = mOutputs.insert(std::make_pair(UTXO(t.getOffset(), i), stat));
+				if (!inserted.second)
+				{
+					mAges.remove((*inserted.first).second);
+					(*inserted.first).second = stat;
+				}
+				mAges.add(stat);
+			}
+		}
+
+		virtual void end(void) override final
+		{
+			mOutputs.clear();
+		}
+
+		DailyStatisticsTable	mTable;
+		UTXOStatMap				mOutputs;
+		UTXOAgeHistogram		mAges;
+	};
+
+	// High resolution distributions of the output values, transaction sizes, input ages and script lengths of each day
+	class DailyHistogramAnalyzer : public TransactionAnalyzer
+	{
+	public:
+		enum Metric
+		{
+			HM_OUTPUT_VALUE,				// Satoshis
+			HM_TRANSACTION_SIZE,			// Bytes
+			HM_INPUT_AGE,					// Days since the output an input spends was created
+			HM_INPUT_SCRIPT_LENGTH,
+			HM_OUTPUT_SCRIPT_LENGTH,
+			HM_LAST
+		};
+
+		class Day
+		{
+		public:
+			Day(void)
+			{
+				for (uint32_t i = 0; i < HM_LAST; i++)
+				{
+					mHistograms[i] = Histogram(DAILY_HISTOGRAM_PRECISION_BITS);
+				}
+			}
+			Histogram	mHistograms[HM_LAST];
+		};
+
+		virtual void onTransaction(const TransactionView &t) override final
+		{
+			uint32_t transactionTime = t.getTransactionTime();
+			uint32_t day = getAgeInDays(transactionTime);
+			if (day >= mDays.size())
+			{
+				mDays.resize(day + 1);
+			}
+			Histogram *h = mDays[day].mHistograms;
+			h[HM_TRANSACTION_SIZE].add(t.getTransactionSize());
+			TransactionInput input;
+			for (uint32_t i = 0; i < t.getInputCount(); i++)
+			{
+				t.getInput(i, input);
+				h[HM_INPUT_SCRIPT_LENGTH].add(input.mResponseScriptLength);
+				if (input.mTransactionIndex != 0xFFFFFFFF)
+				{
+					h[HM_INPUT_AGE].add(getAgeInDays(input.mTimeStamp, transactionTime));
+				}
+			}
+			TransactionOutput output;
+			for (uint32_t i = 0; i < t.getOutputCount(); i++)
+			{
+				t.getOutput(i, output);
+				h[HM_OUTPUT_VALUE].add(output.mValue);
+				h[HM_OUTPUT_SCRIPT_LENGTH].add(output.mScriptLength);
+			}
+		}
+
+		virtual TransactionAnalyzer *createShard(void) override final
+		{
+			return new DailyHistogramAnalyzer;
+		}
+
+		virtual void mergeShard(TransactionAnalyzer *shard) override final
+		{
+			const DailyHistogramAnalyzer *s = static_cast<const DailyHistogramAnalyzer *>(shard);
+			if (s->mDays.size() > mDays.size())
+			{
+				mDays.resize(s->mDays.size());
+			}
+			for (size_t day = 0; day < s->mDays.size(); day++)
+			{
+				for (uint32_t i = 0; i < HM_LAST; i++)
+				{
+					mDays[day].mHistograms[i].merge(s->mDays[day].mHistograms[i]);
+				}
+			}
+		}
+
+		std::vector< Day >	mDays;		// Indexed by day (see getAgeInDays)
+	};
+
+	// Finds the cluster of a public key in a union-find forest shared by several threads.  A key's parent only ever
+	// moves to a lower key index, so each step may safely point a key at its grandparent (path halving); if another
+	// thread got there first the compare and swap just fails and the walk carries on.
+	uint32_t findCluster(std::atomic< uint32_t > *parents, uint32_t key)
+	{
+		for (;;)
+		{
+			uint32_t parent = parents[key].load(std::memory_order_relaxed);
+			if (parent == key)
+			{
+				return key;
+			}
+			uint32_t grandParent = parents[parent].load(std::memory_order_relaxed);
+			if (grandParent != parent)
+			{
+				parents[key].compare_exchange_weak(parent, grandParent, std::memory_order_relaxed);
+			}
+			key = grandParent;
+		}
+	}
+
+	// Merges the clusters of two public keys.  The root with the higher key index is hung under the other, so every
+	// cluster ends up named by its lowest key index whatever order the threads join them in.  The compare and swap fails
+	// if another thread hung the root somewhere else in the meantime, in which case the roots are found again.
+	void joinClusters(std::atomic< uint32_t > *parents, uint32_t a, uint32_t b)
+	{
+		for (;;)
+		{
+			a = findCluster(parents, a);
+			b = findCluster(parents, b);
+			if (a == b)
+			{
+				return;
+			}
+			if (a < b)
+			{
+				std::swap(a, b);
+			}
+			uint32_t expected = a;
+			if (parents[a].compare_exchange_strong(expected, b))
+			{
+				return;
+			}
+		}
+	}
+
+	// Joins the public keys spent from in each transaction into one cluster, on the assumption that whoever signed a
+	// transaction controls every key it spends from.  Every shard joins clusters in the same shared forest, which
+	// doesn't care what order the transactions arrive in, so there is nothing to merge afterwards.
+	class ClusterAnalyzer : public TransactionAnalyzer
+	{
+	public:
+		ClusterAnalyzer(std::atomic< uint32_t > *parents, uint32_t keyCount) : mParents(parents)
+			, mKeyCount(keyCount)
+		{
+		}
+
+		virtual void onTransaction(const TransactionView &t) override final
+		{
+			uint32_t first = 0xFFFFFFFF;
+			TransactionInput input;
+			for (uint32_t i = 0; i < t.getInputCount(); i++)
+			{
+				t.getInput(i, input);
+				if (input.mTransactionIndex == 0xFFFFFFFF || input.mKeyIndex >= mKeyCount)
+				{
+					continue;
+				}
+				if (first == 0xFFFFFFFF)
+				{
+					first = input.mKeyIndex;
+				}
+				else if (input.mKeyIndex != first)
+				{
+					joinClusters(mParents, first, input.mKeyIndex);
+				}
+			}
+		}
+
+		virtual TransactionAnalyzer *createShard(void) override final
+		{
+			return new ClusterAnalyzer(mParents, mKeyCount);
+		}
+
+		std::atomic< uint32_t >	*mParents;		// The parent of each public key; a key which is its own parent names its cluster
+		uint32_t				mKeyCount;
+	};
+
+	const char *magicID = "0123456789ABCDE";
+	const char *transactionFileMagicID = "TRANSACTIONS003";	// Changes whenever the layout, or meaning, of a saved Transaction does
+
+	// Records how far ingest had progressed the last time both database files were known to be consistent.
+	// Everything else (the interned public keys, the transaction hash table and the UTXO set) can be rebuilt
+	// from a sequential scan of the files themselves; so the checkpoint is tiny and cheap to write.
+	class IngestCheckpoint
+	{
+	public:
+		IngestCheckpoint(void) : mBlockIndex(0)
+			, mTransactionCount(0)
+			, mPublicKeyCount(0)
+			, mTransactionFileLength(0)
+			, mPublicKeyFileLength(0)
+		{
+			memset(mBlockHash, 0, sizeof(mBlockHash));
+		}
+
+		// Written to a temporary file first and then renamed, so a crash while checkpointing leaves the previous checkpoint intact
+		bool save(void)
+		{
+			bool ret = false;
+			FILE_INTERFACE *fph = fi_fopen(CHECKPOINT_TEMP_FILE_NAME, "wb", nullptr, 0, false);
+			if (fph)
+			{
+				size_t slen = strlen(magicID);
+				fi_fwrite(magicID, slen + 1, 1, fph);
+				fi_fwrite(&mBlockIndex, sizeof(mBlockIndex), 1, fph);
+				fi_fwrite(mBlockHash, sizeof(mBlockHash), 1, fph);
+				fi_fwrite(&mTransactionCount, sizeof(mTransactionCount), 1, fph);
+				fi_fwrite(&mPublicKeyCount, sizeof(mPublicKeyCount), 1, fph);
+				fi_fwrite(&mTransactionFileLength, sizeof(mTransactionFileLength), 1, fph);
+				uint64_t r = fi_fwrite(&mPublicKeyFileLength, sizeof(mPublicKeyFileLength), 1, fph);
+				fi_fflush(fph);
+				fi_fclose(fph);
+				if (r == 1)
+				{
+					fi_deleteFile(CHECKPOINT_FILE_NAME);
+					ret = rename(CHECKPOINT_TEMP_FILE_NAME, CHECKPOINT_FILE_NAME) == 0;
+				}
+			}
+			if (!ret)
+			{
+				logMessage("Failed to write the ingest checkpoint file '%s'\n", CHECKPOINT_FILE_NAME);
+			}
+			return ret;
+		}
+
+		bool load(void)
+		{
+			bool ret = false;
+			FILE_INTERFACE *fph = fi_fopen(CHECKPOINT_FILE_NAME, "rb", nullptr, 0, false);
+			if (fph)
+			{
+				size_t slen = strlen(magicID);
+				char temp[64];
+				if (fi_fread(temp, slen + 1, 1, fph) == 1 && strcmp(temp, magicID) == 0)
+				{
+					fi_fread(&mBlockIndex, sizeof(mBlockIndex), 1, fph);
+					fi_fread(mBlockHash, sizeof(mBlockHash), 1, fph);
+					fi_fread(&mTransactionCount, sizeof(mTransactionCount), 1, fph);
+					fi_fread(&mPublicKeyCount, sizeof(mPublicKeyCount), 1, fph);
+					fi_fread(&mTransactionFileLength, sizeof(mTransactionFileLength), 1, fph);
+					ret = fi_fread(&mPublicKeyFileLength, sizeof(mPublicKeyFileLength), 1, fph) == 1;
+				}
+				fi_fclose(fph);
+			}
+			return ret;
+		}
+
+		uint32_t	mBlockIndex;				// The last block which was completely added to the database
+		uint8_t		mBlockHash[32];				// The hash of that block; the next block we ingest must build on it
+		uint32_t	mTransactionCount;			// The number of unique transactions at this point
+		uint32_t	mPublicKeyCount;			// The number of unique public keys at this point
+		uint64_t	mTransactionFileLength;		// The length of the transactions file at this point
+		uint64_t	mPublicKeyFileLength;		// The length of the public keys file at this point
+	};
+
+	// The fixed header at the start of PublicKeyRecords.bin.  It is followed by the record offsets table and the
+	// sorted pointers table (each 'mPublicKeyCapacity' entries long) and then by the records themselves.
+	// 'mTransactionFileOffset' is how far into the transactions file the records have been built, which is where
+	// an incremental update picks up from.  A value of zero means the file was left half updated and must be rebuilt.
+	class PublicKeyRecordsHeader
+	{
+	public:
+		PublicKeyRecordsHeader(void)
+		{
+			memset(this, 0, sizeof(*this));
+			strcpy(mMagic, magicID);
+			mVersion = PUBLIC_KEY_RECORDS_VERSION;
+		}
+
+		bool read(FILE_INTERFACE *fph)
+		{
+			bool ret = false;
+			if (fi_fread(this, sizeof(*this), 1, fph) == 1)
+			{
+				if (strcmp(mMagic, magicID) == 0 && mVersion == PUBLIC_KEY_RECORDS_VERSION)
+				{
+					ret = true;
+				}
+			}
+			return ret;
+		}
+
+		void write(FILE_INTERFACE *fph)
+		{
+			fi_fseek(fph, 0, SEEK_SET);
+			fi_fwrite(this, sizeof(*this), 1, fph);
+		}
+
+		// Location in the file of the offset table entry for this public key
+		uint64_t getOffsetLocation(uint32_t index) const
+		{
+			return sizeof(PublicKeyRecordsHeader) + uint64_t(index) * sizeof(uint64_t);
+		}
+
+		char		mMagic[16];
+		uint32_t	mPublicKeyCount;			// Number of public keys which have records
+		uint32_t	mVersion;					// PUBLIC_KEY_RECORDS_VERSION
+		uint32_t	mPublicKeyCapacity;			// Number of entries reserved in the offset and sorted tables
+		uint32_t	mTransactionCount;			// Number of transactions collated into the records so far; every one saved, duplicated hashes included
+		uint64_t	mTransactionFileOffset;		// Offset of the first transaction not yet collated into the records
+		uint64_t	mGarbage;					// Bytes abandoned by records which outgrew their capacity and were moved to the end of the file
+	};
+
+	// Writes PublicKeyRecords.bin front to back; records must be handed over in increasing public key index order.
+	// Any keys skipped over are written as empty records.  A writer can also produce a 'segment'; just the records
+	// for one range of keys, without the header and tables, which is later appended to the complete file.
+	class PublicKeyRecordsWriter
+	{
+	public:
+		PublicKeyRecordsWriter(void) : mFile(nullptr)
+			, mSeekLocations(nullptr)
+			, mFirstIndex(0)
+			, mLastIndex(0)
+			, mNextIndex(0)
+			, mSegment(false)
+		{
+			mFileName[0] = 0;
+		}
+
+		~PublicKeyRecordsWriter(void)
+		{
+			close();
+			delete[]mSeekLocations;
+		}
+
+		bool open(uint32_t publicKeyCount,uint32_t transactionCount,uint64_t transactionFileOffset)
+		{
+			mFile = fi_fopen(PUBLIC_KEY_RECORDS_FILE_NAME, "wb+", nullptr, 0, false);
+			if (mFile == nullptr)
+			{
+				logMessage("Failed to open file '%s' for write access.\n", PUBLIC_KEY_RECORDS_FILE_NAME);
+				return false;
+			}
+			strncpy(mFileName, PUBLIC_KEY_RECORDS_FILE_NAME, sizeof(mFileName));
+			mHeader.mPublicKeyCount = publicKeyCount;
+			mHeader.mPublicKeyCapacity = getRecordCapacity(publicKeyCount);
+			mHeader.mTransactionCount = transactionCount;
+			mHeader.mTransactionFileOffset = transactionFileOffset;
+
+			mSeekLocations = new uint64_t[mHeader.mPublicKeyCapacity];	// Allocate memory for the seek locations table
+			memset(mSeekLocations, 0, sizeof(uint64_t)*mHeader.mPublicKeyCapacity);	// Zero out the seek locations table
+			// Write it out *twice*; once for offsets and the second time will be used for sorting all of the public key records
+			if (fi_fwrite(&mHeader, sizeof(mHeader), 1, mFile) != 1 ||
+				fi_fwrite(mSeekLocations, sizeof(uint64_t)*mHeader.mPublicKeyCapacity, 1, mFile) != 1 ||
+				fi_fwrite(mSeekLocations, sizeof(uint64_t)*mHeader.mPublicKeyCapacity, 1, mFile) != 1)	// save this out twice; this one reserved for sorting pointers via the MemoryMapped file address space
+			{
+				logMessage("Failed to write to file '%s'.\n", mFileName);
+				abandon();
+				return false;
+			}
+			mFirstIndex = 0;
+			mLastIndex = publicKeyCount;
+			mNextIndex = 0;
+			mSegment = false;
+			return true;
+		}
+
+		// Writes the records for keys [firstIndex,lastIndex) to their own file; offsets are relative to its start
+		bool openSegment(uint32_t partition,uint32_t firstIndex,uint32_t lastIndex)
+		{
+			snprintf(mFileName, sizeof(mFileName), PUBLIC_KEY_SEGMENT_FILE_NAME, partition);
+			mFile = fi_fopen(mFileName, "wb+", nullptr, 0, false);
+			if (mFile == nullptr)
+			{
+				logMessage("Failed to open file '%s' for write access.\n", mFileName);
+				return false;
+			}
+			mSeekLocations = new uint64_t[lastIndex - firstIndex];
+			mFirstIndex = firstIndex;
+			mLastIndex = lastIndex;
+			mNextIndex = firstIndex;
+			mSegment = true;
+			return true;
+		}
+
+		void write(PublicKeyRecord &r)
+		{
+			assert(r.mIndex >= mNextIndex && r.mIndex < mLastIndex);
+			while (mNextIndex < r.mIndex)
+			{
+				writeEmpty();
+			}
+			mSeekLocations[mNextIndex++ - mFirstIndex] = uint64_t(fi_ftell(mFile)); // remember the offset for this record...
+			r.save(mFile);
+		}
+
+		// Copies a completed segment onto the end of this file, rebasing its record offsets, and deletes it
+		bool appendSegment(PublicKeyRecordsWriter &segment)
+		{
+			assert(!mSegment && segment.mSegment && segment.mFile == nullptr);
+			assert(segment.mFirstIndex == mNextIndex);
+			uint64_t base = uint64_t(fi_ftell(mFile));
+			FILE_INTERFACE *fph = fi_fopen(segment.mFileName, "rb", nullptr, 0, false);
+			if (fph == nullptr)
+			{
+				logMessage("Failed to open file '%s' for read access.\n", segment.mFileName);
+				return false;
+			}
+			const uint64_t COPY_SIZE = 1024 * 1024;
+			uint8_t *buffer = new uint8_t[COPY_SIZE];
+			bool ok = true;
+			for (;;)
+			{
+				uint64_t r = fi_fread(buffer, 1, COPY_SIZE, fph);
+				if (r == 0)
+				{
+					break;
+				}
+				if (fi_fwrite(buffer, 1, r, mFile) != r)
+				{
+					logMessage("Failed to write to file '%s'.\n", mFileName);
+					ok = false;
+					break;
+				}
+			}
+			delete[]buffer;
+			fi_fclose(fph);
+			if (!ok)
+			{
+				return false;
+			}
+			segment.abandon();	// Its contents are now part of this file
+			for (uint32_t i = segment.mFirstIndex; i < segment.mLastIndex; i++)
+			{
+				mSeekLocations[i] = base + segment.mSeekLocations[i - segment.mFirstIndex];
+			}
+			mNextIndex = segment.mLastIndex;
+			return true;
+		}
+
+		// Pads out the remaining keys and, for the complete file, writes the offsets table.  Only called once every
+		// record has been written; a failed build must call abandon() instead.
+		bool close(void)
+		{
+			if (mFile)
+			{
+				while (mNextIndex < mLastIndex)
+				{
+					writeEmpty();
+				}
+				if (!mSegment)
+				{
+					fi_fseek(mFile, mHeader.getOffsetLocation(0), SEEK_SET);	// Seek back to the start of the offsets table in the file
+					if (fi_fwrite(mSeekLocations, sizeof(uint64_t)*mHeader.mPublicKeyCapacity, 1, mFile) != 1) // write out the offsets
+					{
+						logMessage("Failed to write the record offsets to file '%s'.\n", mFileName);
+						abandon();
+						return false;
+					}
+					logMessage("All records now saved to file '%s'\n", PUBLIC_KEY_RECORDS_FILE_NAME);
+				}
+				fi_fclose(mFile);
+				mFile = nullptr;
+			}
+			return true;
+		}
+
+		// Discards a partially written file.  Padding it out would make it look complete, and a later '-resume'
+		// would trust it, so it is deleted and gets rebuilt from scratch the next time.
+		void abandon(void)
+		{
+			if (mFile)
+			{
+				fi_fclose(mFile);
+				mFile = nullptr;
+			}
+			if (mFileName[0])
+			{
+				fi_deleteFile(mFileName);
+				mFileName[0] = 0;
+			}
+		}
+
+	private:
+		void writeEmpty(void)
+		{
+			PublicKeyRecord empty;
+			empty.mKeyType = BlockChain::KT_UNKNOWN;
+			empty.mIndex = mNextIndex;
+			mSeekLocations[mNextIndex++ - mFirstIndex] = uint64_t(fi_ftell(mFile));
+			empty.save(mFile);
+		}
+
+		char					mFileName[64];
+		FILE_INTERFACE			*mFile;
+		PublicKeyRecordsHeader	mHeader;
+		uint64_t				*mSeekLocations;	// Offsets of the records written so far, indexed relative to mFirstIndex
+		uint32_t				mFirstIndex;		// The range of keys this writer produces records for
+		uint32_t				mLastIndex;
+		uint32_t				mNextIndex;
+		bool					mSegment;			// Whether this is a segment rather than the complete file
+	};
+
+	// A single transaction destined for the record of public key 'mKeyIndex'
+	class PublicKeyTransactionTuple
+	{
+	public:
+		uint32_t				mKeyIndex;
+		uint32_t				mKeyType;			// BlockChain::KeyType of the output, or KT_LAST for a spend
+		PublicKeyTransaction	mTransaction;
+	};
+
+	typedef std::vector< PublicKeyTransactionTuple > PublicKeyTransactionTupleVector;
+
+	// Builds the public key records within a fixed memory budget, rather than holding the whole key to transaction
+	// inversion in memory.  Tuples are collected into a buffer; each time it fills up it is radix sorted by key index and
+	// spilled to disk as a 'run'.  At the end the runs are merged and the records written out in key order.  The sort is
+	// stable and ties between runs go to the earlier run, so each key's transactions stay in chronological order.
+	class PublicKeyRecordSorter : public PublicKeyRecordSink
+	{
+	public:
+		// Only the sorter of a serial build logs its progress; logMessage and formatNumber are not thread safe
+		PublicKeyRecordSorter(uint64_t memoryBudget,uint32_t partition,bool logProgress) : mRunFile(nullptr)
+			, mMemoryBudget(memoryBudget)
+			, mLogProgress(logProgress)
+			, mFailed(false)
+		{
+			snprintf(mRunFileName, sizeof(mRunFileName), PUBLIC_KEY_RUNS_FILE_NAME, partition);
+			// The buffer and the radix sort scratch space share the budget
+			mBufferCapacity = size_t(memoryBudget / (sizeof(PublicKeyTransactionTuple) * 2));
+			if (mBufferCapacity < 1024)
+			{
+				mBufferCapacity = 1024;
+			}
+			mBuffer.reserve(mBufferCapacity);
+		}
+
+		~PublicKeyRecordSorter(void)
+		{
+			if (mRunFile)
+			{
+				fi_fclose(mRunFile);
+				fi_deleteFile(mRunFileName);
+			}
+		}
+
+		virtual void addPublicKeyTransaction(uint32_t index, BlockChain::KeyType keyType, const PublicKeyTransaction &pt) override final
+		{
+			if (mFailed)
+			{
+				return;
+			}
+			PublicKeyTransactionTuple tuple;
+			tuple.mKeyIndex = index;
+			tuple.mKeyType = uint32_t(keyType);
+			tuple.mTransaction = pt;
+			mBuffer.push_back(tuple);
+			if (mBuffer.size() == mBufferCapacity && !spillRun())
+			{
+				// Nothing more is collected; finish reports the failure
+				mFailed = true;
+				mBuffer.clear();
+			}
+		}
+
+		// Sorts/merges everything collected and hands the records to the writer in key order
+		bool finish(PublicKeyRecordsWriter &writer)
+		{
+			mRecord.mTransactions.clear();
+			if (mFailed)
+			{
+				return false;
+			}
+			if (mRuns.empty())
+			{
+				if (mLogProgress)
+				{
+					logMessage("Sorting %u public key transactions in memory.\n", uint32_t(mBuffer.size()));
+				}
+				SORT::radixSort(mBuffer, mScratch, [](const PublicKeyTransactionTuple &t) { return t.mKeyIndex; });
+				for (auto i = mBuffer.begin(); i != mBuffer.end(); ++i)
+				{
+					emit(*i, writer);
+				}
+			}
+			else
+			{
+				if (!mBuffer.empty() && !spillRun())
+				{
+					return false;
+				}
+				releaseBuffers();
+				if (!mergeRuns(writer))
+				{
+					return false;
+				}
+			}
+			flushRecord(writer);
+			return true;
+		}
+
+	private:
+		class Run
+		{
+		public:
+			Run(void) : mFileOffset(0), mRemaining(0), mPosition(0)
+			{
+			}
+			uint64_t						mFileOffset;	// Where the next unread tuples of this run are in the run file
+			uint64_t						mRemaining;		// How many tuples of this run are still on disk
+			PublicKeyTransactionTupleVector	mTuples;		// The tuples currently read in
+			size_t							mPosition;		// The next tuple to merge from mTuples
+		};
+
+		class MergeEntry
+		{
+		public:
+			MergeEntry(uint32_t keyIndex, uint32_t run) : mKeyIndex(keyIndex), mRun(run)
+			{
+			}
+			// Orders the priority queue as a min-heap on key index, then run
+			bool operator<(const MergeEntry &other) const
+			{
+				if (mKeyIndex != other.mKeyIndex)
+				{
+					return mKeyIndex > other.mKeyIndex;
+				}
+				return mRun > other.mRun;
+			}
+			uint32_t	mKeyIndex;
+			uint32_t	mRun;
+		};
+
+		// Returns false if the run could not be written
+		bool spillRun(void)
+		{
+			if (mRunFile == nullptr)
+			{
+				mRunFile = fi_fopen(mRunFileName, "wb+", nullptr, 0, false);
+				if (mRunFile == nullptr)
+				{
+					if (mLogProgress)
+					{
+						logMessage("Failed to open file '%s' for write access.\n", mRunFileName);
+					}
+					return false;
+				}
+			}
+			if (mLogProgress)
+			{
+				logMessage("Sorting and spilling run %u of %u public key transactions to '%s'.\n", uint32_t(mRuns.size() + 1), uint32_t(mBuffer.size()), mRunFileName);
+			}
+			SORT::radixSort(mBuffer, mScratch, [](const PublicKeyTransactionTuple &t) { return t.mKeyIndex; });
+			Run r;
+			r.mFileOffset = uint64_t(fi_ftell(mRunFile));
+			r.mRemaining = mBuffer.size();
+			if (fi_fwrite(&mBuffer[0], sizeof(PublicKeyTransactionTuple)*mBuffer.size(), 1, mRunFile) != 1)
+			{
+				if (mLogProgress)
+				{
+					logMessage("Failed to write a sorted run to '%s'\n", mRunFileName);
+				}
+				return false;
+			}
+			mRuns.push_back(r);
+			mBuffer.clear();
+			return true;
+		}
+
+		void releaseBuffers(void)
+		{
+			PublicKeyTransactionTupleVector empty1, empty2;
+			mBuffer.swap(empty1);
+			mScratch.swap(empty2);
+		}
+
+		bool refill(Run &r, size_t chunk)
+		{
+			size_t count = size_t(r.mRemaining < chunk ? r.mRemaining : chunk);
+			r.mTuples.resize(count);
+			r.mPosition = 0;
+			if (count)
+			{
+				fi_fseek(mRunFile, r.mFileOffset, SEEK_SET);
+				if (fi_fread(&r.mTuples[0], sizeof(PublicKeyTransactionTuple)*count, 1, mRunFile) != 1)
+				{
+					if (mLogProgress)
+					{
+						logMessage("Failed to read back a sorted run from '%s'\n", mRunFileName);
+					}
+					return false;
+				}
+				r.mFileOffset += sizeof(PublicKeyTransactionTuple)*count;
+				r.mRemaining -= count;
+			}
+			return count != 0;
+		}
+
+		bool mergeRuns(PublicKeyRecordsWriter &writer)
+		{
+			uint32_t runCount = uint32_t(mRuns.size());
+			if (mLogProgress)
+			{
+				logMessage("Merging %u sorted runs of public key transactions from '%s'.\n", runCount, mRunFileName);
+			}
+			fi_fflush(mRunFile);
+			size_t chunk = size_t(mMemoryBudget / (sizeof(PublicKeyTransactionTuple) * runCount));
+			if (chunk < 64)
+			{
+				chunk = 64;
+			}
+			std::priority_queue< MergeEntry > heap;
+			for (uint32_t i = 0; i < runCount; i++)
+			{
+				if (refill(mRuns[i], chunk))
+				{
+					heap.push(MergeEntry(mRuns[i].mTuples[0].mKeyIndex, i));
+				}
+			}
+			while (!heap.empty())
+			{
+				MergeEntry e = heap.top();
+				heap.pop();
+				Run &r = mRuns[e.mRun];
+				emit(r.mTuples[r.mPosition], writer);
+				r.mPosition++;
+				if (r.mPosition == r.mTuples.size() && !refill(r, chunk))
+				{
+					if (r.mRemaining)
+					{
+						return false;
+					}
+					continue;
+				}
+				heap.push(MergeEntry(r.mTuples[r.mPosition].mKeyIndex, e.mRun));
+			}
+			return true;
+		}
+
+		// Tuples arrive in key order; collect each key's transactions and write the record once the key changes
+		void emit(const PublicKeyTransactionTuple &tuple, PublicKeyRecordsWriter &writer)
+		{
+			if (!mRecord.mTransactions.empty() && tuple.mKeyIndex != mRecord.mIndex)
+			{
+				flushRecord(writer);
+			}
+			mRecord.mIndex = tuple.mKeyIndex;
+			if (tuple.mKeyType != BlockChain::KT_LAST)
+			{
+				mRecord.mKeyType = BlockChain::KeyType(tuple.mKeyType);
+			}
+			mRecord.mTransactions.push_back(tuple.mTransaction);
+		}
+
+		void flushRecord(PublicKeyRecordsWriter &writer)
+		{
+			if (!mRecord.mTransactions.empty())
+			{
+				writer.write(mRecord);
+				mRecord.mTransactions.clear();
+				mRecord.mKeyType = BlockChain::KT_LAST;
+			}
+		}
+
+		char							mRunFileName[64];
+		FILE_INTERFACE					*mRunFile;
+		uint64_t						mMemoryBudget;
+		size_t							mBufferCapacity;
+		bool							mLogProgress;
+		bool							mFailed;		// A run could not be spilled, so the records can't be built
+		PublicKeyTransactionTupleVector	mBuffer;
+		PublicKeyTransactionTupleVector	mScratch;
+		std::vector< Run >				mRuns;
+		PublicKeyRecord					mRecord;		// The record currently being collected by emit
+	};
+
+	// Routes each transaction to the sorter of the partition which owns its public key.  The parallel build decodes the
+	// transactions file once through this and then sorts and writes every partition on its own thread.
+	class PublicKeyRecordPartitions : public PublicKeyRecordSink
+	{
+	public:
+		PublicKeyRecordPartitions(PublicKeyRecordSorter **sorters, uint32_t partitions, uint32_t publicKeyCount) : mSorters(sorters)
+			, mPartitions(partitions)
+			, mPublicKeyCount(publicKeyCount)
+		{
+		}
+
+		// Each partition owns an equal share of the key index range, starting at this key
+		static uint32_t getFirstIndex(uint32_t partition, uint32_t partitions, uint32_t publicKeyCount)
+		{
+			return uint32_t(uint64_t(publicKeyCount) * partition / partitions);
+		}
+
+		virtual void addPublicKeyTransaction(uint32_t index, BlockChain::KeyType keyType, const PublicKeyTransaction &pt) override final
+		{
+			// The estimate is never past the owning partition, and at most one short of it
+			uint32_t p = uint32_t(uint64_t(index) * mPartitions / mPublicKeyCount);
+			if ((p + 1) < mPartitions && index >= getFirstIndex(p + 1, mPartitions, mPublicKeyCount))
+			{
+				p++;
+			}
+			mSorters[p]->addPublicKeyTransaction(index, keyType, pt);
+		}
+
+		PublicKeyRecordSorter	**mSorters;
+		uint32_t				mPartitions;
+		uint32_t				mPublicKeyCount;
+	};
+
+	// Applies each per-key transaction to a running balance for every public key; used to build the balance
+	// snapshots and to roll a snapshot forward to the requested time
+	class PublicKeyBalances : public PublicKeyRecordSink
+	{
+	public:
+		PublicKeyBalances(std::vector< uint64_t > &balances) : mBalances(balances)
+		{
+		}
+
+		virtual void addPublicKeyTransaction(uint32_t index, BlockChain::KeyType keyType, const PublicKeyTransaction &pt) override final
+		{
+			(void)keyType;
+			if (pt.mSpend)
+			{
+				mBalances[index] -= pt.mValue;
+			}
+			else
+			{
+				mBalances[index] += pt.mValue;
+			}
+		}
+
+		std::vector< uint64_t >	&mBalances;
+	};
+
+	// Returns the first snapshot boundary after 'timeStamp'; midnight UTC for daily and weekly snapshots and the
+	// first of the month for monthly ones
+	uint32_t getNextSnapshotTime(uint32_t timeStamp, PublicKeyDatabase::SnapshotInterval interval)
+	{
+		uint32_t ret = 0;
+		switch (interval)
+		{
+			case PublicKeyDatabase::SI_DAILY:
+				ret = (timeStamp / SECONDS_PER_DAY + 1) * SECONDS_PER_DAY;
+				break;
+			case PublicKeyDatabase::SI_WEEKLY:
+				ret = (timeStamp / (SECONDS_PER_DAY * 7) + 1) * (SECONDS_PER_DAY * 7);
+				break;
+			case PublicKeyDatabase::SI_MONTHLY:
+				{
+					time_t t(timeStamp);
+					struct tm month = *gmtime(&t);
+					month.tm_mon++;		// _mkgmtime carries December over into the next year
+					month.tm_mday = 1;
+					month.tm_hour = 0;
+					month.tm_min = 0;
+					month.tm_sec = 0;
+					ret = uint32_t(_mkgmtime(&month));
+				}
+				break;
+		}
+		return ret;
+	}
+
+	// The fixed header at the start of BalanceSnapshots.bin.  The snapshot columns follow it and the directory
+	// of snapshots is written last, once their number is known; a zero 'mDirectoryOffset' means the build did not finish.
+	class BalanceSnapshotsHeader
+	{
+	public:
+		BalanceSnapshotsHeader(void)
+		{
+			memset(this, 0, sizeof(*this));
+			strcpy(mMagic, magicID);
+			mVersion = BALANCE_SNAPSHOTS_VERSION;
+		}
+
+		bool isValid(void) const
+		{
+			return strcmp(mMagic, magicID) == 0 && mVersion == BALANCE_SNAPSHOTS_VERSION && mDirectoryOffset != 0;
+		}
+
+		char		mMagic[16];
+		uint32_t	mVersion;					// BALANCE_SNAPSHOTS_VERSION
+		uint32_t	mInterval;					// The PublicKeyDatabase::SnapshotInterval the snapshots were taken at
+		uint32_t	mSnapshotCount;				// Number of entries in the directory
+		uint32_t	mPublicKeyCount;			// Number of public keys when the snapshots were built
+		uint64_t	mDirectoryOffset;			// File offset of the directory of BalanceSnapshot entries
+		uint32_t	mTransactionCount;			// Number of transactions the snapshots were built from
+		uint32_t	mReserved;
+	};
+
+	// One directory entry.  A snapshot holds the balance of every public key with a non-zero balance, after all of
+	// the transactions which precede the first one stamped at or after 'mTimeStamp'.  It is stored as two columns
+	// sorted by key index; 'mKeyCount' key indices followed by 'mKeyCount' balances.
+	class BalanceSnapshot
+	{
+	public:
+		uint32_t	mTimeStamp;					// The interval boundary this snapshot was taken at
+		uint32_t	mKeyCount;					// Number of public keys with a non-zero balance
+		uint32_t	mTransactionCount;			// Number of transactions applied to the balances
+		uint32_t	mReserved;
+		uint64_t	mTransactionFileOffset;		// Offset of the first transaction *not* included; where rolling forward starts
+		uint64_t	mIndexOffset;				// File offset of the key index column (uint32_t per key)
+		uint64_t	mBalanceOffset;				// File offset of the balance column (uint64_t per key)
+	};
+
+	typedef std::vector< BalanceSnapshot > BalanceSnapshotVector;
+
+	// Streams the snapshots out to BalanceSnapshots.bin as they are taken and writes the directory on close
+	class BalanceSnapshotsWriter
+	{
+	public:
+		BalanceSnapshotsWriter(void) : mFile(nullptr)
+		{
+		}
+
+		~BalanceSnapshotsWriter(void)
+		{
+			if (mFile)
+			{
+				fi_fclose(mFile);
+			}
+		}
+
+		bool open(PublicKeyDatabase::SnapshotInterval interval, uint32_t publicKeyCount)
+		{
+			mFile = fi_fopen(BALANCE_SNAPSHOTS_FILE_NAME, "wb", nullptr, 0, false);
+			if (mFile == nullptr)
+			{
+				logMessage("Failed to open file '%s' for write access.\n", BALANCE_SNAPSHOTS_FILE_NAME);
+				return false;
+			}
+			mHeader.mInterval = uint32_t(interval);
+			mHeader.mPublicKeyCount = publicKeyCount;
+			fi_fwrite(&mHeader, sizeof(mHeader), 1, mFile);
+			return true;
+		}
+
+		void writeSnapshot(uint32_t timeStamp, uint32_t transactionCount, uint64_t transactionFileOffset, const std::vector< uint64_t > &balances)
+		{
+			mIndices.clear();
+			mBalances.clear();
+			for (uint32_t i = 0; i < uint32_t(balances.size()); i++)
+			{
+				if (balances[i])
+				{
+					mIndices.push_back(i);
+					mBalances.push_back(balances[i]);
+				}
+			}
+			BalanceSnapshot s;
+			memset(&s, 0, sizeof(s));
+			s.mTimeStamp = timeStamp;
+			s.mKeyCount = uint32_t(mIndices.size());
+			s.mTransactionCount = transactionCount;
+			s.mTransactionFileOffset = transactionFileOffset;
+			s.mIndexOffset = alignToPage();
+			if (s.mKeyCount)
+			{
+				fi_fwrite(&mIndices[0], sizeof(uint32_t)*s.mKeyCount, 1, mFile);
+			}
+			s.mBalanceOffset = alignToPage();
+			if (s.mKeyCount)
+			{
+				fi_fwrite(&mBalances[0], sizeof(uint64_t)*s.mKeyCount, 1, mFile);
+			}
+			mDirectory.push_back(s);
+		}
+
+		void close(uint32_t transactionCount)
+		{
+			mHeader.mSnapshotCount = uint32_t(mDirectory.size());
+			mHeader.mTransactionCount = transactionCount;
+			mHeader.mDirectoryOffset = alignToPage();
+			if (!mDirectory.empty())
+			{
+				fi_fwrite(&mDirectory[0], sizeof(BalanceSnapshot)*mDirectory.size(), 1, mFile);
+			}
+			fi_fseek(mFile, 0, SEEK_SET);
+			fi_fwrite(&mHeader, sizeof(mHeader), 1, mFile);
+			fi_fclose(mFile);
+			mFile = nullptr;
+		}
+
+	private:
+		// Pads the file out to the next page boundary and returns that location
+		uint64_t alignToPage(void)
+		{
+			uint64_t location = uint64_t(fi_ftell(mFile));
+			uint64_t aligned = (location + BALANCE_SNAPSHOT_PAGE_SIZE - 1) & ~uint64_t(BALANCE_SNAPSHOT_PAGE_SIZE - 1);
+			static const uint8_t zeros[BALANCE_SNAPSHOT_PAGE_SIZE] = { 0 };
+			if (aligned != location)
+			{
+				fi_fwrite(zeros, size_t(aligned - location), 1, mFile);
+			}
+			return aligned;
+		}
+
+		FILE_INTERFACE				*mFile;
+		BalanceSnapshotsHeader		mHeader;
+		BalanceSnapshotVector		mDirectory;
+		std::vector< uint32_t >		mIndices;		// Scratch columns for the snapshot being written
+		std::vector< uint64_t >		mBalances;
+	};
+
+	// The first 8 bytes of the RIPEMD160 hash inside a 25 byte address; what the public key index is keyed on
+	uint64_t getAddressPrefix(const uint8_t address[25])
+	{
+		uint64_t ret;
+		memcpy(&ret, &address[1], sizeof(ret));
+		return ret;
+	}
+
+	// PublicKeyIndex.bin maps an address to its public key index.  It holds one entry per key, sorted by address prefix
+	// (then key index) and laid out in Eytzinger (breadth first binary tree) order: the children of entry 'k' are at
+	// '2k' and '2k+1'.  A lookup walks down from entry 1 touching one entry per level, and the top levels of the tree
+	// share a handful of cache lines.  Entry 0 is unused.  Different addresses can share a prefix, so the full address
+	// is always checked against PublicKeys.bin.
+#pragma pack(push, 4)
+	class PublicKeyIndexEntry
+	{
+	public:
+		uint64_t	mPrefix;		// getAddressPrefix of the public key
+		uint32_t	mIndex;			// The public key index
+	};
+#pragma pack(pop)
+
+	typedef std::vector< PublicKeyIndexEntry > PublicKeyIndexEntryVector;
+
+	class PublicKeyIndexHeader
+	{
+	public:
+		PublicKeyIndexHeader(void)
+		{
+			memset(this, 0, sizeof(*this));
+			strcpy(mMagic, magicID);
+			mVersion = PUBLIC_KEY_INDEX_VERSION;
+		}
+
+		bool isValid(uint32_t publicKeyCount) const
+		{
+			return strcmp(mMagic, magicID) == 0 && mVersion == PUBLIC_KEY_INDEX_VERSION && mPublicKeyCount == publicKeyCount;
+		}
+
+		char		mMagic[16];
+		uint32_t	mVersion;					// PUBLIC_KEY_INDEX_VERSION
+		uint32_t	mPublicKeyCount;			// Number of entries, not counting the unused entry 0
+		uint64_t	mReserved;
+	};
+
+	class PublicKeyClustersHeader
+	{
+	public:
+		PublicKeyClustersHeader(void)
+		{
+			memset(this, 0, sizeof(*this));
+			strcpy(mMagic, magicID);
+			mVersion = PUBLIC_KEY_CLUSTERS_VERSION;
+		}
+
+		bool isValid(uint32_t publicKeyCount, uint64_t transactionFileLength) const
+		{
+			return strcmp(mMagic, magicID) == 0 && mVersion == PUBLIC_KEY_CLUSTERS_VERSION && mPublicKeyCount == publicKeyCount
+				&& mTransactionFileLength == transactionFileLength;
+		}
+
+		char		mMagic[16];
+		uint32_t	mVersion;					// PUBLIC_KEY_CLUSTERS_VERSION
+		uint32_t	mPublicKeyCount;			// Number of cluster ids which follow, one per public key
+		uint64_t	mTransactionFileLength;		// The length of TransactionFile.bin the clusters were found from
+		uint32_t	mClusterCount;
+		uint32_t	mReserved;
+	};
+
+	// Copies the sorted entries into Eytzinger order; an in-order walk of the implicit tree visits them in sorted order
+	size_t buildEytzinger(const PublicKeyIndexEntry *sorted, PublicKeyIndexEntry *tree, size_t count, size_t next, size_t k)
+	{
+		if (k <= count)
+		{
+			next = buildEytzinger(sorted, tree, count, next, k * 2);
+			tree[k] = sorted[next++];
+			next = buildEytzinger(sorted, tree, count, next, k * 2 + 1);
+		}
+		return next;
+	}
+
+	// The entry which follows 'k' in sorted order; zero if 'k' is the last one
+	size_t getNextEytzinger(size_t k, size_t count)
+	{
+		if (k * 2 + 1 <= count)
+		{
+			k = k * 2 + 1;
+			while (k * 2 <= count)
+			{
+				k = k * 2;
+			}
+			return k;
+		}
+		while (k & 1)
+		{
+			k >>= 1;
+		}
+		return k >> 1;
+	}
+
+	// A packed (balance, key index) pair; the top balances are selected over these rather than by sorting
+	// pointers into the memory mapped records
+#pragma pack(push, 4)
+	class BalanceEntry
+	{
+	public:
+		BalanceEntry(void)
+		{
+		}
+		BalanceEntry(uint64_t balance, uint32_t index) : mBalance(balance)
+			, mIndex(index)
+		{
+		}
+		uint64_t	mBalance;
+		uint32_t	mIndex;
+	};
+#pragma pack(pop)
+
+	typedef std::vector< BalanceEntry > BalanceEntryVector;
+
+	// Orders the largest balance first; equal balances by key index so the report is the same from run to run
+	class HigherBalance
+	{
+	public:
+		bool operator()(const BalanceEntry &a, const BalanceEntry &b) const
+		{
+			if (a.mBalance != b.mBalance)
+			{
+				return a.mBalance > b.mBalance;
+			}
+			return a.mIndex < b.mIndex;
+		}
+	};
+
+	// One address of a batch query; sorted by where its record lives so the records are read in file order
+	class AddressQuery
+	{
+	public:
+		uint64_t	mRecordOffset;		// Offset of the record in PublicKeyRecords.bin; all bits set if the address was not found
+		uint32_t	mIndex;				// The public key index; 0xFFFFFFFF if the address was not found
+		uint32_t	mRow;				// The line of the query file it came from, counting only non-blank lines
+	};
+
+// Sorting classes; orderings of the memory mapped public key records for SORT::parallelMergeSort.
+// Ties are broken by key index so a report is the same from run to run.
+	class SortByBalance
+	{
+	public:
+		bool operator()(const PublicKeyRecordFile *a, const PublicKeyRecordFile *b) const
+		{
+			if (a->mBalance != b->mBalance)
+			{
+				return a->mBalance > b->mBalance;
+			}
+			return a->mIndex < b->mIndex;
+		}
+	};
+
+	// Longest untouched first
+	class SortByAge
+	{
+	public:
+		bool operator()(const PublicKeyRecordFile *a, const PublicKeyRecordFile *b) const
+		{
+			if (a->mDaysOld != b->mDaysOld)
+			{
+				return a->mDaysOld > b->mDaysOld;
+			}
+			return a->mIndex < b->mIndex;
+		}
+	};
+
+	// Busiest first
+	class SortByTransactionCount
+	{
+	public:
+		bool operator()(const PublicKeyRecordFile *a, const PublicKeyRecordFile *b) const
+		{
+			if (a->mCount != b->mCount)
+			{
+				return a->mCount > b->mCount;
+			}
+			return a->mIndex < b->mIndex;
+		}
+	};
+
+	class PublicKeyDatabaseImpl : public PublicKeyDatabase
+	{
+	public:
+		PublicKeyDatabaseImpl(bool analyze,bool resume) : mAnalyze(analyze)
+			, mFirstTransactionOffset(0)
+			, mPublicKeyFile(nullptr)
+			, mTransactionFile(nullptr)
+			, mTransactionFileCountSeekLocation(0)
+			, mPublicKeyFileCountSeekLocation(0)
+			, mTransactionCount(0)
+			, mPublicKeyCount(0)
+			, mAddressFile(nullptr)
+			, mAddresses(nullptr)
+			, mPublicKeyRecordFile(nullptr)
+			, mPublicKeyRecordBaseAddress(nullptr)
+			, mPublicKeyRecordOffsets(nullptr)
+			, mPublicKeyRecordSorted(nullptr)
+			, mPublicKeyIndexFile(nullptr)
+			, mPublicKeyIndex(nullptr)
+			, mPublicKeyClustersFile(nullptr)
+			, mPublicKeyClusters(nullptr)
+			, mResumeBlockIndex(0)
+			, mLastBlockIndex(0)
+			, mLastBlockTime(0)
+			, mMemoryBudget(DEFAULT_MEMORY_BUDGET)
+			, mThreadCount(0)
+			, mReportFormat(ReportWriter::RF_CSV)
+			, mNeedSpentOutputs(false)
+		{
+			memset(mLastBlockHash, 0, sizeof(mLastBlockHash));
+			if (analyze)
+			{
+				openTransactionsFile();
+				loadPublicKeyFile();
+				loadPublicKeyRecordsFile();
+				loadPublicKeyIndex();
+			}
+			else if (resume && resumeFromCheckpoint())
+			{
+				logMessage("Resuming ingest at block %s\n", formatNumber(mResumeBlockIndex));
+			}
+			else
+			{
+				uint32_t key = 'y';
+				FILE_INTERFACE *fph = fi_fopen(TRANSACTION_FILE_NAME, "rb", 0, 0, false);
+				if (fph)
+				{
+					fi_fclose(fph);
+					logMessage("A pre-processed transactions database already exists!\n");
+					logMessage("Are you sure you want to delete it and start over? (Use -resume to continue from the last checkpoint instead)\n");
+					logMessage("Press 'y' to continue, any other key to cancel.\n");
+					key = getKey();
+				}
+				if (key == 'y')
+				{
+					fi_deleteFile(PUBLIC_KEY_RECORDS_FILE_NAME);
+					fi_deleteFile(CHECKPOINT_FILE_NAME);
+					mTransactionFile = fi_fopen(TRANSACTION_FILE_NAME, "wb+", nullptr, 0, false);
+					if (mTransactionFile)
+					{
+						size_t slen = strlen(transactionFileMagicID);
+						fi_fwrite(transactionFileMagicID, slen + 1, 1, mTransactionFile);
+						mTransactionFileCountSeekLocation = uint32_t(fi_ftell(mTransactionFile));
+						fi_fwrite(&mTransactionCount, sizeof(mTransactionCount), 1, mTransactionFile); // save the number of transactions
+						fi_fflush(mTransactionFile);
+						mPublicKeyFile = fi_fopen(PUBLIC_KEY_FILE_NAME, "wb+", nullptr, 0, false);
+						if (mPublicKeyFile)
+						{
+							size_t slen = strlen(magicID);
+							fi_fwrite(magicID, slen + 1, 1, mPublicKeyFile);
+							mPublicKeyFileCountSeekLocation = uint32_t(fi_ftell(mPublicKeyFile));
+							fi_fwrite(&mPublicKeyCount, sizeof(mPublicKeyCount), 1, mPublicKeyFile); // save the number of transactions
+							fi_fflush(mPublicKeyFile);
+						}
+						else
+						{
+							logMessage("Failed to open file '%s' for write access.\n", PUBLIC_KEY_FILE_NAME);
+						}
+					}
+					else
+					{
+						logMessage("Failed to open file '%s' for write access.\n", TRANSACTION_FILE_NAME);
+					}
+				}
+			}
+		}
+
+		virtual ~PublicKeyDatabaseImpl(void)
+		{
+			logMessage("~PublicKeyDatabaseImpl destructor\n");
+			if (mTransactionFile)
+			{
+				fi_fclose(mTransactionFile);
+			}
+			if (mPublicKeyRecordFile)
+			{
+				fi_fclose(mPublicKeyRecordFile);
+			}
+			if (mAddressFile)
+			{
+				fi_fclose(mAddressFile);
+			}
+			closePublicKeyIndex();
+			closePublicKeyClusters();
+		}
+
+		virtual bool addBlock(const BlockChain::Block *b) override final
+		{
+			if (!mTransactionFile || mAnalyze )
+			{
+				return false;
+			}
+
+			// Every public key and unspent output rebuilt from the checkpoint belongs to the old chain, so none of it
+			// can be carried over onto a chain which forked before the checkpointed block
+			if (mResumeBlockIndex && b->blockIndex == mResumeBlockIndex && memcmp(b->previousBlockHash, mLastBlockHash, sizeof(mLastBlockHash)) != 0)
+			{
+				logMessage("ERROR: Block %s does not build on the checkpointed block; the blockchain has changed since the checkpoint was taken.\n", formatNumber(b->blockIndex));
+				logMessage("Cannot resume from this checkpoint; run again without -resume to rebuild the database from block 0.\n");
+				return false;
+			}
+			// On a resumed run the blockchain parser has not seen the transactions before the checkpoint, so this hash
+			// set, restored from the checkpoint, is the only complete record to check the inputs against.  The whole
+			// block is checked before any of it is written, so a rejected block leaves nothing behind.
+			if (mResumeBlockIndex && !findSpentTransactions(b))
+			{
+				return false;
+			}
+			mSpentOutputs.clear();
+
+			// A block's time stamp may be earlier than that of the block before it.  Transactions are stamped with the
+			// latest block time seen so far instead, so time never goes backwards through the transactions file.  The
+			// key records binary search their transactions by time and the balance snapshots are cut as the file is
+			// walked, so both rely on that; a transaction in such a block counts on the day of the block before it.
+			if (b->timeStamp > mLastBlockTime)
+			{
+				mLastBlockTime = b->timeStamp;
+			}
+
+			for (uint32_t i = 0; i < b->transactionCount; i++)
+			{
+				uint64_t fileOffset = uint64_t(fi_ftell(mTransactionFile)); // the file offset for this transaction data
+				const BlockChain::BlockTransaction &bt = b->transactions[i];
+
+				Transaction t(bt,mLastBlockTime,b->blockIndex);
+
+				for (uint32_t i = 0; i < bt.inputCount; i++)
+				{
+					const BlockChain::BlockInput &bi = bt.inputs[i];
+					Hash256 h(bi.transactionHash);
+					TransactionHash th(h);
+					TransactionHashSet::iterator found = mTransactions.find(th);
+					uint64_t fileOffset = 0;
+					uint32_t timeStamp = 0;
+					uint64_t inputValue = 0;
+					uint32_t keyIndex = 0xFFFFFFFF;
+					if (found == mTransactions.end())
+					{
+						timeStamp = mLastBlockTime; // if it's a coinbase transaction, we just use the block time as the timestamp
+						if (bi.transactionIndex != 0xFFFFFFFF) // we should always be able to find the previous transaction!
 						{
-							assert(0); // we should always be able to find the previous transaction!
+							logMessage("ERROR: Failed to find transaction ");
+							printReverseHash(bi.transactionHash);
+							logMessage(" spent by block %s.\n", formatNumber(b->blockIndex));
 						}
 					}
 					else
@@ -1272,113 +3271,632 @@ namespace PUBLIC_KEY_DATABASE
 						UTXOMap::iterator found = mUTXO.find(utxo);
 						if (found != mUTXO.end())
 						{
-							inputValue = (*found).second;
+							inputValue = (*found).second.mValue;
+							keyIndex = (*found).second.mKeyIndex;
 							mUTXO.erase(found); // we can now remove it since it has been consumed
 						}
 						else
 						{
-							logMessage("Failed to locate unspent transaction output.\r\n");
+							// Not in the unspent set (an output spent twice, as the duplicated coinbase transactions are);
+							// read the value and key back from the previous transaction itself, as the records build used to
+							Transaction previous;
+							uint64_t writeLocation = uint64_t(fi_ftell(mTransactionFile));
+							if (readTransaction(previous, fileOffset) && bi.transactionIndex < previous.mOutputs.size())
+							{
+								inputValue = previous.mOutputs[bi.transactionIndex].mValue;
+								keyIndex = previous.mOutputs[bi.transactionIndex].mIndex;
+							}
+							else
+							{
+								logMessage("Failed to locate unspent transaction output.\r\n");
+							}
+							fi_fseek(mTransactionFile, writeLocation, SEEK_SET);
 						}
 					}
-					t.addInput(bi, fileOffset,timeStamp, inputValue);
+					t.addInput(bi, fileOffset,timeStamp, inputValue, keyIndex);
+					if (mNeedSpentOutputs)
+					{
+						BlockAnalyzer::SpentOutput spent;
+						spent.mValue = inputValue;
+						spent.mKeyIndex = keyIndex;
+						spent.mTimeStamp = timeStamp;
+						mSpentOutputs.push_back(spent);
+					}
+				}
+
+				// Each output gets added to the UTXO hash map
+				for (uint32_t i = 0; i < bt.outputCount; i++)
+				{
+					const BlockChain::BlockOutput &bo = bt.outputs[i];
+					uint32_t addressIndex = getPublicKeyIndex(bo.asciiAddress);
+					t.addOutput(bo,addressIndex);
+					// Add it to the UTXO set
+					UTXO utxo(fileOffset, i);
+					mUTXO[utxo] = UTXOValue(bo.value, addressIndex);
+				}
+
+				t.save(mTransactionFile);
+				Hash256 h(bt.transactionHash);
+				TransactionHash th(h);
+				th.setFileOffset(fileOffset);
+				th.setTimeStamp(mLastBlockTime);
+
+				TransactionHashSet::iterator found = mTransactions.find(th);
+				if (found != mTransactions.end() )
+				{
+					logMessage("Encountered the same transaction hash twice; this appears to be a bug and must be fixed! Ignoring second occurence for now.\n");
+					logMessage("DuplicateHash:");
+					printReverseHash((const uint8_t *)&th.mWord0);
+					logMessage("\n");
+				}
+				else
+				{
+					mTransactionCount++;	// increment the transaction count
+					mTransactions.insert(th);	// Add it to the transaction hash table; so we can convert from a transaction hash to a file offset quickly and efficiently
+				}
+			}
+			fi_fflush(mTransactionFile);
+
+			for (auto i = mBlockAnalyzers.begin(); i != mBlockAnalyzers.end(); ++i)
+			{
+				(*i)->onBlock(*b, (*i)->needsSpentOutputs() ? mSpentOutputs.data() : nullptr);
+			}
+
+			mLastBlockIndex = b->blockIndex;
+			memcpy(mLastBlockHash, b->computedBlockHash, sizeof(mLastBlockHash));
+
+			if ((b->blockIndex % 10000) == 0)
+			{
+				closePublicKeyFile(true); //
+			}
+			return true;
+		}
+
+		virtual void addBlockAnalyzer(BlockAnalyzer *analyzer) override final
+		{
+			mBlockAnalyzers.push_back(analyzer);
+			mNeedSpentOutputs |= analyzer->needsSpentOutputs();
+		}
+
+		virtual uint32_t getResumeBlockIndex(void) override final
+		{
+			return mResumeBlockIndex;
+		}
+
+		// Truncates the transaction and public key files back to the state they were in when the last checkpoint
+		// was written, and then rebuilds the in memory hash tables from them with a single sequential pass.
+		bool resumeFromCheckpoint(void)
+		{
+			IngestCheckpoint c;
+			if (!c.load())
+			{
+				logMessage("Unable to resume; no valid checkpoint file '%s' was found.\n", CHECKPOINT_FILE_NAME);
+				return false;
+			}
+			logMessage("Found a checkpoint taken after block %s with %s transactions and %s public keys.\n", formatNumber(c.mBlockIndex), formatNumber(c.mTransactionCount), formatNumber(c.mPublicKeyCount));
+			if (!fi_truncateFile(TRANSACTION_FILE_NAME, c.mTransactionFileLength) || !fi_truncateFile(PUBLIC_KEY_FILE_NAME, c.mPublicKeyFileLength))
+			{
+				logMessage("Failed to truncate the database files back to the last checkpoint.\n");
+				return false;
+			}
+			mTransactionFile = fi_fopen(TRANSACTION_FILE_NAME, "rb+", nullptr, 0, false);
+			mPublicKeyFile = fi_fopen(PUBLIC_KEY_FILE_NAME, "rb+", nullptr, 0, false);
+			if (!mTransactionFile || !mPublicKeyFile)
+			{
+				logMessage("Failed to open the database files for read/write access.\n");
+				return abortResume();
+			}
+			size_t slen = strlen(magicID);
+			char temp[64];
+			if (fi_fread(temp, strlen(transactionFileMagicID) + 1, 1, mTransactionFile) != 1 || strcmp(temp, transactionFileMagicID) != 0)
+			{
+				logMessage("Not a valid transaction file.\n");
+				return abortResume();
+			}
+			mTransactionFileCountSeekLocation = uint32_t(fi_ftell(mTransactionFile));
+			fi_fseek(mTransactionFile, mTransactionFileCountSeekLocation + sizeof(mTransactionCount), SEEK_SET);
+			mFirstTransactionOffset = fi_ftell(mTransactionFile);
+
+			if (fi_fread(temp, slen + 1, 1, mPublicKeyFile) != 1 || strcmp(temp, magicID) != 0)
+			{
+				logMessage("Not a valid public key file.\n");
+				return abortResume();
+			}
+			mPublicKeyFileCountSeekLocation = uint32_t(fi_ftell(mPublicKeyFile));
+			fi_fseek(mPublicKeyFile, mPublicKeyFileCountSeekLocation + sizeof(mPublicKeyCount), SEEK_SET);
+
+			logMessage("Re-interning %s public keys.\n", formatNumber(c.mPublicKeyCount));
+			mPublicKeys.reserve(c.mPublicKeyCount);
+			for (uint32_t i = 0; i < c.mPublicKeyCount; i++)
+			{
+				PublicKeyData a;
+				if (fi_fread(a.address, sizeof(a.address), 1, mPublicKeyFile) != 1)
+				{
+					logMessage("The public key file is shorter than the checkpoint claims.\n");
+					return abortResume();
+				}
+				PublicKey key(a);
+				key.mIndex = i;
+				mPublicKeys.insert(key);
+			}
+			mPublicKeyCount = c.mPublicKeyCount;
+
+			logMessage("Rebuilding the transaction hash table and the unspent transaction outputs.\n");
+			mTransactionCount = 0;
+			uint64_t transactionOffset = mFirstTransactionOffset;
+			Transaction t;
+			while (transactionOffset < c.mTransactionFileLength && readTransaction(t, transactionOffset))
+			{
+				for (auto i = t.mInputs.begin(); i != t.mInputs.end(); ++i)
+				{
+					const TransactionInput &ti = (*i);
+					if (ti.mTransactionFileOffset && ti.mTransactionIndex != 0xFFFFFFFF)
+					{
+						mUTXO.erase(UTXO(ti.mTransactionFileOffset, ti.mTransactionIndex));
+					}
+				}
+				for (uint32_t i = 0; i < uint32_t(t.mOutputs.size()); i++)
+				{
+					mUTXO[UTXO(transactionOffset, i)] = UTXOValue(t.mOutputs[i].mValue, t.mOutputs[i].mIndex);
+				}
+				TransactionHash th(Hash256(t.mTransactionHash));
+				th.setFileOffset(transactionOffset);
+				th.setTimeStamp(t.mTransactionTime);
+				mLastBlockTime = t.mTransactionTime;
+				if (mTransactions.find(th) == mTransactions.end())
+				{
+					mTransactions.insert(th);
+					mTransactionCount++;
+				}
+				transactionOffset = uint64_t(fi_ftell(mTransactionFile));
+				if ((mTransactionCount % 100000) == 0)
+				{
+					logMessage("Rebuilt %s transactions\n", formatNumber(mTransactionCount));
+				}
+			}
+			if (mTransactionCount != c.mTransactionCount)
+			{
+				logMessage("Found %s transactions but the checkpoint expected %s.\n", formatNumber(mTransactionCount), formatNumber(c.mTransactionCount));
+				return abortResume();
+			}
+			// Append from the end of both files from now on
+			fi_fseek(mTransactionFile, 0, SEEK_END);
+			fi_fseek(mPublicKeyFile, 0, SEEK_END);
+			mLastBlockIndex = c.mBlockIndex;
+			memcpy(mLastBlockHash, c.mBlockHash, sizeof(mLastBlockHash));
+			mResumeBlockIndex = c.mBlockIndex + 1;
+			return true;
+		}
+
+		bool abortResume(void)
+		{
+			if (mTransactionFile)
+			{
+				fi_fclose(mTransactionFile);
+				mTransactionFile = nullptr;
+			}
+			if (mPublicKeyFile)
+			{
+				fi_fclose(mPublicKeyFile);
+				mPublicKeyFile = nullptr;
+			}
+			mPublicKeys.clear();
+			mTransactions.clear();
+			mUTXO.clear();
+			mTransactionCount = 0;
+			mPublicKeyCount = 0;
+			return false;
+		}
+
+		// Once all of the blocks have been processed and transactions accumulated, we now
+		// can build the public key database; this collates all transaction inputs and outupts
+		// relative to each bitcoin address.
+		// The purpose of this is so that we can later use this pre-processed database to perform
+		// relatively high speed queries against the blockchain.  Most of the interesting data we want to 
+		// collect is relative to public key addresses
+		virtual void buildPublicKeyDatabase(void) override final
+		{
+			buildPublicKeyRecords();
+			buildPublicKeyIndex();
+		}
+
+		void buildPublicKeyRecords(void)
+		{
+			if (!mAnalyze)
+			{
+				uint32_t previousPublicKeyCount = mPublicKeyCount;
+				closePublicKeyFile(false);
+				mTransactionFile = nullptr;
+				logMessage("Clearing transactions container\n");
+				mTransactions.clear();		// We no longer need this hash-set of transaction hashes since we have rebased the data based the data based on transaction offset into the datafile
+				logMessage("Clearing UTXO container\n");
+				mUTXO.clear();
+
+				logMessage("Clearing PublicKeys container\n");
+				mPublicKeys.clear();		// We no longer needs this hash set, so free up the memory
+				mAnalyze = true;
+				logMessage("Opening the transactions file\n");
+				openTransactionsFile();
+				logMessage("Loading the PublicKey address file\n");
+				loadPublicKeyFile();
+				assert(mPublicKeyCount == previousPublicKeyCount);
+				// If a previous build of the records file exists (it survives a '-resume'), only the transactions
+				// appended since then need to be merged into it
+				if (updatePublicKeyRecords())
+				{
+					return;
+				}
+			}
+			uint32_t partitions = mThreadCount ? mThreadCount : ThreadPool::getHardwareThreadCount();
+			if (partitions > mPublicKeyCount)
+			{
+				partitions = 1;
+			}
+			logMessage("Building PublicKey records on %d threads using a memory budget of %s MB.\n", partitions, formatNumber(uint32_t(mMemoryBudget / (1024 * 1024))));
+			PublicKeyRecordsWriter writer;
+			if (partitions == 1)
+			{
+				PublicKeyRecordSorter sorter(mMemoryBudget, 0, true);
+				uint32_t transactionCount = 0;
+				uint64_t transactionOffset = 0;
+				seekFirstTransaction();
+				scanPublicKeyTransactions(mTransactionFile, sorter, true, transactionCount, transactionOffset);
+				logMessage("Saving %s public key records; this is the fully collated set of transactions corresponding to each unique public key address.\n", formatNumber(mPublicKeyCount));
+				if (writer.open(mPublicKeyCount, transactionCount, transactionOffset))
+				{
+					if (sorter.finish(writer))
+					{
+						writer.close();
+					}
+					else
+					{
+						logMessage("Failed to build the public key records.\n");
+						writer.abandon();
+					}
+				}
+				return;
+			}
+
+			// The transactions file is decoded once, on this thread, with each transaction routed to the sorter of the partition
+			// owning its key.  Every partition is then sorted and written to a segment file on a worker, and the segments are
+			// concatenated in key order, which produces exactly the same file as the serial build.
+			std::vector< PublicKeyRecordSorter * > sorters(partitions);
+			for (uint32_t p = 0; p < partitions; p++)
+			{
+				sorters[p] = new PublicKeyRecordSorter(mMemoryBudget / partitions, p, false);
+			}
+			PublicKeyRecordPartitions router(sorters.data(), partitions, mPublicKeyCount);
+			uint32_t transactionCount = 0;
+			uint64_t transactionOffset = 0;
+			seekFirstTransaction();
+			scanPublicKeyTransactions(mTransactionFile, router, true, transactionCount, transactionOffset);
+
+			PublicKeyRecordsWriter *segments = new PublicKeyRecordsWriter[partitions];
+			std::vector< uint8_t > succeeded(partitions);
+			for (uint32_t p = 0; p < partitions; p++)
+			{
+				uint32_t firstIndex = PublicKeyRecordPartitions::getFirstIndex(p, partitions, mPublicKeyCount);
+				uint32_t lastIndex = PublicKeyRecordPartitions::getFirstIndex(p + 1, partitions, mPublicKeyCount);
+				succeeded[p] = segments[p].openSegment(p, firstIndex, lastIndex);
+			}
+			logMessage("Sorting the public key transactions of %d key ranges.\n", partitions);
+			ThreadPool *pool = ThreadPool::create(partitions);
+			pool->parallelFor(partitions, [&](uint32_t p)
+			{
+				// Nothing in here may log; failures are reported below, on this thread
+				if (succeeded[p])
+				{
+					succeeded[p] = sorters[p]->finish(segments[p]);
+					if (succeeded[p])
+					{
+						segments[p].close();
+					}
+					else
+					{
+						segments[p].abandon();
+					}
 				}
+				delete sorters[p];
+				sorters[p] = nullptr;
+			});
+			pool->release();
 
-				// Each output gets added to the UTXO hash map
-				for (uint32_t i = 0; i < bt.outputCount; i++)
+			logMessage("Saving %s public key records; this is the fully collated set of transactions corresponding to each unique public key address.\n", formatNumber(mPublicKeyCount));
+			bool ok = writer.open(mPublicKeyCount, transactionCount, transactionOffset);
+			for (uint32_t p = 0; ok && p < partitions; p++)
+			{
+				if (!succeeded[p] || !writer.appendSegment(segments[p]))
 				{
-					const BlockChain::BlockOutput &bo = bt.outputs[i];
-					uint32_t addressIndex = getPublicKeyIndex(bo.asciiAddress);
-					t.addOutput(bo,addressIndex);
-					// Add it to the UTXO set
-					UTXO utxo(fileOffset, i);
-					mUTXO[utxo] = bo.value;			// Crash occurred here?  Why?
+					logMessage("Failed to build the public key records for key range %d.\n", p);
+					ok = false;
+				}
+			}
+			if (ok)
+			{
+				writer.close();
+			}
+			else
+			{
+				writer.abandon();
+				for (uint32_t p = 0; p < partitions; p++)
+				{
+					segments[p].abandon();	// Deletes whichever segment files were not appended
 				}
+			}
+			delete[]segments;
+		}
 
-				t.save(mTransactionFile);
-				Hash256 h(bt.transactionHash);
-				TransactionHash th(h);
-				th.setFileOffset(fileOffset);
-				th.setTimeStamp(b->timeStamp);
+		// Writes PublicKeyIndex.bin; the address to public key index lookup table
+		void buildPublicKeyIndex(void)
+		{
+			if (mAddresses == nullptr)
+			{
+				return;
+			}
+			closePublicKeyIndex();
+			logMessage("Building the address lookup index for %s public keys.\n", formatNumber(mPublicKeyCount));
+			PublicKeyIndexEntryVector sorted(mPublicKeyCount);
+			for (uint32_t i = 0; i < mPublicKeyCount; i++)
+			{
+				sorted[i].mPrefix = getAddressPrefix(mAddresses[i].address);
+				sorted[i].mIndex = i;
+			}
+			SORT::introSort(sorted.data(), sorted.size(), [](const PublicKeyIndexEntry &a, const PublicKeyIndexEntry &b)
+			{
+				return a.mPrefix < b.mPrefix || (a.mPrefix == b.mPrefix && a.mIndex < b.mIndex);
+			});
+			PublicKeyIndexEntryVector tree(size_t(mPublicKeyCount) + 1);
+			memset(&tree[0], 0, sizeof(PublicKeyIndexEntry));
+			buildEytzinger(sorted.data(), tree.data(), mPublicKeyCount, 0, 1);
+
+			FILE_INTERFACE *fph = fi_fopen(PUBLIC_KEY_INDEX_FILE_NAME, "wb", nullptr, 0, false);
+			if (fph == nullptr)
+			{
+				logMessage("Failed to open file '%s' for write access.\n", PUBLIC_KEY_INDEX_FILE_NAME);
+				return;
+			}
+			PublicKeyIndexHeader header;
+			header.mPublicKeyCount = mPublicKeyCount;
+			fi_fwrite(&header, sizeof(header), 1, fph);
+			fi_fwrite(tree.data(), sizeof(PublicKeyIndexEntry)*tree.size(), 1, fph);
+			fi_fclose(fph);
+			logMessage("Saved the address lookup index to '%s'\n", PUBLIC_KEY_INDEX_FILE_NAME);
+		}
 
-				TransactionHashSet::iterator found = mTransactions.find(th);
-				if (found != mTransactions.end() )
+		// Memory maps PublicKeyIndex.bin; rebuilding it first if it is missing or does not match PublicKeys.bin
+		bool loadPublicKeyIndex(void)
+		{
+			if (mPublicKeyIndex)
+			{
+				return true;
+			}
+			for (uint32_t attempt = 0; attempt < 2; attempt++)
+			{
+				mPublicKeyIndexFile = fi_fopen(PUBLIC_KEY_INDEX_FILE_NAME, "rb", nullptr, 0, true);
+				if (mPublicKeyIndexFile)
 				{
-					logMessage("Encountered the same transaction hash twice; this appears to be a bug and must be fixed! Ignoring second occurence for now.\n");
-					logMessage("DuplicateHash:");
-					printReverseHash((const uint8_t *)&th.mWord0);
-					logMessage("\n");
+					fi_fseek(mPublicKeyIndexFile, 0, SEEK_END);
+					uint64_t length = uint64_t(fi_ftell(mPublicKeyIndexFile));
+					uint64_t bufferLength;
+					const uint8_t *base = (const uint8_t *)fi_getMemBuffer(mPublicKeyIndexFile, &bufferLength);
+					const PublicKeyIndexHeader *header = (const PublicKeyIndexHeader *)base;
+					if (base && length == sizeof(PublicKeyIndexHeader) + sizeof(PublicKeyIndexEntry)*(uint64_t(mPublicKeyCount) + 1) && header->isValid(mPublicKeyCount))
+					{
+						mPublicKeyIndex = (const PublicKeyIndexEntry *)(header + 1);
+						return true;
+					}
+					closePublicKeyIndex();
 				}
-				else
+				if (attempt == 0)
 				{
-					mTransactionCount++;	// increment the transaction count
-					mTransactions.insert(th);	// Add it to the transaction hash table; so we can convert from a transaction hash to a file offset quickly and efficiently
+					logMessage("The address lookup index '%s' is missing or out of date.\n", PUBLIC_KEY_INDEX_FILE_NAME);
+					buildPublicKeyIndex();
 				}
 			}
-			fi_fflush(mTransactionFile);
+			return false;
+		}
 
-			if ((b->blockIndex % 10000) == 0)
+		void closePublicKeyIndex(void)
+		{
+			if (mPublicKeyIndexFile)
 			{
-				closePublicKeyFile(true); //
+				fi_fclose(mPublicKeyIndexFile);
+				mPublicKeyIndexFile = nullptr;
 			}
+			mPublicKeyIndex = nullptr;
 		}
 
-		// Once all of the blocks have been processed and transactions accumulated, we now
-		// can build the public key database; this collates all transaction inputs and outupts
-		// relative to each bitcoin address.
-		// The purpose of this is so that we can later use this pre-processed database to perform
-		// relatively high speed queries against the blockchain.  Most of the interesting data we want to 
-		// collect is relative to public key addresses
-		virtual void buildPublicKeyDatabase(void) override final
+		// Writes PublicKeyClusters.bin; the cluster id of every public key, where a cluster is every key spent from
+		// together with another of its keys in some transaction, and its id is the lowest key index in it.  The clusters
+		// are found in one scan of the transactions by every thread joining keys in one shared, lock free forest.
+		void buildPublicKeyClusters(void)
 		{
-			if (!mAnalyze)
+			closePublicKeyClusters();
+			fi_fseek(mTransactionFile, 0, SEEK_END);
+			uint64_t transactionFileLength = uint64_t(fi_ftell(mTransactionFile));
+			uint64_t bufferLength;
+			const uint8_t *transactionFileBase = (const uint8_t *)fi_getMemBuffer(mTransactionFile, &bufferLength);
+			if (transactionFileBase == nullptr || mFirstTransactionOffset == 0)
 			{
-				closePublicKeyFile(false);
-				mTransactionFile = nullptr;
-				logMessage("Clearing transactions container\n");
-				mTransactions.clear();		// We no longer need this hash-set of transaction hashes since we have rebased the data based the data based on transaction offset into the datafile
-				logMessage("Clearing UTXO container\n");
-				mUTXO.clear();
+				logMessage("The transactions file '%s' must be memory mapped to cluster the public keys.\n", TRANSACTION_FILE_NAME);
+				return;
+			}
+			logMessage("Clustering %s public keys by common inputs.\n", formatNumber(mPublicKeyCount));
+			uint32_t partitions = mThreadCount ? mThreadCount : ThreadPool::getHardwareThreadCount();
+			ThreadPool *pool = ThreadPool::create(partitions);
+			std::atomic< uint32_t > *parents = new std::atomic< uint32_t >[mPublicKeyCount];
+			pool->parallelFor(partitions, [&](uint32_t p)
+			{
+				uint32_t lastIndex = uint32_t(uint64_t(mPublicKeyCount) * (p + 1) / partitions);
+				for (uint32_t i = uint32_t(uint64_t(mPublicKeyCount) * p / partitions); i < lastIndex; i++)
+				{
+					parents[i].store(i, std::memory_order_relaxed);
+				}
+			});
+			ClusterAnalyzer clusters(parents, mPublicKeyCount);
+			TransactionAnalyzerDriver driver;
+			driver.addAnalyzer(&clusters);
+			driver.run(transactionFileBase, mFirstTransactionOffset, transactionFileLength, mThreadCount);
+			// Point every key straight at its cluster
+			std::vector< uint32_t > clusterIds(mPublicKeyCount);
+			std::vector< uint32_t > clusterCounts(partitions, 0);
+			pool->parallelFor(partitions, [&](uint32_t p)
+			{
+				uint32_t lastIndex = uint32_t(uint64_t(mPublicKeyCount) * (p + 1) / partitions);
+				for (uint32_t i = uint32_t(uint64_t(mPublicKeyCount) * p / partitions); i < lastIndex; i++)
+				{
+					clusterIds[i] = findCluster(parents, i);
+					if (clusterIds[i] == i)
+					{
+						clusterCounts[p]++;
+					}
+				}
+			});
+			pool->release();
+			delete[]parents;
 
-				logMessage("Clearing PublicKeys container\n");
-				mPublicKeys.clear();		// We no longer needs this hash set, so free up the memory
-				mAnalyze = true;
-				logMessage("Opening the transactions file\n");
-				openTransactionsFile();
-				logMessage("Loading the PublicKey address file\n");
-				loadPublicKeyFile();
+			FILE_INTERFACE *fph = fi_fopen(PUBLIC_KEY_CLUSTERS_FILE_NAME, "wb", nullptr, 0, false);
+			if (fph == nullptr)
+			{
+				logMessage("Failed to open file '%s' for write access.\n", PUBLIC_KEY_CLUSTERS_FILE_NAME);
+				return;
 			}
-			logMessage("Creating PublicKey records data  set.\n");
-			PublicKeyRecord *records = new PublicKeyRecord[mPublicKeyCount];
-			for (uint32_t i = 0; i < mPublicKeyCount; i++)
+			PublicKeyClustersHeader header;
+			header.mPublicKeyCount = mPublicKeyCount;
+			header.mTransactionFileLength = transactionFileLength;
+			for (auto i = clusterCounts.begin(); i != clusterCounts.end(); ++i)
 			{
-				records[i].mIndex = i; // assign the array index
+				header.mClusterCount += *i;
 			}
-			logMessage("Building PublicKey records.\n");
-			uint32_t transactionCount = 0;
-			uint64_t transactionOffset = uint64_t(fi_ftell(mTransactionFile));
+			fi_fwrite(&header, sizeof(header), 1, fph);
+			fi_fwrite(clusterIds.data(), sizeof(uint32_t)*clusterIds.size(), 1, fph);
+			fi_fclose(fph);
+			logMessage("Saved %s clusters of public keys to '%s'\n", formatNumber(header.mClusterCount), PUBLIC_KEY_CLUSTERS_FILE_NAME);
+		}
+
+		// Memory maps PublicKeyClusters.bin; rebuilding it first if it is missing or older than TransactionFile.bin
+		bool loadPublicKeyClusters(void)
+		{
+			if (mPublicKeyClusters)
+			{
+				return true;
+			}
+			if (mTransactionFile == nullptr)
+			{
+				return false;
+			}
+			fi_fseek(mTransactionFile, 0, SEEK_END);
+			uint64_t transactionFileLength = uint64_t(fi_ftell(mTransactionFile));
+			for (uint32_t attempt = 0; attempt < 2; attempt++)
+			{
+				mPublicKeyClustersFile = fi_fopen(PUBLIC_KEY_CLUSTERS_FILE_NAME, "rb", nullptr, 0, true);
+				if (mPublicKeyClustersFile)
+				{
+					fi_fseek(mPublicKeyClustersFile, 0, SEEK_END);
+					uint64_t length = uint64_t(fi_ftell(mPublicKeyClustersFile));
+					uint64_t bufferLength;
+					const uint8_t *base = (const uint8_t *)fi_getMemBuffer(mPublicKeyClustersFile, &bufferLength);
+					const PublicKeyClustersHeader *header = (const PublicKeyClustersHeader *)base;
+					if (base && length == sizeof(PublicKeyClustersHeader) + sizeof(uint32_t)*uint64_t(mPublicKeyCount) && header->isValid(mPublicKeyCount, transactionFileLength))
+					{
+						mPublicKeyClusters = (const uint32_t *)(header + 1);
+						return true;
+					}
+					closePublicKeyClusters();
+				}
+				if (attempt == 0)
+				{
+					logMessage("The public key clusters '%s' are missing or out of date.\n", PUBLIC_KEY_CLUSTERS_FILE_NAME);
+					buildPublicKeyClusters();
+				}
+			}
+			return false;
+		}
+
+		void closePublicKeyClusters(void)
+		{
+			if (mPublicKeyClustersFile)
+			{
+				fi_fclose(mPublicKeyClustersFile);
+				mPublicKeyClustersFile = nullptr;
+			}
+			mPublicKeyClusters = nullptr;
+		}
+
+		// Returns the index of the public key with this ASCII bitcoin address; 0xFFFFFFFF if it is not in the database
+		virtual uint32_t lookupPublicKey(const char *address) const override final
+		{
+			uint8_t binary[25];
+			if (mPublicKeyIndex == nullptr || !bitcoinAsciiToAddress(address, binary))
+			{
+				return 0xFFFFFFFF;
+			}
+			uint64_t prefix = getAddressPrefix(binary);
+			// Descend to the first entry whose prefix is not less than ours
+			size_t count = mPublicKeyCount;
+			size_t k = 1;
+			while (k <= count)
+			{
+				k = k * 2 + (mPublicKeyIndex[k].mPrefix < prefix ? 1 : 0);
+			}
+			while (k & 1)
+			{
+				k >>= 1;
+			}
+			k >>= 1;
+			for (; k && mPublicKeyIndex[k].mPrefix == prefix; k = getNextEytzinger(k, count))
+			{
+				uint32_t index = mPublicKeyIndex[k].mIndex;
+				if (memcmp(mAddresses[index].address, binary, sizeof(binary)) == 0)
+				{
+					return index;
+				}
+			}
+			return 0xFFFFFFFF;
+		}
+
+		// Runs every transaction from the current location of 'fph' through processTransaction.
+		// Only the thread doing the logging may use formatNumber, which is not thread safe.
+		void scanPublicKeyTransactions(FILE_INTERFACE *fph,PublicKeyRecordSink &sink,bool logProgress,uint32_t &transactionCount,uint64_t &transactionOffset)
+		{
+			transactionCount = 0;
+			transactionOffset = uint64_t(fi_ftell(fph));
 			Transaction t;
-			while (readTransaction(t, transactionOffset))
+			while (readTransaction(fph, t, transactionOffset))
 			{
 				transactionCount++;
-				if ((transactionCount % 10000) == 0)
+				if (logProgress && (transactionCount % 10000) == 0)
 				{
 					logMessage("Processing transaction %s\n", formatNumber(transactionCount));
 				}
 				uint64_t toffset = transactionOffset; // the base transaction offset
-				transactionOffset = uint64_t(fi_ftell(mTransactionFile));
-				processTransaction(t,toffset,records);
-				// do stuff here...
+				transactionOffset = uint64_t(fi_ftell(fph));
+				processTransaction(t, toffset, sink, logProgress);
 			}
-			logMessage("Public Key Records built.\n");
-			savePublicKeyRecords(records); // save the records to disk!
-			logMessage("Finished saving public records, now deleting them.\n");
-			delete[]records;
-			logMessage("Public record deletion now complete.\n");
+		}
+
+		// Sets how many threads the records build uses; zero means one per hardware thread
+		virtual void setThreadCount(uint32_t threadCount) override final
+		{
+			mThreadCount = threadCount;
+		}
+
+		// Sets the format every report is written in
+		virtual void setReportFormat(ReportWriter::Format format) override final
+		{
+			mReportFormat = format;
+		}
+
+		// Sets how much memory the records build may use for sorting before it spills to disk
+		virtual void setMemoryBudget(uint64_t bytes) override final
+		{
+			mMemoryBudget = bytes;
 		}
 
 		// Process all of the inputs and outputs in this transaction and correlate them with the records
-		// for each corresponding public key
-		void processTransaction(const Transaction &t,uint64_t transactionOffset,PublicKeyRecord *records)
+		// for each corresponding public key.  Each input already knows which key and value it is spending, so this
+		// never has to go back and read the previous transactions.
+		void processTransaction(const Transaction &t,uint64_t transactionOffset,PublicKeyRecordSink &records,bool logWarnings=true)
 		{
 			bool hasCoinBase = false;
 
@@ -1387,30 +3905,23 @@ namespace PUBLIC_KEY_DATABASE
 				const TransactionInput &ti = (*i);
 				if (ti.mTransactionIndex != 0xFFFFFFFF) // if it is not a coinbase input...
 				{
-					Transaction inputTransaction;
-					readTransaction(inputTransaction, ti.mTransactionFileOffset);
-					if (ti.mTransactionIndex < inputTransaction.mOutputs.size())
+					if (ti.mKeyIndex < mPublicKeyCount)
 					{
-						TransactionOutput &to = inputTransaction.mOutputs[ti.mTransactionIndex];
-						if (to.mIndex < mPublicKeyCount)
-						{
-							PublicKeyRecord &record = records[to.mIndex]; // ok...let's get the record
-							PublicKeyTransaction pt;
-							pt.mCoinbase = false;
-							pt.mSpend = true;	// we are spending a previous output here...
-							pt.mTimeStamp = t.mTransactionTime;
-							pt.mTransactionOffset = transactionOffset;
-							pt.mValue = to.mValue;
-							record.mTransactions.push_back(pt);
-						}
-						else
-						{
-							logMessage("WARNING! Encountered index to public key #%s but the maximum number of public keys we have is %s\n", formatNumber(to.mIndex), formatNumber(mPublicKeyCount));
-						}
+						PublicKeyTransaction pt;
+						pt.mCoinbase = false;
+						pt.mSpend = true;	// we are spending a previous output here...
+						pt.mTimeStamp = t.mTransactionTime;
+						pt.mTransactionOffset = transactionOffset;
+						pt.mValue = ti.mInputValue;
+						records.addPublicKeyTransaction(ti.mKeyIndex, BlockChain::KT_LAST, pt);
 					}
-					else
+					else if (logWarnings && ti.mKeyIndex == 0xFFFFFFFF)
+					{
+						logMessage("WARNING! Skipping an input whose spent output could not be resolved when it was ingested\n");
+					}
+					else if (logWarnings)
 					{
-						logMessage("Invalid transaction index of %d; maximum outputs in this transaction are %d\n", ti.mTransactionIndex, inputTransaction.mOutputs.size());
+						logMessage("WARNING! Encountered index to public key #%s but the maximum number of public keys we have is %s\n", formatNumber(ti.mKeyIndex), formatNumber(mPublicKeyCount));
 					}
 				}
 				else
@@ -1431,51 +3942,80 @@ namespace PUBLIC_KEY_DATABASE
 				pt.mTransactionOffset = transactionOffset;
 				pt.mValue = to.mValue;
 
-				PublicKeyRecord &record = records[to.mIndex]; // ok...let's get the record
 				if (to.mIndex < mPublicKeyCount)
 				{
-					record.mKeyType = to.mKeyType;
-
 					// see if any of the transaction inputs is this output, in which case this gets flagged as 'change'
 					for (auto i = t.mInputs.begin(); i != t.mInputs.end(); ++i)
 					{
 						const TransactionInput &ti = (*i);
-						if (ti.mTransactionIndex != 0xFFFFFFFF) // if it is not a coinbase input...
+						if (ti.mTransactionIndex != 0xFFFFFFFF && ti.mKeyIndex == to.mIndex) // if it is not a coinbase input...
 						{
-							Transaction inputTransaction;
-							readTransaction(inputTransaction, ti.mTransactionFileOffset);
-							if (ti.mTransactionIndex < inputTransaction.mOutputs.size())
-							{
-								TransactionOutput &pto = inputTransaction.mOutputs[ti.mTransactionIndex];
-								if (pto.mIndex == to.mIndex)
-								{
-									pt.mChange = true;
-									break;
-								}
-							}
+							pt.mChange = true;
+							break;
 						}
 					}
-					record.mTransactions.push_back(pt);
+					records.addPublicKeyTransaction(to.mIndex, to.mKeyType, pt);
 				}
-				else
+				else if (logWarnings)
 				{
 					logMessage("WARNING! Encountered index to public key #%s but the maximum number of public keys we have is %s\n", formatNumber(to.mIndex), formatNumber(mPublicKeyCount));
 				}
 			}
 		}
 
+		// Whether every transaction spent by this block is either in the hash set or earlier in the block itself;
+		// logs the first one which is not
+		bool findSpentTransactions(const BlockChain::Block *b)
+		{
+			for (uint32_t i = 0; i < b->transactionCount; i++)
+			{
+				const BlockChain::BlockTransaction &bt = b->transactions[i];
+				for (uint32_t j = 0; j < bt.inputCount; j++)
+				{
+					const BlockChain::BlockInput &bi = bt.inputs[j];
+					if (bi.transactionIndex == 0xFFFFFFFF)
+					{
+						continue;	// coinbase
+					}
+					Hash256 h(bi.transactionHash);
+					if (mTransactions.find(TransactionHash(h)) != mTransactions.end())
+					{
+						continue;
+					}
+					uint32_t k = 0;
+					while (k < i && memcmp(b->transactions[k].transactionHash, bi.transactionHash, sizeof(bt.transactionHash)) != 0)
+					{
+						k++;
+					}
+					if (k == i)
+					{
+						logMessage("ERROR: Failed to find transaction ");
+						printReverseHash(bi.transactionHash);
+						logMessage(" spent by block %s.\n", formatNumber(b->blockIndex));
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
 		// Logically 'reads' a Transaction; but since this is via a memory mapped file this will 
 		// just be memory copies
 		bool readTransaction(Transaction &t, uint64_t transactionOffset)
+		{
+			return readTransaction(mTransactionFile, t, transactionOffset);
+		}
+
+		bool readTransaction(FILE_INTERFACE *fph, Transaction &t, uint64_t transactionOffset)
 		{
 			bool ret = false;
 
 			{
-				fi_fseek(mTransactionFile, size_t(transactionOffset), SEEK_SET);
-				uint64_t actual = uint64_t(fi_ftell(mTransactionFile));
+				fi_fseek(fph, size_t(transactionOffset), SEEK_SET);
+				uint64_t actual = uint64_t(fi_ftell(fph));
 				if (actual == transactionOffset)
 				{
-					ret = t.read(mTransactionFile); // read this transaction 
+					ret = t.read(fph); // read this transaction 
 				}
 			}
 
@@ -1510,13 +4050,13 @@ namespace PUBLIC_KEY_DATABASE
 				logMessage("Failed to open transaction file '%s' for read access.\n", TRANSACTION_FILE_NAME);
 				return false;
 			}
-			size_t slen = strlen(magicID);
+			size_t slen = strlen(transactionFileMagicID);
 			char *temp = new char[slen + 1];
 			size_t r = fi_fread(temp, slen + 1, 1, mTransactionFile);
 			bool ret = false;
 			if (r == 1)
 			{
-				if (strcmp(temp, magicID) == 0)
+				if (strcmp(temp, transactionFileMagicID) == 0)
 				{
 					ret = true;
 					logMessage("Successfully opened the transaction file '%s' for read access.\n", TRANSACTION_FILE_NAME);
@@ -1555,57 +4095,277 @@ namespace PUBLIC_KEY_DATABASE
 			}
 			else
 			{
-				ret = (*found).mIndex;
+				ret = (*found).mIndex;
+			}
+
+			return ret;
+		}
+
+		// Merges the transactions appended to the transactions file since the records file was last built into it.
+		// Records with spare capacity are extended in place; a record which outgrows its capacity is moved to the
+		// end of the file with room to grow, and the space it leaves behind is reclaimed by compaction once enough has
+		// accumulated.  Returns false if there is no usable records file, in which case a full build is required.
+		bool updatePublicKeyRecords(void)
+		{
+			FILE_INTERFACE *fph = fi_fopen(PUBLIC_KEY_RECORDS_FILE_NAME, "rb+", nullptr, 0, false);
+			if (fph == nullptr)
+			{
+				return false;
+			}
+			// The header's transaction count includes every transaction saved to the transactions file, duplicated
+			// hashes and all, so it is not comparable with mTransactionCount; where it stopped in the file is
+			PublicKeyRecordsHeader header;
+			if (!header.read(fph) ||
+				header.mTransactionFileOffset == 0 ||
+				header.mPublicKeyCount > mPublicKeyCount)
+			{
+				logMessage("The existing public key records file '%s' does not match the transactions file; rebuilding it from scratch.\n", PUBLIC_KEY_RECORDS_FILE_NAME);
+				fi_fclose(fph);
+				return false;
+			}
+			fi_fseek(mTransactionFile, 0, SEEK_END);
+			uint64_t transactionFileLength = uint64_t(fi_ftell(mTransactionFile));
+			if (header.mTransactionFileOffset < mFirstTransactionOffset || header.mTransactionFileOffset > transactionFileLength)
+			{
+				logMessage("The public key records file '%s' refers past the end of the transactions file; rebuilding it from scratch.\n", PUBLIC_KEY_RECORDS_FILE_NAME);
+				fi_fclose(fph);
+				return false;
+			}
+			fi_fseek(mTransactionFile, header.mTransactionFileOffset, SEEK_SET);
+
+			logMessage("Updating the public key records with the transactions appended since they were built.\n");
+			PublicKeyRecordMap pending;
+			uint32_t transactionCount = header.mTransactionCount;
+			uint64_t transactionOffset = header.mTransactionFileOffset;
+			Transaction t;
+			while (readTransaction(t, transactionOffset))
+			{
+				transactionCount++;
+				if ((transactionCount % 10000) == 0)
+				{
+					logMessage("Processing transaction %s\n", formatNumber(transactionCount));
+				}
+				uint64_t toffset = transactionOffset;
+				transactionOffset = uint64_t(fi_ftell(mTransactionFile));
+				processTransaction(t, toffset, pending);
+			}
+			logMessage("Found %s new transactions.\n", formatNumber(transactionCount - header.mTransactionCount));
+
+			// The offsets table can't hold the new public keys; rewrite the file with a larger one first
+			if (mPublicKeyCount > header.mPublicKeyCapacity)
+			{
+				fph = compactPublicKeyRecords(fph, header);
+				if (fph == nullptr)
+				{
+					return false;
+				}
+			}
+
+			// Mark the file as half updated until we are done, so an interrupted update forces a rebuild
+			header.mTransactionFileOffset = 0;
+			header.write(fph);
+			fi_fflush(fph);
+
+			// Visit the records in index order; which is also roughly the order they sit in the file
+			std::vector< uint32_t > indices;
+			indices.reserve(pending.mRecords.size());
+			for (auto i = pending.mRecords.begin(); i != pending.mRecords.end(); ++i)
+			{
+				indices.push_back((*i).first);
+			}
+			std::sort(indices.begin(), indices.end());
+
+			fi_fseek(fph, 0, SEEK_END);
+			uint64_t endOfFile = uint64_t(fi_ftell(fph));
+			uint32_t relocated = 0;
+			for (auto i = indices.begin(); i != indices.end(); ++i)
+			{
+				PublicKeyRecord &r = pending.mRecords[*i];
+				uint32_t newCount = uint32_t(r.mTransactions.size());
+
+				uint64_t recordOffset = 0;
+				if (r.mIndex < header.mPublicKeyCount)
+				{
+					fi_fseek(fph, header.getOffsetLocation(r.mIndex), SEEK_SET);
+					fi_fread(&recordOffset, sizeof(recordOffset), 1, fph);
+				}
+
+				PublicKeyRecordFile rf = PublicKeyRecordFile();
+				if (recordOffset)
+				{
+					fi_fseek(fph, recordOffset, SEEK_SET);
+					fi_fread(&rf, publicKeyRecordHeaderSize, 1, fph);
+				}
+				else
+				{
+					rf.mIndex = r.mIndex;
+				}
+				if (r.mKeyType != BlockChain::KT_LAST)
+				{
+					rf.mKeyType = r.mKeyType;	// the most recent output decides the key type, just as in a full build
+				}
+				// The running totals carry on from the last transaction already stored for this key
+				uint32_t oldCount = rf.mCount;
+				if (oldCount)
+				{
+					PublicKeyTransaction previous;
+					fi_fseek(fph, recordOffset + publicKeyRecordHeaderSize + uint64_t(oldCount - 1)*sizeof(PublicKeyTransaction), SEEK_SET);
+					fi_fread(&previous, sizeof(previous), 1, fph);
+					r.computeRunningTotals(&previous);
+				}
+				else
+				{
+					r.computeRunningTotals(nullptr);
+				}
+				const PublicKeyTransaction &last = r.mTransactions[newCount - 1];
+				rf.mBalance = last.mBalance;
+				rf.mLastSendTime = last.mLastSendTime;
+				rf.mLastReceiveTime = last.mLastReceiveTime;
+
+				rf.mCount += newCount;
+				if (recordOffset && rf.mCount <= rf.mCapacity)
+				{
+					// Fits in the slack at the end of the existing record
+					fi_fseek(fph, recordOffset, SEEK_SET);
+					fi_fwrite(&rf, publicKeyRecordHeaderSize, 1, fph);
+					fi_fseek(fph, recordOffset + publicKeyRecordHeaderSize + uint64_t(oldCount)*sizeof(PublicKeyTransaction), SEEK_SET);
+					fi_fwrite(&r.mTransactions[0], sizeof(PublicKeyTransaction)*newCount, 1, fph);
+				}
+				else
+				{
+					// Move the record to the end of the file; a key which has grown once is likely to keep growing,
+					// so it gets twice the room it needs
+					PublicKeyTransactionVector oldTransactions;
+					if (oldCount)
+					{
+						oldTransactions.resize(oldCount);
+						fi_fseek(fph, recordOffset + publicKeyRecordHeaderSize, SEEK_SET);
+						fi_fread(&oldTransactions[0], sizeof(PublicKeyTransaction)*oldCount, 1, fph);
+						header.mGarbage += publicKeyRecordHeaderSize + uint64_t(rf.mCapacity)*sizeof(PublicKeyTransaction);
+						relocated++;
+					}
+					rf.mCapacity = recordOffset ? rf.mCount * 2 : getRecordCapacity(rf.mCount);
+
+					fi_fseek(fph, endOfFile, SEEK_SET);
+					fi_fwrite(&rf, publicKeyRecordHeaderSize, 1, fph);
+					if (oldCount)
+					{
+						fi_fwrite(&oldTransactions[0], sizeof(PublicKeyTransaction)*oldCount, 1, fph);
+					}
+					fi_fwrite(&r.mTransactions[0], sizeof(PublicKeyTransaction)*newCount, 1, fph);
+					writeEmptyTransactions(fph, rf.mCapacity - rf.mCount);
+
+					fi_fseek(fph, header.getOffsetLocation(r.mIndex), SEEK_SET);
+					fi_fwrite(&endOfFile, sizeof(endOfFile), 1, fph);
+					endOfFile += publicKeyRecordHeaderSize + uint64_t(rf.mCapacity)*sizeof(PublicKeyTransaction);
+				}
+			}
+			logMessage("Updated %s public key records; %s of them had to be moved to make room.\n", formatNumber(uint32_t(indices.size())), formatNumber(relocated));
+
+			header.mPublicKeyCount = mPublicKeyCount;
+			header.mTransactionCount = transactionCount;
+			header.mTransactionFileOffset = transactionOffset;
+			header.write(fph);
+			fi_fflush(fph);
+
+			if (header.mGarbage > endOfFile / PUBLIC_KEY_RECORDS_GARBAGE_RATIO)
+			{
+				fph = compactPublicKeyRecords(fph, header);
+			}
+			if (fph)
+			{
+				fi_fclose(fph);
 			}
-
-			return ret;
+			logMessage("All records now saved to file '%s'\n", PUBLIC_KEY_RECORDS_FILE_NAME);
+			return true;
 		}
 
-		// Save all of the public key records we built
-		void savePublicKeyRecords(PublicKeyRecord *records)
+		// Rewrites the records file without the space abandoned by relocated records, resetting each record to its
+		// default capacity, and with the tables sized for the current number of public keys.  Keys which do not have
+		// a record yet get an offset of zero.  Returns the new file opened for update, or null on failure.
+		FILE_INTERFACE *compactPublicKeyRecords(FILE_INTERFACE *fph,PublicKeyRecordsHeader &header)
 		{
-			logMessage("Saving %s public key records; this is the fully collated set of transactions corresponding to each unique public key address.\n", formatNumber(mPublicKeyCount));
-			FILE_INTERFACE *fph = fi_fopen(PUBLIC_KEY_RECORDS_FILE_NAME, "wb+", nullptr, 0, false);
-			if (fph)
+			logMessage("Compacting the public key records file '%s'\n", PUBLIC_KEY_RECORDS_FILE_NAME);
+			FILE_INTERFACE *dest = fi_fopen(PUBLIC_KEY_RECORDS_TEMP_FILE_NAME, "wb+", nullptr, 0, false);
+			if (dest == nullptr)
 			{
-				size_t slen = strlen(magicID);
-				fi_fwrite(magicID, slen + 1, 1, fph);		// Save the MagicID
-				fi_fwrite(&mPublicKeyCount, sizeof(mPublicKeyCount), 1, fph);	// Save the number of public keys
-
-				uint64_t seekLocationsStart = uint64_t(fi_ftell(fph)); // remember the seek location for the seek locations table
-
-				uint64_t *seekLocations = new uint64_t[mPublicKeyCount];	// Allocate memory for the seek locations table
-
-				memset(seekLocations, 0, sizeof(uint64_t)*mPublicKeyCount);	// Zero out the seek locations table
-				// Write it out *twice*; once for offsets and the second time will be used for sorting all of the public key records
-				fi_fwrite(seekLocations, sizeof(uint64_t)*mPublicKeyCount, 1, fph);
-				fi_fwrite(seekLocations, sizeof(uint64_t)*mPublicKeyCount, 1, fph);	// save this out twice; this one reserved for sorting pointers via the MemoryMapped file address space
-				// Now, we save each record and, as we do so, we record the seek offset location
-				for (uint64_t i = 0; i < mPublicKeyCount; i++)
+				logMessage("Failed to open file '%s' for write access.\n", PUBLIC_KEY_RECORDS_TEMP_FILE_NAME);
+				fi_fclose(fph);
+				return nullptr;
+			}
+			uint32_t oldCount = header.mPublicKeyCount;
+			uint64_t *seekLocations = new uint64_t[oldCount];
+			fi_fseek(fph, header.getOffsetLocation(0), SEEK_SET);
+			fi_fread(seekLocations, sizeof(uint64_t)*oldCount, 1, fph);
+
+			PublicKeyRecordsHeader newHeader(header);
+			newHeader.mPublicKeyCapacity = getRecordCapacity(mPublicKeyCount);
+			newHeader.mGarbage = 0;
+			newHeader.write(dest);
+			uint64_t *newSeekLocations = new uint64_t[newHeader.mPublicKeyCapacity];
+			memset(newSeekLocations, 0, sizeof(uint64_t)*newHeader.mPublicKeyCapacity);
+			fi_fwrite(newSeekLocations, sizeof(uint64_t)*newHeader.mPublicKeyCapacity, 1, dest);
+			fi_fwrite(newSeekLocations, sizeof(uint64_t)*newHeader.mPublicKeyCapacity, 1, dest);
+
+			PublicKeyTransactionVector transactions;
+			for (uint32_t i = 0; i < oldCount; i++)
+			{
+				if (seekLocations[i] == 0)
 				{
-					seekLocations[i] = uint64_t(fi_ftell(fph)); // remember the offset for this record...
-					records[i].save(fph);
+					continue;
 				}
-				fi_fseek(fph, seekLocationsStart, SEEK_SET);	// Seek back to the start of the offsets table in the file
-				fi_fwrite(seekLocations, sizeof(uint64_t)*mPublicKeyCount, 1, fph); // write out the offsets
-
-				delete[]seekLocations;
-
-				fi_fclose(fph);
-				logMessage("All records now saved to file '%s'\n", PUBLIC_KEY_RECORDS_FILE_NAME);
+				PublicKeyRecordFile rf;
+				fi_fseek(fph, seekLocations[i], SEEK_SET);
+				fi_fread(&rf, publicKeyRecordHeaderSize, 1, fph);
+				transactions.resize(rf.mCount);
+				if (rf.mCount)
+				{
+					fi_fread(&transactions[0], sizeof(PublicKeyTransaction)*rf.mCount, 1, fph);
+				}
+				rf.mCapacity = getRecordCapacity(rf.mCount);
+				newSeekLocations[i] = uint64_t(fi_ftell(dest));
+				fi_fwrite(&rf, publicKeyRecordHeaderSize, 1, dest);
+				if (rf.mCount)
+				{
+					fi_fwrite(&transactions[0], sizeof(PublicKeyTransaction)*rf.mCount, 1, dest);
+				}
+				writeEmptyTransactions(dest, rf.mCapacity - rf.mCount);
+			}
+			fi_fseek(dest, newHeader.getOffsetLocation(0), SEEK_SET);
+			fi_fwrite(newSeekLocations, sizeof(uint64_t)*newHeader.mPublicKeyCapacity, 1, dest);
+			delete[]seekLocations;
+			delete[]newSeekLocations;
+
+			fi_fclose(dest);
+			fi_fclose(fph);
+			fi_deleteFile(PUBLIC_KEY_RECORDS_FILE_NAME);
+			if (rename(PUBLIC_KEY_RECORDS_TEMP_FILE_NAME, PUBLIC_KEY_RECORDS_FILE_NAME) != 0)
+			{
+				logMessage("Failed to rename '%s' to '%s'\n", PUBLIC_KEY_RECORDS_TEMP_FILE_NAME, PUBLIC_KEY_RECORDS_FILE_NAME);
+				return nullptr;
 			}
+			header = newHeader;
+			return fi_fopen(PUBLIC_KEY_RECORDS_FILE_NAME, "rb+", nullptr, 0, false);
 		}
 
 		// Close the unique public keys file
+		// Both the checkpoint and the final close also record an ingest checkpoint which '-resume' can continue from
 		void closePublicKeyFile(bool isCheckPoint)
 		{
 			assert(mTransactionCount == uint32_t(mTransactions.size()));
 			assert(mPublicKeyCount == uint32_t(mPublicKeys.size()));
 
+			IngestCheckpoint checkpoint;
+			checkpoint.mBlockIndex = mLastBlockIndex;
+			memcpy(checkpoint.mBlockHash, mLastBlockHash, sizeof(checkpoint.mBlockHash));
+			checkpoint.mTransactionCount = mTransactionCount;
+			checkpoint.mPublicKeyCount = mPublicKeyCount;
+
 			// Write out the total number of transactions and then close the transactions file
 			if (mTransactionFile)
 			{
 				uint64_t curLoc = fi_ftell(mTransactionFile);
+				checkpoint.mTransactionFileLength = curLoc;
 				if (isCheckPoint)
 				{
 					logMessage("Checkpointing the transaction file which contains %s transactions.\n", formatNumber(mTransactionCount));
@@ -1616,6 +4376,7 @@ namespace PUBLIC_KEY_DATABASE
 				}
 				fi_fseek(mTransactionFile, mTransactionFileCountSeekLocation, SEEK_SET);
 				fi_fwrite(&mTransactionCount, sizeof(mTransactionCount), 1, mTransactionFile);
+				fi_fflush(mTransactionFile);
 				if (isCheckPoint)
 				{
 					fi_fseek(mTransactionFile, curLoc, SEEK_SET);
@@ -1636,6 +4397,7 @@ namespace PUBLIC_KEY_DATABASE
 			if (mPublicKeyFile)
 			{
 				uint64_t curLoc = fi_ftell(mPublicKeyFile);
+				checkpoint.mPublicKeyFileLength = curLoc;
 				if (isCheckPoint)
 				{
 					logMessage("Checkpointing the PublicKeys file\n");
@@ -1646,6 +4408,7 @@ namespace PUBLIC_KEY_DATABASE
 				}
 				fi_fseek(mPublicKeyFile, mPublicKeyFileCountSeekLocation, SEEK_SET);
 				fi_fwrite(&mPublicKeyCount, sizeof(mPublicKeyCount), 1, mPublicKeyFile);
+				fi_fflush(mPublicKeyFile);
 				if (isCheckPoint)
 				{
 					fi_fseek(mPublicKeyFile, curLoc, SEEK_SET);
@@ -1660,6 +4423,12 @@ namespace PUBLIC_KEY_DATABASE
 			{
 				assert(0);
 			}
+
+			// Only once both files have been flushed do we claim they are consistent
+			if (checkpoint.mTransactionFileLength && checkpoint.mPublicKeyFileLength)
+			{
+				checkpoint.save();
+			}
 		}
 
 		// load the public keys; does so as a memory mapped file though
@@ -1741,51 +4510,37 @@ namespace PUBLIC_KEY_DATABASE
 				logMessage("Failed to open public key file '%s' for read access.\n", PUBLIC_KEY_RECORDS_FILE_NAME);
 				return false;
 			}
-			size_t slen = strlen(magicID);
-			char *temp = new char[slen + 1];
-			size_t r = fi_fread(temp, slen + 1, 1, mPublicKeyRecordFile);
-			if (r == 1)
+			PublicKeyRecordsHeader header;
+			if (header.read(mPublicKeyRecordFile))
 			{
-				if (strcmp(temp, magicID) == 0)
+				logMessage("Successfully opened the public key records file '%s' for read access.\n", PUBLIC_KEY_RECORDS_FILE_NAME);
+				assert(header.mPublicKeyCount); // if the public key count is zero; this probably indicates that the file did not close cleanly on creation. We could derive the count if necessary...
+				assert(header.mPublicKeyCount == mPublicKeyCount);
+				if (header.mTransactionFileOffset == 0)
 				{
-					logMessage("Successfully opened the public key records file '%s' for read access.\n", PUBLIC_KEY_RECORDS_FILE_NAME);
-					uint32_t publicKeyCount = 0;
-					r = fi_fread(&publicKeyCount, sizeof(publicKeyCount), 1, mPublicKeyRecordFile);
-					if (r == 1)
-					{
-						assert(publicKeyCount); // if the public key count is zero; this probably indicates that the file did not close cleanly on creation. We could derive the count if necessary...
-						assert(publicKeyCount == mPublicKeyCount);
-						mPublicKeyCount = publicKeyCount;
-						logMessage("Initializing pointer tables for %s public keys records\n", formatNumber(mPublicKeyCount));
-						mPublicKeyRecordOffsets = (const uint64_t *)fi_getCurrentMemoryLocation(mPublicKeyRecordFile);
-						mPublicKeyRecordSorted = (PublicKeyRecordFile **)(mPublicKeyRecordOffsets + mPublicKeyCount);
-						size_t size;
-						// This is the base address of the memory mapped file
-						mPublicKeyRecordBaseAddress = (uint8_t *)fi_getMemBuffer(mPublicKeyRecordFile, &size);
-						// Initialize the public key sorted records array.
-						for (uint32_t i = 0; i < mPublicKeyCount; i++)
-						{
-							uint64_t offset = mPublicKeyRecordOffsets[i];
-							uint8_t *ptr = &mPublicKeyRecordBaseAddress[offset];
-							PublicKeyRecordFile *pkrf = (PublicKeyRecordFile *)ptr;
-							mPublicKeyRecordSorted[i]   = pkrf;
-						}
-					}
-					else
-					{
-						logMessage("Failed to read from public key records file.\n");
-					}
+					logMessage("WARNING: The public key records file was not completely updated; rebuild it with '-analyze -rebuild'\n");
 				}
-				else
+				mPublicKeyCount = header.mPublicKeyCount;
+				logMessage("Initializing pointer tables for %s public keys records\n", formatNumber(mPublicKeyCount));
+				mPublicKeyRecordOffsets = (const uint64_t *)fi_getCurrentMemoryLocation(mPublicKeyRecordFile);
+				mPublicKeyRecordSorted = (PublicKeyRecordFile **)(mPublicKeyRecordOffsets + header.mPublicKeyCapacity);
+				uint64_t size;
+				// This is the base address of the memory mapped file
+				mPublicKeyRecordBaseAddress = (uint8_t *)fi_getMemBuffer(mPublicKeyRecordFile, &size);
+				// Initialize the public key sorted records array.
+				for (uint32_t i = 0; i < mPublicKeyCount; i++)
 				{
-					logMessage("Not a valid header block.\n");
+					uint64_t offset = mPublicKeyRecordOffsets[i];
+					uint8_t *ptr = &mPublicKeyRecordBaseAddress[offset];
+					PublicKeyRecordFile *pkrf = (PublicKeyRecordFile *)ptr;
+					mPublicKeyRecordSorted[i]   = pkrf;
 				}
+				ret = true;
 			}
 			else
 			{
-				logMessage("Not a valid file failed to read header.\n");
+				logMessage("Not a valid public key records file (or one written by an older version); rebuild it with '-analyze -rebuild'\n");
 			}
-			delete[]temp;
 
 			return ret;
 		}
@@ -1815,6 +4570,300 @@ namespace PUBLIC_KEY_DATABASE
 			return *pkrf;
 		}
 
+		const PublicKeyRecordFile &getPublicKeyRecordFile(uint32_t index) const
+		{
+			uint64_t offset = mPublicKeyRecordOffsets[index];
+			const uint8_t *ptr = &mPublicKeyRecordBaseAddress[offset];
+			return *(const PublicKeyRecordFile *)(ptr);
+		}
+
+		virtual bool getAddressAscii(uint32_t index, char *address, uint32_t maxLength) const override final
+		{
+			if (index >= mPublicKeyCount || mAddresses == nullptr)
+			{
+				return false;
+			}
+			return bitcoinAddressToAscii(mAddresses[index].address, address, maxLength);
+		}
+
+		virtual bool getKeySummary(uint32_t index, uint32_t timeStamp, KeySummary &summary) const override final
+		{
+			if (index >= mPublicKeyCount || mPublicKeyRecordOffsets == nullptr)
+			{
+				return false;
+			}
+			const PublicKeyRecordFile &r = getPublicKeyRecordFile(index);
+			const PublicKeyTransaction *t = r.getTransactionAtTime(timeStamp);
+			memset(&summary, 0, sizeof(summary));
+			summary.mIndex = index;
+			if (t)
+			{
+				summary.mTransactionCount = uint32_t(t - r.mTransactions) + 1;
+				summary.mBalance = t->mBalance;
+				summary.mTotalReceive = t->mTotalReceive;
+				summary.mTotalSend = t->mTotalReceive - t->mBalance;
+				summary.mFirstTime = r.mTransactions[0].mTimeStamp;
+				summary.mLastSendTime = t->mLastSendTime;
+				summary.mLastReceiveTime = t->mLastReceiveTime;
+			}
+			return true;
+		}
+
+		virtual uint32_t getKeyHistory(uint32_t index, uint32_t first, uint32_t maxCount, KeyTransaction *history) const override final
+		{
+			if (index >= mPublicKeyCount || mPublicKeyRecordOffsets == nullptr)
+			{
+				return 0;
+			}
+			const PublicKeyRecordFile &r = getPublicKeyRecordFile(index);
+			uint32_t count = 0;
+			for (uint32_t i = first; i < r.mCount && count < maxCount; i++, count++)
+			{
+				const PublicKeyTransaction &t = r.mTransactions[i];
+				KeyTransaction &h = history[count];
+				h.mValue = t.mValue;
+				h.mBalance = t.mBalance;
+				h.mTimeStamp = t.mTimeStamp;
+				h.mSpend = t.mSpend;
+			}
+			return count;
+		}
+
+		virtual uint32_t getTopBalances(uint32_t maxCount, uint32_t timeStamp, uint32_t *indices, uint64_t *balances) const override final
+		{
+			if (mPublicKeyRecordOffsets == nullptr)
+			{
+				return 0;
+			}
+			// This runs on a query server worker, so it stays on that thread rather than starting a pool of its own
+			BalanceEntryVector top;
+			if (timeStamp == 0xFFFFFFFF)
+			{
+				selectTopBalances(maxCount, [this](uint32_t index)
+				{
+					return getPublicKeyRecordFile(index).getCurrentBalance();
+				}, top, false);
+			}
+			else
+			{
+				selectTopBalances(maxCount, [this, timeStamp](uint32_t index)
+				{
+					return getPublicKeyRecordFile(index).getBalance(timeStamp);
+				}, top, false);
+			}
+			for (size_t i = 0; i < top.size(); i++)
+			{
+				indices[i] = top[i].mIndex;
+				balances[i] = top[i].mBalance;
+			}
+			return uint32_t(top.size());
+		}
+
+		// Looks up a batch of addresses.  The addresses are decoded and found in the index in parallel, then sorted by
+		// where their records live so that the records file is walked in address order, prefetching records ahead of the
+		// one being read, and finally the rows are formatted in parallel and written in the order they were listed.
+		virtual void reportAddressQueries(const char *queryFileName, const char *reportFileName, uint32_t timeStamp) override final
+		{
+			if (mPublicKeyRecordOffsets == nullptr || mPublicKeyIndex == nullptr)
+			{
+				logMessage("The public key records and index must be loaded to query addresses.\n");
+				return;
+			}
+			std::vector< char > text;
+			FILE *fph = fopen(queryFileName, "rb");
+			if (fph == nullptr)
+			{
+				logMessage("Failed to open the address query file '%s'\n", queryFileName);
+				return;
+			}
+			fseek(fph, 0, SEEK_END);
+			text.resize(size_t(ftell(fph)) + 1);
+			fseek(fph, 0, SEEK_SET);
+			size_t length = fread(&text[0], 1, text.size() - 1, fph);
+			fclose(fph);
+			text[length] = 0;
+
+			// One query per non-blank line; each line is terminated in place
+			std::vector< const char * > addresses;
+			char *scan = &text[0];
+			while (*scan)
+			{
+				char *end = scan;
+				while (*end && *end != '\n' && *end != '\r')
+				{
+					end++;
+				}
+				char *next = *end ? end + 1 : end;
+				*end = 0;
+				while (*scan == ' ' || *scan == '\t' || *scan == ',')
+				{
+					scan++;
+				}
+				for (char *trim = end; trim > scan && (trim[-1] == ' ' || trim[-1] == '\t' || trim[-1] == ','); trim--)
+				{
+					trim[-1] = 0;
+				}
+				if (*scan)
+				{
+					addresses.push_back(scan);
+				}
+				scan = next;
+			}
+			uint32_t queryCount = uint32_t(addresses.size());
+			logMessage("Querying %s addresses.\n", formatNumber(queryCount));
+
+			ThreadPool *pool = ThreadPool::create(mThreadCount);
+			uint32_t tasks = (queryCount + ADDRESS_QUERY_ROWS_PER_TASK - 1) / ADDRESS_QUERY_ROWS_PER_TASK;
+
+			// Decode every address and find its record
+			std::vector< AddressQuery > queries(queryCount);
+			pool->parallelFor(tasks, [&](uint32_t task)
+			{
+				uint32_t last = std::min(queryCount, (task + 1) * ADDRESS_QUERY_ROWS_PER_TASK);
+				for (uint32_t i = task * ADDRESS_QUERY_ROWS_PER_TASK; i < last; i++)
+				{
+					AddressQuery &q = queries[i];
+					q.mIndex = lookupPublicKey(addresses[i]);
+					q.mRow = i;
+					q.mRecordOffset = q.mIndex == 0xFFFFFFFF ? ~uint64_t(0) : mPublicKeyRecordOffsets[q.mIndex];
+				}
+			});
+			std::vector< AddressQuery > scratch;
+			SORT::radixSort(queries, scratch, [](const AddressQuery &q) { return q.mRecordOffset; });
+
+			// Each task walks its run of the sorted queries in record order
+			std::vector< KeySummary > summaries(queryCount);
+			pool->parallelFor(tasks, [&](uint32_t task)
+			{
+				uint32_t first = task * ADDRESS_QUERY_ROWS_PER_TASK;
+				uint32_t last = std::min(queryCount, first + ADDRESS_QUERY_ROWS_PER_TASK);
+				for (uint32_t i = first; i < last; i++)
+				{
+					if (i + ADDRESS_QUERY_PREFETCH_DISTANCE * 2 < last)
+					{
+						prefetchRecordHeader(queries[i + ADDRESS_QUERY_PREFETCH_DISTANCE * 2]);
+					}
+					if (i + ADDRESS_QUERY_PREFETCH_DISTANCE < last)
+					{
+						prefetchRecordTransaction(queries[i + ADDRESS_QUERY_PREFETCH_DISTANCE], timeStamp);
+					}
+					const AddressQuery &q = queries[i];
+					KeySummary &summary = summaries[q.mRow];
+					if (!getKeySummary(q.mIndex, timeStamp, summary))
+					{
+						memset(&summary, 0, sizeof(summary));
+						summary.mIndex = 0xFFFFFFFF;
+					}
+				}
+			});
+			pool->release();
+
+			ReportWriter *report = ReportWriter::create(reportFileName, mReportFormat);
+			if (report)
+			{
+				report->addColumn("PublicKey", ReportWriter::CT_TEXT);
+				report->addColumn("Found", ReportWriter::CT_TEXT);
+				report->addColumn("Balance", ReportWriter::CT_BTC, 8);
+				report->addColumn("Transactions", ReportWriter::CT_COUNT);
+				report->addColumn("FirstTime", ReportWriter::CT_COUNT);
+				report->addColumn("LastSendTime", ReportWriter::CT_COUNT);
+				report->addColumn("LastReceiveTime", ReportWriter::CT_COUNT);
+				report->addColumn("TotalSent", ReportWriter::CT_BTC, 8);
+				report->addColumn("TotalReceived", ReportWriter::CT_BTC, 8);
+				for (uint32_t i = 0; i < queryCount; i++)
+				{
+					const KeySummary &k = summaries[i];
+					report->writeText(addresses[i]);
+					report->writeText(k.mIndex == 0xFFFFFFFF ? "false" : "true");
+					report->writeSatoshis(k.mBalance);
+					report->writeCount(k.mTransactionCount);
+					report->writeCount(k.mFirstTime);
+					report->writeCount(k.mLastSendTime);
+					report->writeCount(k.mLastReceiveTime);
+					report->writeSatoshis(k.mTotalSend);
+					report->writeSatoshis(k.mTotalReceive);
+					report->endRow();
+				}
+				report->release();
+			}
+		}
+
+		// Summarizes every public key which had any transactions by 'timeStamp', in key index order.  The keys are
+		// summarized in parallel a batch at a time, so only one batch of summaries is held at once.
+		virtual void reportAddressSummaries(const char *reportFileName, uint32_t timeStamp) override final
+		{
+			if (mPublicKeyRecordOffsets == nullptr)
+			{
+				logMessage("The public key records must be loaded to summarize addresses.\n");
+				return;
+			}
+			ReportWriter *report = ReportWriter::create(reportFileName, mReportFormat);
+			if (report == nullptr)
+			{
+				return;
+			}
+			logMessage("Summarizing %s public keys.\n", formatNumber(mPublicKeyCount));
+			report->addColumn("KeyIndex", ReportWriter::CT_COUNT);
+			report->addColumn("Balance", ReportWriter::CT_BTC, 8);
+			report->addColumn("FirstTime", ReportWriter::CT_COUNT);
+			report->addColumn("LastSendTime", ReportWriter::CT_COUNT);
+			report->addColumn("LastReceiveTime", ReportWriter::CT_COUNT);
+			report->addColumn("Transactions", ReportWriter::CT_COUNT);
+			ThreadPool *pool = ThreadPool::create(mThreadCount);
+			std::vector< KeySummary > summaries(std::min(mPublicKeyCount, uint32_t(ADDRESS_SUMMARY_BATCH)));
+			for (uint32_t base = 0; base < mPublicKeyCount; base += ADDRESS_SUMMARY_BATCH)
+			{
+				uint32_t count = std::min(mPublicKeyCount - base, uint32_t(ADDRESS_SUMMARY_BATCH));
+				uint32_t tasks = (count + ADDRESS_QUERY_ROWS_PER_TASK - 1) / ADDRESS_QUERY_ROWS_PER_TASK;
+				pool->parallelFor(tasks, [&](uint32_t task)
+				{
+					uint32_t last = std::min(count, (task + 1) * ADDRESS_QUERY_ROWS_PER_TASK);
+					for (uint32_t i = task * ADDRESS_QUERY_ROWS_PER_TASK; i < last; i++)
+					{
+						getKeySummary(base + i, timeStamp, summaries[i]);
+					}
+				});
+				for (uint32_t i = 0; i < count; i++)
+				{
+					const KeySummary &k = summaries[i];
+					if (k.mTransactionCount)
+					{
+						report->writeCount(k.mIndex);
+						report->writeSatoshis(k.mBalance);
+						report->writeCount(k.mFirstTime);
+						report->writeCount(k.mLastSendTime);
+						report->writeCount(k.mLastReceiveTime);
+						report->writeCount(k.mTransactionCount);
+						report->endRow();
+					}
+				}
+			}
+			pool->release();
+			report->release();
+		}
+
+		// The first stage of prefetching a query's record; pulls in the record header
+		void prefetchRecordHeader(const AddressQuery &q) const
+		{
+			if (q.mIndex != 0xFFFFFFFF)
+			{
+				prefetch(&mPublicKeyRecordBaseAddress[q.mRecordOffset]);
+			}
+		}
+
+		// The second stage, once the header has arrived; pulls in the transaction a summary as of now will read
+		void prefetchRecordTransaction(const AddressQuery &q, uint32_t timeStamp) const
+		{
+			if (q.mIndex != 0xFFFFFFFF && timeStamp == 0xFFFFFFFF)
+			{
+				const PublicKeyRecordFile *r = (const PublicKeyRecordFile *)&mPublicKeyRecordBaseAddress[q.mRecordOffset];
+				if (r->mCount)
+				{
+					prefetch(&r->mTransactions[r->mCount - 1]);
+				}
+			}
+		}
+
 		virtual void printPublicKey(uint32_t index)
 		{
 			assert(index < mPublicKeyCount);
@@ -1872,52 +4921,303 @@ namespace PUBLIC_KEY_DATABASE
 			logMessage("\n");
 		}
 
-		void initByTime(uint32_t timeStamp)
+		void initByTime(uint32_t timeStamp)
+		{
+			logMessage("Computing balances up to this date: %s\n", getTimeString(timeStamp));
+			for (uint32_t i = 0; i < mPublicKeyCount; i++)
+			{
+				PublicKeyRecordFile &pkrf = getPublicKeyRecordFile(i);
+				pkrf.computeBalance(timeStamp);
+				mPublicKeyRecordSorted[i] = &pkrf;
+			}
+		}
+
+		// Walks the transactions in chronological order keeping a running balance for every public key, and saves
+		// a snapshot of all of the non-zero balances each time an interval boundary is crossed.  addBlock stamps the
+		// transactions so their times never go backwards through the file, so each snapshot holds exactly the
+		// transactions before its boundary.
+		virtual void buildBalanceSnapshots(SnapshotInterval interval) override final
+		{
+			if (!seekFirstTransaction())
+			{
+				logMessage("No transactions file to build the balance snapshots from.\n");
+				return;
+			}
+			BalanceSnapshotsWriter writer;
+			if (!writer.open(interval, mPublicKeyCount))
+			{
+				return;
+			}
+			logMessage("Building balance snapshots for %s public keys.\n", formatNumber(mPublicKeyCount));
+			std::vector< uint64_t > balances(mPublicKeyCount);
+			PublicKeyBalances sink(balances);
+			uint32_t snapshotCount = 0;
+			uint32_t nextTime = 0;
+			uint32_t transactionCount = 0;
+			uint64_t transactionOffset = mFirstTransactionOffset;
+			Transaction t;
+			while (readTransaction(t, transactionOffset))
+			{
+				if (nextTime == 0)
+				{
+					nextTime = getNextSnapshotTime(t.mTransactionTime, interval);
+				}
+				while (t.mTransactionTime >= nextTime)
+				{
+					writer.writeSnapshot(nextTime, transactionCount, transactionOffset, balances);
+					snapshotCount++;
+					nextTime = getNextSnapshotTime(nextTime, interval);
+				}
+				transactionCount++;
+				if ((transactionCount % 100000) == 0)
+				{
+					logMessage("Processing transaction %s\n", formatNumber(transactionCount));
+				}
+				uint64_t toffset = transactionOffset;
+				transactionOffset = uint64_t(fi_ftell(mTransactionFile));
+				processTransaction(t, toffset, sink);
+			}
+			writer.close(transactionCount);
+			logMessage("Saved %s balance snapshots to '%s'\n", formatNumber(snapshotCount), BALANCE_SNAPSHOTS_FILE_NAME);
+		}
+
+		// Fills 'balances' with the balance of every public key as of 'timeStamp' by loading the latest snapshot taken
+		// at or before then and rolling it forward through the transactions which follow it.  Returns false if there
+		// is no usable snapshot.
+		bool getSnapshotBalances(uint32_t timeStamp, std::vector< uint64_t > &balances)
+		{
+			FILE_INTERFACE *fph = fi_fopen(BALANCE_SNAPSHOTS_FILE_NAME, "rb", nullptr, 0, true);
+			if (fph == nullptr)
+			{
+				return false;
+			}
+			bool ret = false;
+			fi_fseek(fph, 0, SEEK_END);
+			uint64_t length = uint64_t(fi_ftell(fph));
+			uint64_t bufferLength;
+			const uint8_t *base = (const uint8_t *)fi_getMemBuffer(fph, &bufferLength);
+			const BalanceSnapshotsHeader *header = (const BalanceSnapshotsHeader *)base;
+			if (base && length >= sizeof(BalanceSnapshotsHeader) && header->isValid() && header->mPublicKeyCount <= mPublicKeyCount)
+			{
+				// The directory is in time order; find the last snapshot at or before the requested time
+				const BalanceSnapshot *directory = (const BalanceSnapshot *)(base + header->mDirectoryOffset);
+				uint32_t low = 0;
+				uint32_t high = header->mSnapshotCount;
+				while (low < high)
+				{
+					uint32_t middle = low + (high - low) / 2;
+					if (directory[middle].mTimeStamp > timeStamp)
+					{
+						high = middle;
+					}
+					else
+					{
+						low = middle + 1;
+					}
+				}
+				if (low)
+				{
+					const BalanceSnapshot &snapshot = directory[low - 1];
+					const uint32_t *indices = (const uint32_t *)(base + snapshot.mIndexOffset);
+					const uint64_t *values = (const uint64_t *)(base + snapshot.mBalanceOffset);
+					balances.assign(mPublicKeyCount, 0);
+					for (uint32_t i = 0; i < snapshot.mKeyCount; i++)
+					{
+						balances[indices[i]] = values[i];
+					}
+
+					// Transaction times never go backwards through the file, so the first one past 'timeStamp' ends the roll forward
+					PublicKeyBalances sink(balances);
+					uint32_t transactionCount = 0;
+					uint64_t transactionOffset = snapshot.mTransactionFileOffset;
+					Transaction t;
+					while (readTransaction(t, transactionOffset) && t.mTransactionTime <= timeStamp)
+					{
+						transactionCount++;
+						uint64_t toffset = transactionOffset;
+						transactionOffset = uint64_t(fi_ftell(mTransactionFile));
+						processTransaction(t, toffset, sink);
+					}
+					logMessage("Using the balance snapshot from %s plus %s later transactions.\n", getTimeString(snapshot.mTimeStamp), formatNumber(transactionCount));
+					ret = true;
+				}
+			}
+			else
+			{
+				logMessage("The balance snapshots file '%s' is incomplete or out of date; rebuild it with '-snapshots'\n", BALANCE_SNAPSHOTS_FILE_NAME);
+			}
+			fi_fclose(fph);
+			return ret;
+		}
+
+		// Returns the 'maxReport' largest non-zero balances, largest first, where 'getBalance' gives the balance of
+		// each public key.  Each thread keeps a bounded min-heap of the best entries in its own range of keys and the
+		// per-thread winners are merged at the end; O(n log k) over packed entries instead of sorting every key.
+		// With 'parallel' false everything runs on the calling thread.
+		void selectTopBalances(uint32_t maxReport, const std::function<uint64_t(uint32_t)> &getBalance, BalanceEntryVector &top, bool parallel = true) const
+		{
+			top.clear();
+			if (maxReport == 0)
+			{
+				return;
+			}
+			uint32_t partitions = parallel ? (mThreadCount ? mThreadCount : ThreadPool::getHardwareThreadCount()) : 1;
+			if (partitions > mPublicKeyCount / TOP_BALANCES_KEYS_PER_THREAD)
+			{
+				partitions = mPublicKeyCount / TOP_BALANCES_KEYS_PER_THREAD;
+			}
+			if (partitions == 0)
+			{
+				partitions = 1;
+			}
+			std::vector< BalanceEntryVector > winners(partitions);
+			auto selectPartition = [&](uint32_t p)
+			{
+				uint32_t firstIndex = uint32_t(uint64_t(mPublicKeyCount) * p / partitions);
+				uint32_t lastIndex = uint32_t(uint64_t(mPublicKeyCount) * (p + 1) / partitions);
+				// The heap is ordered so that its top is the weakest of the entries kept so far
+				std::priority_queue< BalanceEntry, BalanceEntryVector, HigherBalance > heap;
+				for (uint32_t i = firstIndex; i < lastIndex; i++)
+				{
+					BalanceEntry e(getBalance(i), i);
+					if (e.mBalance == 0)
+					{
+						continue;
+					}
+					if (heap.size() < maxReport)
+					{
+						heap.push(e);
+					}
+					else if (HigherBalance()(e, heap.top()))
+					{
+						heap.pop();
+						heap.push(e);
+					}
+				}
+				BalanceEntryVector &w = winners[p];
+				w.reserve(heap.size());
+				while (!heap.empty())
+				{
+					w.push_back(heap.top());
+					heap.pop();
+				}
+			};
+			if (partitions == 1)
+			{
+				selectPartition(0);
+			}
+			else
+			{
+				ThreadPool *pool = ThreadPool::create(partitions);
+				pool->parallelFor(partitions, selectPartition);
+				pool->release();
+			}
+
+			for (auto i = winners.begin(); i != winners.end(); ++i)
+			{
+				top.insert(top.end(), (*i).begin(), (*i).end());
+			}
+			SORT::introSort(top.data(), top.size(), HigherBalance());
+			if (top.size() > maxReport)
+			{
+				top.resize(maxReport);
+			}
+		}
+
+		// Writes the selected top balances to the report.  Only these keys have their records looked at, to find their age.
+		void writeTopBalancesReport(const char *reportFileName, const BalanceEntryVector &top, uint32_t timeStamp)
+		{
+			ReportWriter *report = ReportWriter::create(reportFileName, mReportFormat);
+			if (report)
+			{
+				report->addColumn("PublicKey", ReportWriter::CT_TEXT);
+				report->addColumn("Balance", ReportWriter::CT_BTC, 2);
+				report->addColumn("Age", ReportWriter::CT_COUNT);
+				for (auto i = top.begin(); i != top.end(); ++i)
+				{
+					PublicKeyRecordFile &pkrf = getPublicKeyRecordFile((*i).mIndex);
+					pkrf.computeBalance(timeStamp);
+					PublicKeyData &a = mAddresses[pkrf.mIndex];
+					report->writeText(getBitcoinAddressAscii(a.address));
+					report->writeSatoshis((*i).mBalance);
+					report->writeCount(pkrf.mDaysOld);
+					report->endRow();
+				}
+				report->release();
+			}
+		}
+
+		// Generates the top balance report; writtent to 'TopBalances.txt'
+		virtual void reportTopBalances(const char *reportFileName,uint32_t maxReport,uint32_t timeStamp)
 		{
-			logMessage("Computing balances up to this date: %s\n", getTimeString(timeStamp));
-			for (uint32_t i = 0; i < mPublicKeyCount; i++)
+			BalanceEntryVector top;
+			// Historical reports start from the nearest balance snapshot, if they have been built
+			std::vector< uint64_t > balances;
+			if (timeStamp != 0xFFFFFFFF && getSnapshotBalances(timeStamp, balances))
 			{
-				PublicKeyRecordFile &pkrf = getPublicKeyRecordFile(i);
-				pkrf.computeBalance(timeStamp);
-				mPublicKeyRecordSorted[i] = &pkrf;
+				logMessage("Selecting the top %s balances.\n", formatNumber(maxReport));
+				selectTopBalances(maxReport, [&balances](uint32_t index)
+				{
+					return balances[index];
+				}, top);
+			}
+			else
+			{
+				logMessage("Computing balances up to this date: %s\n", getTimeString(timeStamp));
+				logMessage("Selecting the top %s balances.\n", formatNumber(maxReport));
+				selectTopBalances(maxReport, [this, timeStamp](uint32_t index)
+				{
+					return getPublicKeyRecordFile(index).getBalance(timeStamp);
+				}, top);
 			}
+			writeTopBalancesReport(reportFileName, top, timeStamp);
 		}
 
-		// Generates the top balance report; writtent to 'TopBalances.txt'
-		virtual void reportTopBalances(const char *reportFileName,uint32_t maxReport,uint32_t timeStamp)
+
+		// Sorts every public key record in the requested order and lists the first 'maxReport' of them
+		virtual void reportSortedKeys(const char *reportFileName, uint32_t maxReport, KeyOrder order, uint32_t timeStamp) override final
 		{
 			initByTime(timeStamp);
-			logMessage("Finished computing balances for %s public keys.\n", formatNumber(mPublicKeyCount));
-			logMessage("Sorting by balance.\n");
-			SortByBalance sbb;
-			sbb.heapSort((void **)(mPublicKeyRecordSorted), mPublicKeyCount);
-			FILE *fph = fopen(reportFileName, "wb+");
-			if (fph)
+			logMessage("Sorting %s public key records.\n", formatNumber(mPublicKeyCount));
+			ThreadPool *pool = ThreadPool::create(mThreadCount);
+			switch (order)
+			{
+				case KO_BALANCE:
+					SORT::parallelMergeSort(mPublicKeyRecordSorted, mPublicKeyCount, SortByBalance(), pool);
+					break;
+				case KO_AGE:
+					SORT::parallelMergeSort(mPublicKeyRecordSorted, mPublicKeyCount, SortByAge(), pool);
+					break;
+				case KO_TRANSACTION_COUNT:
+					SORT::parallelMergeSort(mPublicKeyRecordSorted, mPublicKeyCount, SortByTransactionCount(), pool);
+					break;
+			}
+			pool->release();
+			ReportWriter *report = ReportWriter::create(reportFileName, mReportFormat);
+			if (report)
 			{
-				fprintf(fph, "PublicKey,Balance,Age\n");
+				report->addColumn("PublicKey", ReportWriter::CT_TEXT);
+				report->addColumn("Balance", ReportWriter::CT_BTC, 2);
+				report->addColumn("Age", ReportWriter::CT_COUNT);
+				report->addColumn("Transactions", ReportWriter::CT_COUNT);
 				if (maxReport > mPublicKeyCount)
 				{
 					maxReport = mPublicKeyCount;
 				}
-
-				time_t curTime;
-				time(&curTime);
-
 				for (uint32_t i = 0; i < maxReport; i++)
 				{
 					PublicKeyRecordFile &pkrf = *mPublicKeyRecordSorted[i];
 					PublicKeyData &a = mAddresses[pkrf.mIndex];
-					fprintf(fph, "%s,%0.2f,%d\n", getBitcoinAddressAscii(a.address), (float)pkrf.mBalance / ONE_BTC, pkrf.mDaysOld);
+					report->writeText(getBitcoinAddressAscii(a.address));
+					report->writeSatoshis(pkrf.mBalance);
+					report->writeCount(pkrf.mDaysOld);
+					report->writeCount(pkrf.mCount);
+					report->endRow();
 				}
-				fclose(fph);
-			}
-			else
-			{
-				logMessage("Failed to open report file '%s' for write access\n");
+				report->release();
 			}
 		}
 
-
 		time_t getMonthDayYear(uint32_t month, uint32_t day, uint32_t year)
 		{
 			time_t rawtime;
@@ -1929,467 +5229,578 @@ namespace PUBLIC_KEY_DATABASE
 			return _mkgmtime(timeinfo);
 		}
 
-		// Will generate a spreadsheet of bitcoin balances sorted by age of last access
-		virtual void reportByAge(const char *reportName)
-		{
-
-		}
-
-
-
-		// compute the transaction statistics on a daily basis for the entire history of the blockchain
-		virtual void reportDailyTransactions(const char *reportFileName)
+		// Adds up the balance of every cluster of public keys as of 'timeStamp' and lists the 'maxReport' clusters
+		// holding the most.  Each thread adds the balances of one slice of the keys into the totals of their clusters,
+		// which are indexed by cluster id, so the rich list can be picked out just like the one for single keys.
+		virtual void reportClusterBalances(const char *reportFileName, uint32_t maxReport, uint32_t timeStamp) override final
 		{
-			delete[]mDailyStatistics;
-			mDailyStatistics = new DailyStatistics[MAXIMUM_DAYS];
-			mZombieInputs.clear();
-			time_t curTime;
-			time(&curTime);		// get the current 'real' time; if we go past it, we stop..
-			mLastDay = 0;
-			seekFirstTransaction();
-			uint32_t transactionCount = 0;
-			uint64_t transactionOffset = uint64_t(fi_ftell(mTransactionFile));
-			Transaction t;
-			while (readTransaction(t, transactionOffset))
+			if (mPublicKeyRecordOffsets == nullptr)
 			{
-				transactionCount++;
-				if ((transactionCount % 10000) == 0)
+				logMessage("The public key records must be loaded to report cluster balances.\n");
+				return;
+			}
+			if (!loadPublicKeyClusters())
+			{
+				return;
+			}
+			logMessage("Computing the balances of the public key clusters up to this date: %s\n", getTimeString(timeStamp));
+			uint32_t partitions = mThreadCount ? mThreadCount : ThreadPool::getHardwareThreadCount();
+			ThreadPool *pool = ThreadPool::create(partitions);
+			std::atomic< uint64_t > *balances = new std::atomic< uint64_t >[mPublicKeyCount];
+			std::atomic< uint32_t > *keyCounts = new std::atomic< uint32_t >[mPublicKeyCount];
+			pool->parallelFor(partitions, [&](uint32_t p)
+			{
+				uint32_t lastIndex = uint32_t(uint64_t(mPublicKeyCount) * (p + 1) / partitions);
+				for (uint32_t i = uint32_t(uint64_t(mPublicKeyCount) * p / partitions); i < lastIndex; i++)
 				{
-					logMessage("Processing transaction %s\n", formatNumber(transactionCount));
+					balances[i].store(0, std::memory_order_relaxed);
+					keyCounts[i].store(0, std::memory_order_relaxed);
 				}
-				uint64_t toffset = transactionOffset; // the base transaction offset
-				transactionOffset = uint64_t(fi_ftell(mTransactionFile));
-				computeTransactionStatistics(t,toffset);
-			}
-
-
+			});
+			pool->parallelFor(partitions, [&](uint32_t p)
 			{
-				logMessage("Generating Value Distribution report.\r\n");
-				FILE_INTERFACE *fph = fi_fopen("ValueDistribution.csv", "wb", nullptr, 0, false);
-				if (fph)
+				uint32_t lastIndex = uint32_t(uint64_t(mPublicKeyCount) * (p + 1) / partitions);
+				for (uint32_t i = uint32_t(uint64_t(mPublicKeyCount) * p / partitions); i < lastIndex; i++)
 				{
-					fi_fprintf(fph, "Date,");
-					ValueEntryTable vt;
-					vt.outputHeader(fph);
-					fi_fprintf(fph,"\r\n");
-					for (uint32_t i = 0; i < MAXIMUM_DAYS; i++)
+					uint32_t cluster = mPublicKeyClusters[i];
+					uint64_t balance = getPublicKeyRecordFile(i).getBalance(timeStamp);
+					if (balance)
 					{
-						if (noMoreDays(i))
-						{
-							break;
-						}
-
-						DailyStatistics &d = mDailyStatistics[i];
-
-						if (d.mTimeStamp)
-						{
-							fi_fprintf(fph, "%s,", getDateString(d.mTimeStamp));	// Date
-							d.mValueEntryTable.outputValue(fph);
-							fi_fprintf(fph, "\r\n");
-						}
+						balances[cluster].fetch_add(balance, std::memory_order_relaxed);
 					}
-					fi_fclose(fph);
+					keyCounts[cluster].fetch_add(1, std::memory_order_relaxed);
+				}
+			});
+			pool->release();
+			logMessage("Selecting the top %s cluster balances.\n", formatNumber(maxReport));
+			BalanceEntryVector top;
+			selectTopBalances(maxReport, [balances](uint32_t index)
+			{
+				return balances[index].load(std::memory_order_relaxed);
+			}, top);
+			ReportWriter *report = ReportWriter::create(reportFileName, mReportFormat);
+			if (report)
+			{
+				report->addColumn("Cluster", ReportWriter::CT_COUNT);
+				report->addColumn("PublicKey", ReportWriter::CT_TEXT);
+				report->addColumn("Keys", ReportWriter::CT_COUNT);
+				report->addColumn("Balance", ReportWriter::CT_BTC, 8);
+				char address[256];
+				for (auto i = top.begin(); i != top.end(); ++i)
+				{
+					uint32_t cluster = (*i).mIndex;
+					if (!getAddressAscii(cluster, address, sizeof(address)))
+					{
+						snprintf(address, sizeof(address), "%u", cluster);
+					}
+					report->writeCount(cluster);
+					report->writeText(address);
+					report->writeCount(keyCounts[cluster].load(std::memory_order_relaxed));
+					report->writeSatoshis((*i).mBalance);
+					report->endRow();
 				}
+				report->release();
 			}
+			delete[]balances;
+			delete[]keyCounts;
+		}
 
-			FILE_INTERFACE *fph = fi_fopen(reportFileName, "wb", nullptr, 0, false);
-			if (fph)
+		// The balance of a public key as of 'timeStamp' and the day of its last send or receive before then.  Returns
+		// false if the key held nothing at that time.
+		bool getDormancy(uint32_t index, uint32_t timeStamp, uint64_t &balance, uint32_t &lastActivity) const
+		{
+			const PublicKeyTransaction *t = getPublicKeyRecordFile(index).getTransactionAtTime(timeStamp);
+			if (t == nullptr || t->mBalance == 0)
 			{
-				logMessage("Generating daily transactions report to file '%s'\n", reportFileName);
-				fi_fprintf(fph,"Date");
-
-				fi_fprintf(fph, ",BlockCount");
-				fi_fprintf(fph, ",DustCount");
-				fi_fprintf(fph, ",TotalTransactionCount");
-				fi_fprintf(fph, ",AverageTransactionCount");
-				fi_fprintf(fph, ",MaxTransactionCount");
-
-				fi_fprintf(fph, ",TotalTransactionSize");
-				fi_fprintf(fph, ",AverageTransactionSize");
-
-				fi_fprintf(fph, ",TotalInputCount");
-				fi_fprintf(fph, ",AverageInputCount");
-				fi_fprintf(fph, ",MaxInputCount");
-				fi_fprintf(fph, ",TotalInputValue");
-				fi_fprintf(fph, ",AverageInputValue");
-				fi_fprintf(fph, ",MaxInputValue");
-				fi_fprintf(fph, ",TotalInputScriptLength");
-				fi_fprintf(fph, ",AverageInputScriptLength");
-
-				fi_fprintf(fph, ",TotalOutputCount");
-				fi_fprintf(fph, ",AverageOutputCount");
-				fi_fprintf(fph, ",MaxOutputCount");
-				fi_fprintf(fph, ",TotalOutputValue");
-				fi_fprintf(fph, ",AverageOutputValue");
-				fi_fprintf(fph, ",MaxOutputValue");
-				fi_fprintf(fph, ",TotalOutputScriptLength");
-				fi_fprintf(fph, ",AverageOutputScriptLength");
-
-
-				fi_fprintf(fph, ",MaxInputDaysOld");
-
-				fi_fprintf(fph, ",ZombieInputCount");
-				fi_fprintf(fph, ",ZombieInputValue");
-				fi_fprintf(fph, ",ZombieScore");
-
-				fi_fprintf(fph, ",UTXOCount");
-				fi_fprintf(fph, ",UTXOValue");
-
-				fi_fprintf(fph, ",EarlyCount");
-				fi_fprintf(fph, ",EarlyValue");
-
+				return false;
+			}
+			balance = t->mBalance;
+			lastActivity = t->mLastSendTime > t->mLastReceiveTime ? t->mLastSendTime : t->mLastReceiveTime;
+			return true;
+		}
 
+		// Buckets every public key holding a balance as of 'timeStamp' by how long it has been since the key last sent
+		// or received, as of 'timeStamp' or, for the current balances, the most recent activity of any key.  Each thread
+		// counts the keys and balances of one slice of the keys by the day of their last activity, which are folded into
+		// the age ranges afterwards.
+		//
+		// If 'keysReportFileName' is given every funded key is also listed, the longest dormant first.  The per day
+		// counts of each slice say exactly where its keys go in that order, so the keys are scattered straight into place
+		// by a second parallel pass instead of being sorted.
+		virtual void reportByAge(const char *reportFileName, const char *keysReportFileName, uint32_t timeStamp) override final
+		{
+			if (mPublicKeyRecordOffsets == nullptr)
+			{
+				logMessage("The public key records must be loaded to report balances by age.\n");
+				return;
+			}
+			uint32_t partitions = mThreadCount ? mThreadCount : ThreadPool::getHardwareThreadCount();
+			if (partitions > mPublicKeyCount / TOP_BALANCES_KEYS_PER_THREAD)
+			{
+				partitions = mPublicKeyCount / TOP_BALANCES_KEYS_PER_THREAD;
+			}
+			if (partitions == 0)
+			{
+				partitions = 1;
+			}
+			logMessage("Computing the dormancy of %s public keys.\n", formatNumber(mPublicKeyCount));
+			// Key counts and balances of each slice, indexed by the day of last activity
+			std::vector< std::vector< uint64_t > > dayCounts(partitions);
+			std::vector< std::vector< uint64_t > > dayBalances(partitions);
+			std::vector< uint32_t > lastActivity(partitions, 0);
+			ThreadPool *pool = ThreadPool::create(partitions);
+			pool->parallelFor(partitions, [&](uint32_t p)
+			{
+				uint32_t firstIndex = uint32_t(uint64_t(mPublicKeyCount) * p / partitions);
+				uint32_t lastIndex = uint32_t(uint64_t(mPublicKeyCount) * (p + 1) / partitions);
+				std::vector< uint64_t > &counts = dayCounts[p];
+				std::vector< uint64_t > &balances = dayBalances[p];
+				for (uint32_t i = firstIndex; i < lastIndex; i++)
 				{
-					DailyStatistics &d = mDailyStatistics[0];
-					for (uint32_t i = 0; i < AR_LAST; i++)
+					uint64_t balance;
+					uint32_t activity;
+					if (!getDormancy(i, timeStamp, balance, activity))
+					{
+						continue;
+					}
+					uint32_t day = activity / SECONDS_PER_DAY;
+					if (day >= counts.size())
 					{
-						fi_fprintf(fph, ",\"%s Count\"", d.mAgeStats[i].mLabel);
+						counts.resize(day + 1, 0);
+						balances.resize(day + 1, 0);
 					}
-					for (uint32_t i = 0; i < AR_LAST; i++)
+					counts[day]++;
+					balances[day] += balance;
+					if (activity > lastActivity[p])
 					{
-						fi_fprintf(fph, ",\"%s Value\"", d.mAgeStats[i].mLabel);
+						lastActivity[p] = activity;
 					}
 				}
-
-				fi_fprintf(fph, "\n");
-
-
-				for (uint32_t i = 0; i < MAXIMUM_DAYS; i++)
+			});
+			uint32_t dayCount = 0;
+			uint32_t referenceTime = 0;
+			for (uint32_t p = 0; p < partitions; p++)
+			{
+				dayCount = std::max(dayCount, uint32_t(dayCounts[p].size()));
+				referenceTime = std::max(referenceTime, lastActivity[p]);
+			}
+			if (timeStamp != 0xFFFFFFFF)
+			{
+				referenceTime = timeStamp;
+			}
+			uint32_t referenceDay = referenceTime / SECONDS_PER_DAY;
+			std::vector< uint64_t > counts(dayCount, 0);
+			std::vector< uint64_t > balances(dayCount, 0);
+			for (uint32_t p = 0; p < partitions; p++)
+			{
+				for (uint32_t day = 0; day < uint32_t(dayCounts[p].size()); day++)
+				{
+					counts[day] += dayCounts[p][day];
+					balances[day] += dayBalances[p][day];
+				}
+			}
+			uint64_t rankCounts[AR_LAST] = { 0 };
+			uint64_t rankBalances[AR_LAST] = { 0 };
+			uint64_t totalCount = 0;
+			uint64_t totalBalance = 0;
+			// Walk from the most recent day to the oldest, so the age only ever moves up through the ranges
+			uint32_t rank = 0;
+			for (uint32_t day = dayCount; day-- > 0;)
+			{
+				uint32_t age = referenceDay > day ? referenceDay - day : 0;
+				while (rank < AR_LAST - 1 && age > getAgeRankDays(AgeRank(rank)))
+				{
+					rank++;
+				}
+				rankCounts[rank] += counts[day];
+				rankBalances[rank] += balances[day];
+				totalCount += counts[day];
+				totalBalance += balances[day];
+			}
+			logMessage("%s public keys hold a balance as of %s.\n", formatNumber(totalCount), getTimeString(referenceTime));
+			ReportWriter *report = ReportWriter::create(reportFileName, mReportFormat);
+			if (report)
+			{
+				report->addColumn("LastActivity", ReportWriter::CT_TEXT);
+				report->addColumn("Keys", ReportWriter::CT_COUNT);
+				report->addColumn("Balance", ReportWriter::CT_BTC, 8);
+				report->addColumn("KeysPercent", ReportWriter::CT_REAL, 2);
+				report->addColumn("BalancePercent", ReportWriter::CT_REAL, 2);
+				for (uint32_t r = 0; r < AR_LAST; r++)
+				{
+					report->writeText(getAgeRankLabel(AgeRank(r)));
+					report->writeCount(rankCounts[r]);
+					report->writeSatoshis(rankBalances[r]);
+					report->writeReal(totalCount ? double(rankCounts[r]) * 100 / double(totalCount) : 0);
+					report->writeReal(totalBalance ? double(rankBalances[r]) * 100 / double(totalBalance) : 0);
+					report->endRow();
+				}
+				report->release();
+			}
+			if (keysReportFileName && totalCount)
+			{
+				// Where each slice's first key of each day goes; the oldest day first, and within a day the slices in
+				// key index order
+				std::vector< std::vector< uint64_t > > &positions = dayCounts;
+				uint64_t position = 0;
+				for (uint32_t day = 0; day < dayCount; day++)
 				{
-					if (noMoreDays(i))
+					for (uint32_t p = 0; p < partitions; p++)
 					{
-						break;
+						if (day < positions[p].size())
+						{
+							uint64_t count = positions[p][day];
+							positions[p][day] = position;
+							position += count;
+						}
 					}
-					DailyStatistics &d = mDailyStatistics[i];
-
-					if (d.mTimeStamp)
+				}
+				std::vector< uint32_t > keys(static_cast<size_t>(totalCount));
+				pool->parallelFor(partitions, [&](uint32_t p)
+				{
+					uint32_t firstIndex = uint32_t(uint64_t(mPublicKeyCount) * p / partitions);
+					uint32_t lastIndex = uint32_t(uint64_t(mPublicKeyCount) * (p + 1) / partitions);
+					std::vector< uint64_t > &next = positions[p];
+					for (uint32_t i = firstIndex; i < lastIndex; i++)
 					{
-						fi_fprintf(fph, "%s",	getDateString(d.mTimeStamp));	// Date
-						fi_fprintf(fph, ",%d",	d.mBlockCount);										// Blocks on this day
-						fi_fprintf(fph, ",%d", d.mDustCount);
-						fi_fprintf(fph, ",%d",	d.mTransactionCount);								// Number of transactions on this day
-						fi_fprintf(fph, ",%f",	(double)d.mTransactionCount / (double)d.mBlockCount);				// Average number of transactions per block
-						fi_fprintf(fph, ",%d",  d.mMaxTransactionBlockCount);						// Most transactions in a block
-						fi_fprintf(fph, ",%d",	d.mTransactionSize);								// Total size of all transactions on this day
-						fi_fprintf(fph, ",%f",  (double)d.mTransactionSize / (double)d.mTransactionCount);			// Average size of a transaction on this day
-
-						fi_fprintf(fph, ",%d", d.mInputCount);										// Total number of inputs on this day.
-						fi_fprintf(fph, ",%f", (double)d.mInputCount / (double)d.mTransactionCount);	// Average number of inputs per transaction
-						fi_fprintf(fph, ",%d", d.mMaxInputCount);									// Maximum number of inputs on a transaction this day
-						fi_fprintf(fph, ",%f", d.mTotalInputValue);									// Total input value
-						fi_fprintf(fph, ",%f", d.mTotalInputValue / (double)d.mTransactionCount);	// Average input value per transaction
-						fi_fprintf(fph, ",%f", (double)d.mMaxInputValue / ONE_BTC);					// Maximum input value on this day
-						fi_fprintf(fph, ",%d", d.mTotalInputScriptLength);
-						fi_fprintf(fph, ",%f", (double)d.mTotalInputScriptLength / (double)d.mInputCount);
-
-						fi_fprintf(fph, ",%d", d.mOutputCount);										// Total number of outputs on this day.
-						fi_fprintf(fph, ",%f", (double)d.mOutputCount / (double)d.mTransactionCount);	// Average number of outputs per transaction
-						fi_fprintf(fph, ",%d", d.mMaxOutputCount);									// Maximum number of outputs on a transaction this day
-						fi_fprintf(fph, ",%f", d.mTotalOutputValue);									// Total output value
-						fi_fprintf(fph, ",%f", d.mTotalOutputValue / (double)d.mTransactionCount);	// Average output value per transaction
-						fi_fprintf(fph, ",%f", (double)d.mMaxOutputValue / ONE_BTC);					// Maximum output value on this day
-						fi_fprintf(fph, ",%d", d.mTotalOutputScriptLength);
-						fi_fprintf(fph, ",%f", (double)d.mTotalOutputScriptLength / (double)d.mOutputCount);
-
-
-						fi_fprintf(fph, ",%d", d.mMaxInputAge); //  oldest input
-
-						fi_fprintf(fph, ",%d", d.mZombieInputCount); // number of inputs which were over 3 years old when spent
-						fi_fprintf(fph, ",%f", d.mZombieInputValue); // total value of inputs which were over 3 years old when spent
-						fi_fprintf(fph, ",%f", d.mZombieScore); // total value of inputs which were over 3 years old when spent
-
-						fi_fprintf(fph, ",%d", d.mUTXOCount); // number of inputs which were over 3 years old when spent
-						fi_fprintf(fph, ",%f", d.mUTXOValue); // total value of inputs which were over 3 years old when spent
-
-						fi_fprintf(fph, ",%d", d.mEarlyCount); // number of inputs which were over 3 years old when spent
-						fi_fprintf(fph, ",%f", d.mEarlyValue); // total value of inputs which were over 3 years old when spent
-
-
-						for (uint32_t i = 0; i < AR_LAST; i++)
+						uint64_t balance;
+						uint32_t activity;
+						if (getDormancy(i, timeStamp, balance, activity))
 						{
-							AgeStat &a = d.mAgeStats[i];
-							fi_fprintf(fph, ",%d", a.mCount);
+							keys[size_t(next[activity / SECONDS_PER_DAY]++)] = i;
 						}
-
-						for (uint32_t i = 0; i < AR_LAST; i++)
+					}
+				});
+				report = ReportWriter::create(keysReportFileName, mReportFormat);
+				if (report)
+				{
+					logMessage("Listing %s public keys by age of last activity.\n", formatNumber(totalCount));
+					report->addColumn("PublicKey", ReportWriter::CT_TEXT);
+					report->addColumn("Balance", ReportWriter::CT_BTC, 8);
+					report->addColumn("LastActivity", ReportWriter::CT_DATE);
+					report->addColumn("DaysDormant", ReportWriter::CT_COUNT);
+					char address[256];
+					for (auto i = keys.begin(); i != keys.end(); ++i)
+					{
+						uint64_t balance;
+						uint32_t activity;
+						getDormancy(*i, timeStamp, balance, activity);
+						if (!getAddressAscii(*i, address, sizeof(address)))
 						{
-							AgeStat &a = d.mAgeStats[i];
-							fi_fprintf(fph, ",%f", a.mValue);
+							snprintf(address, sizeof(address), "%u", *i);
 						}
-
-
-						fi_fprintf(fph, "\n");
-
+						report->writeText(address);
+						report->writeSatoshis(balance);
+						report->writeDate(activity);
+						report->writeCount(getAgeInDays(activity, referenceTime));
+						report->endRow();
 					}
-
+					report->release();
 				}
-				fi_fclose(fph);
 			}
-			else
+			pool->release();
+		}
+
+
+
+		// compute the transaction statistics on a daily basis for the entire history of the blockchain
+		virtual void reportDailyTransactions(const char *reportFileName)
+		{
+			mDailyStatistics.clear();
+			mZombieInputs.clear();
+			fi_fseek(mTransactionFile, 0, SEEK_END);
+			uint64_t transactionFileLength = uint64_t(fi_ftell(mTransactionFile));
+			uint64_t bufferLength;
+			const uint8_t *transactionFileBase = (const uint8_t *)fi_getMemBuffer(mTransactionFile, &bufferLength);
+			if (transactionFileBase == nullptr || mFirstTransactionOffset == 0)
 			{
-				logMessage("Failed to open file '%s' for write access.\n", reportFileName);
+				logMessage("The transactions file '%s' must be memory mapped to compute the daily statistics.\n", TRANSACTION_FILE_NAME);
+				return;
 			}
 
-			if (!mZombieInputs.empty())
+			// Every daily statistic comes from the same scan of the transactions
+			DailyTransactionAnalyzer transactions;
+			ValueDistributionAnalyzer values;
+			ZombieAnalyzer zombies;
+			UTXOAgeAnalyzer utxoAges;
+			DailyHistogramAnalyzer histograms;
+			TransactionAnalyzerDriver driver;
+			driver.addAnalyzer(&transactions);
+			driver.addAnalyzer(&values);
+			driver.addAnalyzer(&zombies);
+			driver.addAnalyzer(&utxoAges);
+			driver.addAnalyzer(&histograms);
+			logMessage("Computing the daily statistics.\n");
+			driver.run(transactionFileBase, mFirstTransactionOffset, transactionFileLength, mThreadCount);
+			mDailyStatistics.merge(transactions.mTable);
+			mDailyStatistics.merge(values.mTable);
+			mDailyStatistics.merge(zombies.mTable);
+			mDailyStatistics.merge(utxoAges.mTable);
+			mZombieInputs.swap(zombies.mZombies);
+
+			const DailyStatisticsTable &d = mDailyStatistics;
+			uint32_t dayCount = d.getDayCount();
 			{
-				logMessage("Encountered %s zombie inputs.\r\n", formatNumber(int32_t(mZombieInputs.size())));
-				logMessage("Generating Zombie report.\r\n");
-				FILE_INTERFACE *fph = fi_fopen("ZombieReport.csv", "wb", nullptr, 0, false);
-				if (fph)
+				logMessage("Generating Value Distribution report.\r\n");
+				ReportWriter *report = ReportWriter::create("ValueDistribution.csv", mReportFormat);
+				if (report)
 				{
-					fi_fprintf(fph, "Date,LastDate,PublicKey,Age,Value,ZombieScore\r\n");
-					for (size_t i = 0; i < mZombieInputs.size(); i++)
+					char label[256];
+					report->addColumn("Date", ReportWriter::CT_DATE);
+					for (uint32_t i = 0; i < VT_LAST_ENTRY; i++)
+					{
+						snprintf(label, sizeof(label), "%s count", getValueTypeLabel(ValueType(i)));
+						report->addColumn(label, ReportWriter::CT_COUNT);
+					}
+					for (uint32_t i = 0; i < VT_LAST_ENTRY; i++)
+					{
+						snprintf(label, sizeof(label), "%s value", getValueTypeLabel(ValueType(i)));
+						report->addColumn(label, ReportWriter::CT_BTC);
+					}
+					for (uint32_t day = 0; day < dayCount; day++)
 					{
-						TransactionInput &input = mZombieInputs[i];
-						Transaction t;
-						bool ok = readTransaction(t, input.mTransactionFileOffset);
-						assert(ok);
-						if (ok)
+						if (d.hasDay(day))
 						{
-							assert(input.mTransactionIndex != 0xFFFFFFFF);
-							if (input.mTransactionIndex != 0xFFFFFFFF)
+							report->writeDate(d.mTimeStamp[day]);
+							for (uint32_t i = 0; i < VT_LAST_ENTRY; i++)
+							{
+								report->writeCount(d.getSum(DS_VALUE_COUNT + i, day));
+							}
+							for (uint32_t i = 0; i < VT_LAST_ENTRY; i++)
 							{
-								assert(input.mTransactionIndex < t.mOutputs.size());
-								if (input.mTransactionIndex < t.mOutputs.size())
-								{
-									TransactionOutput &output = t.mOutputs[input.mTransactionIndex];
-									fi_fprintf(fph, "%s,", getDateString(input.mTimeStamp));
-									fi_fprintf(fph, "%s,", getDateString(t.mTransactionTime));
-									PublicKeyData &a = mAddresses[output.mIndex];
-									fi_fprintf(fph, "%s,", getBitcoinAddressAscii(a.address));
-									uint32_t days = getAgeInDays(t.mTransactionTime, input.mTimeStamp );
-									fi_fprintf(fph, "%d,", days);
-									double value = (double)output.mValue / ONE_BTC;
-									fi_fprintf(fph, "%f,", value);
-									double score = double(days*days)*value;
-									fi_fprintf(fph, "%f,", score);
-									fi_fprintf(fph, "\r\n");
-								}
+								report->writeSatoshis(d.getSum(DS_VALUE_TOTAL + i, day));
 							}
+							report->endRow();
 						}
 					}
-					fi_fclose(fph);
+					report->release();
 				}
 			}
 
-		}
-
-
-		bool noMoreDays(uint32_t index)
-		{
-			// look for no new data for two weeks in which case, this is EOF
-			bool ret = true;
-
-			for (uint32_t i = 0; i < 7; i++)
+			ReportWriter *report = ReportWriter::create(reportFileName, mReportFormat);
+			if (report)
 			{
-				uint32_t day = index + i;
-				if (day < MAXIMUM_DAYS)
+				logMessage("Generating daily transactions report to file '%s'\n", reportFileName);
+				report->addColumn("Date", ReportWriter::CT_DATE);
+
+				report->addColumn("BlockCount", ReportWriter::CT_COUNT);
+				report->addColumn("DustCount", ReportWriter::CT_COUNT);
+				report->addColumn("TotalTransactionCount", ReportWriter::CT_COUNT);
+				report->addColumn("AverageTransactionCount", ReportWriter::CT_REAL);
+				report->addColumn("MaxTransactionCount", ReportWriter::CT_COUNT);
+
+				report->addColumn("TotalTransactionSize", ReportWriter::CT_COUNT);
+				report->addColumn("AverageTransactionSize", ReportWriter::CT_REAL);
+
+				report->addColumn("TotalInputCount", ReportWriter::CT_COUNT);
+				report->addColumn("AverageInputCount", ReportWriter::CT_REAL);
+				report->addColumn("MaxInputCount", ReportWriter::CT_COUNT);
+				report->addColumn("TotalInputValue", ReportWriter::CT_BTC);
+				report->addColumn("AverageInputValue", ReportWriter::CT_REAL);
+				report->addColumn("MaxInputValue", ReportWriter::CT_BTC);
+				report->addColumn("TotalInputScriptLength", ReportWriter::CT_COUNT);
+				report->addColumn("AverageInputScriptLength", ReportWriter::CT_REAL);
+
+				report->addColumn("TotalOutputCount", ReportWriter::CT_COUNT);
+				report->addColumn("AverageOutputCount", ReportWriter::CT_REAL);
+				report->addColumn("MaxOutputCount", ReportWriter::CT_COUNT);
+				report->addColumn("TotalOutputValue", ReportWriter::CT_BTC);
+				report->addColumn("AverageOutputValue", ReportWriter::CT_REAL);
+				report->addColumn("MaxOutputValue", ReportWriter::CT_BTC);
+				report->addColumn("TotalOutputScriptLength", ReportWriter::CT_COUNT);
+				report->addColumn("AverageOutputScriptLength", ReportWriter::CT_REAL);
+
+				report->addColumn("MaxInputDaysOld", ReportWriter::CT_COUNT);
+
+				report->addColumn("ZombieInputCount", ReportWriter::CT_COUNT);
+				report->addColumn("ZombieInputValue", ReportWriter::CT_BTC);
+				report->addColumn("ZombieScore", ReportWriter::CT_REAL);
+
+				report->addColumn("UTXOCount", ReportWriter::CT_COUNT);
+				report->addColumn("UTXOValue", ReportWriter::CT_BTC);
+
+				report->addColumn("EarlyCount", ReportWriter::CT_COUNT);
+				report->addColumn("EarlyValue", ReportWriter::CT_BTC);
+
+				char label[256];
+				for (uint32_t i = 0; i < AR_LAST; i++)
 				{
-					DailyStatistics &d = mDailyStatistics[index + i];
-					if (d.mTimeStamp)
-					{
-						ret = false;
-						break;
-					}
+					snprintf(label, sizeof(label), "%s Count", getAgeRankLabel(AgeRank(i)));
+					report->addColumn(label, ReportWriter::CT_COUNT);
 				}
-				else
+				for (uint32_t i = 0; i < AR_LAST; i++)
 				{
-					break;
+					snprintf(label, sizeof(label), "%s Value", getAgeRankLabel(AgeRank(i)));
+					report->addColumn(label, ReportWriter::CT_BTC);
 				}
-			}
-
-			return ret;
-		}
-
-		void computeTransactionStatistics(const Transaction &t, uint64_t toffset)
-		{
-			uint32_t days = getAgeInDays(t.mTransactionTime);
 
-			if (days != mLastDay)
-			{
-				if (days > mLastDay)
+				for (uint32_t day = 0; day < dayCount; day++)
 				{
-					logMessage("Accumulating Unspent Transaction Output Statistics for %s\r\n", getDateString(t.mTransactionTime));
-					DailyStatistics &d = mDailyStatistics[mLastDay];
-					d.mUTXOCount = uint32_t(mUTXOStats.size());
-					// iterate through all unspent transaction outputs
-					for (auto i = mUTXOStats.begin(); i != mUTXOStats.end(); ++i)
+					if (d.hasDay(day))
 					{
-						UTXOSTAT &stat = (*i).second;
-						double value = (double)stat.mValue / ONE_BTC;
+						uint64_t blockCount = d.getSum(DS_BLOCK_COUNT, day);
+						uint64_t transactionCount = d.getSum(DS_TRANSACTION_COUNT, day);
+						uint64_t transactionSize = d.getSum(DS_TRANSACTION_SIZE, day);
+						uint64_t inputCount = d.getSum(DS_INPUT_COUNT, day);
+						uint64_t outputCount = d.getSum(DS_OUTPUT_COUNT, day);
+						uint64_t totalInputValue = d.getSum(DS_INPUT_VALUE, day);
+						uint64_t totalOutputValue = d.getSum(DS_OUTPUT_VALUE, day);
+						uint64_t inputScriptLength = d.getSum(DS_INPUT_SCRIPT_LENGTH, day);
+						uint64_t outputScriptLength = d.getSum(DS_OUTPUT_SCRIPT_LENGTH, day);
+
+						report->writeDate(d.mTimeStamp[day]);										// Date
+						report->writeCount(blockCount);												// Blocks on this day
+						report->writeCount(d.getSum(DS_DUST_COUNT, day));
+						report->writeCount(transactionCount);										// Number of transactions on this day
+						report->writeReal((double)transactionCount / (double)blockCount);			// Average number of transactions per block
+						report->writeCount(d.getMax(DM_BLOCK_TRANSACTION_COUNT, day));				// Most transactions in a block
+						report->writeCount(transactionSize);										// Total size of all transactions on this day
+						report->writeReal((double)transactionSize / (double)transactionCount);		// Average size of a transaction on this day
+
+						report->writeCount(inputCount);												// Total number of inputs on this day.
+						report->writeReal((double)inputCount / (double)transactionCount);			// Average number of inputs per transaction
+						report->writeCount(d.getMax(DM_INPUT_COUNT, day));							// Maximum number of inputs on a transaction this day
+						report->writeSatoshis(totalInputValue);										// Total input value
+						report->writeReal((double)totalInputValue / ONE_BTC / (double)transactionCount);	// Average input value per transaction
+						report->writeSatoshis(d.getMax(DM_INPUT_VALUE, day));						// Maximum input value on this day
+						report->writeCount(inputScriptLength);
+						report->writeReal((double)inputScriptLength / (double)inputCount);
+
+						report->writeCount(outputCount);											// Total number of outputs on this day.
+						report->writeReal((double)outputCount / (double)transactionCount);			// Average number of outputs per transaction
+						report->writeCount(d.getMax(DM_OUTPUT_COUNT, day));							// Maximum number of outputs on a transaction this day
+						report->writeSatoshis(totalOutputValue);									// Total output value
+						report->writeReal((double)totalOutputValue / ONE_BTC / (double)transactionCount);	// Average output value per transaction
+						report->writeSatoshis(d.getMax(DM_OUTPUT_VALUE, day));						// Maximum output value on this day
+						report->writeCount(outputScriptLength);
+						report->writeReal((double)outputScriptLength / (double)outputCount);
+
+						report->writeCount(d.getMax(DM_INPUT_AGE, day));							//  oldest input
+
+						report->writeCount(d.getSum(DS_ZOMBIE_INPUT_COUNT, day));					// number of inputs which were over 4 years old when spent
+						report->writeSatoshis(d.getSum(DS_ZOMBIE_INPUT_VALUE, day));				// total value of inputs which were over 4 years old when spent
+						report->writeReal(d.mZombieScore[day]);
+
+						report->writeCount(d.getSum(DS_UTXO_COUNT, day));							// number of unspent transaction outputs
+						report->writeSatoshis(d.getSum(DS_UTXO_VALUE, day));						// total value of the unspent transaction outputs
+
+						report->writeCount(d.getSum(DS_EARLY_COUNT, day));							// number of unspent transaction outputs from 2009-2010
+						report->writeSatoshis(d.getSum(DS_EARLY_VALUE, day));						// their total value
 
-						if (isEarly(stat.mTimeStamp))
+						for (uint32_t i = 0; i < AR_LAST; i++)
 						{
-							d.mEarlyCount++;
-							d.mEarlyValue += value;
+							report->writeCount(d.getSum(DS_AGE_COUNT + i, day));
 						}
 
-						d.mUTXOValue += value;
-						uint32_t age = getAgeInDays(stat.mTimeStamp, t.mTransactionTime);
 						for (uint32_t i = 0; i < AR_LAST; i++)
 						{
-							if (age <= d.mAgeStats[i].mDays)
-							{
-								d.mAgeStats[i].mCount++;
-								d.mAgeStats[i].mValue += value;
-								break;
-							}
+							report->writeSatoshis(d.getSum(DS_AGE_VALUE + i, day));
 						}
+
+						report->endRow();
 					}
-					mLastDay = days;
 				}
+				report->release();
 			}
-			assert(days < MAXIMUM_DAYS);
-			DailyStatistics &d = mDailyStatistics[days];
-			if (t.mBlockNumber != d.mCurrentBlock)
+
+			writeDailyPercentilesReport(histograms);
+
+			if (!mZombieInputs.empty())
 			{
-				d.mCurrentBlock = t.mBlockNumber;
-				d.mBlockCount++;
-				if (d.mTransactionBlockCount > d.mMaxTransactionBlockCount)
+				logMessage("Encountered %s zombie inputs.\r\n", formatNumber(int32_t(mZombieInputs.size())));
+				logMessage("Generating Zombie report.\r\n");
+				ReportWriter *zombieReport = ReportWriter::create("ZombieReport.csv", mReportFormat);
+				if (zombieReport)
 				{
-					d.mMaxTransactionBlockCount = d.mTransactionBlockCount;
+					zombieReport->addColumn("Date", ReportWriter::CT_DATE);
+					zombieReport->addColumn("LastDate", ReportWriter::CT_DATE);
+					zombieReport->addColumn("PublicKey", ReportWriter::CT_TEXT);
+					zombieReport->addColumn("Age", ReportWriter::CT_COUNT);
+					zombieReport->addColumn("Value", ReportWriter::CT_BTC);
+					zombieReport->addColumn("ZombieScore", ReportWriter::CT_REAL);
+					for (auto i = mZombieInputs.begin(); i != mZombieInputs.end(); ++i)
+					{
+						const ZombieInput &z = *i;
+						zombieReport->writeDate(z.mSpendTime);
+						zombieReport->writeDate(z.mOriginTime);
+						zombieReport->writeText(z.mKeyIndex < mPublicKeyCount ? getBitcoinAddressAscii(mAddresses[z.mKeyIndex].address) : "UNKNOWN");
+						uint32_t days = getAgeInDays(z.mOriginTime, z.mSpendTime);
+						zombieReport->writeCount(days);
+						zombieReport->writeSatoshis(z.mValue);
+						zombieReport->writeReal(double(days*days)*((double)z.mValue / ONE_BTC));
+						zombieReport->endRow();
+					}
+					zombieReport->release();
 				}
-				d.mTransactionBlockCount = 0;
 			}
-			d.mTransactionBlockCount++;
-			d.mTransactionCount++;
-			d.mTransactionSize += t.mTransactionSize;
-			d.mInputCount += uint32_t(t.mInputs.size());
-			d.mOutputCount += uint32_t(t.mOutputs.size());
-			if (t.mInputs.size() > d.mMaxInputCount)
-			{
-				d.mMaxInputCount = uint32_t(t.mInputs.size());
-			}
-			if (t.mOutputs.size() > d.mMaxOutputCount)
+
+		}
+
+		// Lists the spread of each of the daily distributions as a handful of percentiles
+		void writeDailyPercentilesReport(const DailyHistogramAnalyzer &histograms)
+		{
+			static const char *metricLabels[DailyHistogramAnalyzer::HM_LAST] =
 			{
-				d.mMaxInputCount = uint32_t(t.mOutputs.size());
-			}
-			if (t.mTransactionSize > d.mMaxTransactionSize)
+				"OutputValue",
+				"TransactionSize",
+				"InputAge",
+				"InputScriptLength",
+				"OutputScriptLength"
+			};
+			static const double percentiles[] = { 10, 25, 50, 75, 90, 99 };
+			const uint32_t percentileCount = sizeof(percentiles) / sizeof(percentiles[0]);
+			ReportWriter *report = ReportWriter::create("DailyPercentiles.csv", mReportFormat);
+			if (report == nullptr)
 			{
-				d.mMaxTransactionSize = t.mTransactionSize;
+				return;
 			}
-			// iterate through all of the inputs on this transaction and accumulate daily stats
-			for (size_t i = 0; i < t.mInputs.size(); i++)
+			logMessage("Generating Daily Percentiles report.\r\n");
+			report->addColumn("Date", ReportWriter::CT_DATE);
+			char label[256];
+			for (uint32_t m = 0; m < DailyHistogramAnalyzer::HM_LAST; m++)
 			{
-				const TransactionInput &input = t.mInputs[i];
-
-				if (input.mTransactionIndex != 0xFFFFFFFF )
-				{
-					UTXO utxo(input.mTransactionFileOffset, input.mTransactionIndex);
-					UTXOStatMap::iterator found = mUTXOStats.find(utxo);
-					if (found != mUTXOStats.end())
-					{
-						mUTXOStats.erase(found);
-						if (input.mInputValue < DUST_VALUE)
-						{
-							d.mDustCount++;
-						}
-					}
-					else
-					{
-						assert(0);
-					}
-				}
-
-
-				d.mTotalInputScriptLength += input.mResponseScriptLength;
-				d.mTotalInputValue += double(input.mInputValue) / ONE_BTC;
-				if (input.mResponseScriptLength > d.mMaxInputScriptLength)
-				{
-					d.mMaxInputScriptLength = input.mResponseScriptLength;
-				}
-				if (input.mInputValue > d.mMaxInputValue)
+				ReportWriter::ColumnType type = m == DailyHistogramAnalyzer::HM_OUTPUT_VALUE ? ReportWriter::CT_BTC : ReportWriter::CT_COUNT;
+				snprintf(label, sizeof(label), "%s Min", metricLabels[m]);
+				report->addColumn(label, type, 8);
+				for (uint32_t p = 0; p < percentileCount; p++)
 				{
-					d.mMaxInputValue = input.mInputValue;
+					snprintf(label, sizeof(label), "%s P%d", metricLabels[m], int(percentiles[p]));
+					report->addColumn(label, type, 8);
 				}
-				uint32_t days = getAgeInDays(input.mTimeStamp, t.mTransactionTime);
-				if (days > d.mMaxInputAge)
+				snprintf(label, sizeof(label), "%s Max", metricLabels[m]);
+				report->addColumn(label, type, 8);
+			}
+			const DailyStatisticsTable &d = mDailyStatistics;
+			for (uint32_t day = 0; day < uint32_t(histograms.mDays.size()); day++)
+			{
+				if (!d.hasDay(day))
 				{
-					d.mMaxInputAge = days;
+					continue;
 				}
-
-				if (days > ZOMBIE_TIME)
+				report->writeDate(d.mTimeStamp[day]);
+				for (uint32_t m = 0; m < DailyHistogramAnalyzer::HM_LAST; m++)
 				{
-					TransactionInput ip = input;
-					ip.mTimeStamp = t.mTransactionTime;
-					mZombieInputs.push_back(ip);
-					d.mZombieInputCount++;
-					d.mZombieInputValue += double(input.mInputValue) / ONE_BTC;
-				}
-
-				d.mZombieScore += (double)(days*days)*(double(input.mInputValue) / ONE_BTC);
-			}
-
-
-			uint32_t count = uint32_t(t.mOutputs.size());
-			switch (count)
-			{
-				case 0:
-					assert(0); // should never happen!?
-					break;
-				case 1:
-					{
-						const TransactionOutput &to = t.mOutputs[0];
-						d.mValueEntryTable.addValue(to.mValue);
-					}
-					break;
-				case 2:
+					const Histogram &h = histograms.mDays[day].mHistograms[m];
+					bool satoshis = m == DailyHistogramAnalyzer::HM_OUTPUT_VALUE;
+					for (uint32_t p = 0; p <= percentileCount + 1; p++)
 					{
-						const TransactionOutput &t1 = t.mOutputs[0];
-						const TransactionOutput &t2 = t.mOutputs[1];
-						uint64_t v = t1.mValue;
-						if (t2.mValue < v)
+						uint64_t value = p == 0 ? h.getMin() : p > percentileCount ? h.getMax() : h.getValueAtPercentile(percentiles[p - 1]);
+						if (satoshis)
 						{
-							v = t2.mValue;
+							report->writeSatoshis(value);
 						}
-						d.mValueEntryTable.addValue(v);
-					}
-					break;
-				default:
-					{
-						uint64_t v = 0;
-						for (uint32_t i = 0; i < count; i++)
+						else
 						{
-							const TransactionOutput &to = t.mOutputs[i];
-							if (to.mValue > v)
-							{
-								v = to.mValue;
-							}
+							report->writeCount(value);
 						}
-						d.mValueEntryTable.addValue(v);
 					}
-					break;
-			}
-
-
-			for (size_t i = 0; i < t.mOutputs.size(); i++)
-			{
-				const TransactionOutput &output = t.mOutputs[i];
-				d.mTotalOutputScriptLength += output.mScriptLength;
-				d.mTotalOutputValue += (double)(output.mValue) / ONE_BTC;
-				if (output.mScriptLength > d.mMaxOutputScriptLength)
-				{
-					d.mMaxOutputScriptLength = output.mScriptLength;
 				}
-				if (output.mValue > d.mMaxOutputValue)
-				{
-					d.mMaxOutputValue = output.mValue;
-				}
-
-				UTXOSTAT stat(output.mValue, t.mTransactionTime);
-				UTXO utxo(toffset, i);
-				mUTXOStats[utxo] = stat;
-
-				d.mKeyTypeCounts[output.mKeyType]++;
-			}
-			if (d.mTimeStamp == 0)
-			{
-				d.mTimeStamp = t.mTransactionTime;
+				report->endRow();
 			}
+			report->release();
 		}
 
 
-
 	private:
 		bool						mAnalyze;
 		uint64_t					mFirstTransactionOffset;	// the first transaction offset
@@ -2410,19 +5821,33 @@ namespace PUBLIC_KEY_DATABASE
 		const uint64_t				*mPublicKeyRecordOffsets;		// Offsets 
 		PublicKeyRecordFile			**mPublicKeyRecordSorted;		// Public key records sorted
 
-		uint32_t					mLastDay;
-		DailyStatistics				*mDailyStatistics;	// room to compute daily statistics
+		FILE_INTERFACE				*mPublicKeyIndexFile;			// The memory mapped address lookup index
+		const PublicKeyIndexEntry	*mPublicKeyIndex;				// Its entries in Eytzinger order; entry 0 is unused
+		FILE_INTERFACE				*mPublicKeyClustersFile;		// The memory mapped public key clusters
+		const uint32_t				*mPublicKeyClusters;			// The cluster id of each public key
+
+		DailyStatisticsTable		mDailyStatistics;	// The statistics computed by reportDailyTransactions
 		UTXOMap						mUTXO;				// unspent transaction outputs...
-		UTXOStatMap					mUTXOStats;			//
 
-		TransactionInputVector		mZombieInputs;		// all zombie events
+		ZombieInputVector			mZombieInputs;		// all zombie events
+
+		uint32_t					mResumeBlockIndex;	// The first block to add when resuming from a checkpoint
+		uint32_t					mLastBlockIndex;	// The last block added to the database
+		uint32_t					mLastBlockTime;		// The latest block time stamp added so far; what new transactions are stamped with
+		uint8_t						mLastBlockHash[32];	// The hash of the last block added to the database
+		uint64_t					mMemoryBudget;		// Memory the records build may use for sorting
+		uint32_t					mThreadCount;		// Threads the records build uses; zero means one per hardware thread
+		ReportWriter::Format		mReportFormat;		// The format reports are written in
+		std::vector< BlockAnalyzer * >	mBlockAnalyzers;	// Handed every block as it is added
+		bool						mNeedSpentOutputs;	// Some block analyzer wants the outputs each block spends
+		std::vector< BlockAnalyzer::SpentOutput >	mSpentOutputs;	// The outputs spent by the inputs of the block being added
 	};
 
 }
 
-PublicKeyDatabase * PublicKeyDatabase::create(bool analyze)
+PublicKeyDatabase * PublicKeyDatabase::create(bool analyze,bool resume)
 {
-	PUBLIC_KEY_DATABASE::PublicKeyDatabaseImpl *p = new PUBLIC_KEY_DATABASE::PublicKeyDatabaseImpl(analyze);
+	PUBLIC_KEY_DATABASE::PublicKeyDatabaseImpl *p = new PUBLIC_KEY_DATABASE::PublicKeyDatabaseImpl(analyze,resume);
 	if (!p->isValid())
 	{
 		p->release();
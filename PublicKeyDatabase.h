@@ -4,6 +4,8 @@
 #include <stdint.h>
 
 #include "BlockChain.h"
+#include "ReportWriter.h"
+#include "BlockAnalyzer.h"
 
 // This class converts the contents of the blocks in the blockchain into
 // a database of transactions associated with public keys.
@@ -14,26 +16,131 @@
 class PublicKeyDatabase
 {
 public:
+	// How often buildBalanceSnapshots records every public key's balance
+	enum SnapshotInterval
+	{
+		SI_DAILY,
+		SI_WEEKLY,
+		SI_MONTHLY
+	};
+
+	// The orderings reportSortedKeys can list the public keys in
+	enum KeyOrder
+	{
+		KO_BALANCE,				// Largest balance first
+		KO_AGE,					// Longest untouched first
+		KO_TRANSACTION_COUNT	// Most transactions first
+	};
+
+	// What the query methods report about one public key, as of a point in time
+	class KeySummary
+	{
+	public:
+		uint32_t	mIndex;					// The public key index
+		uint32_t	mTransactionCount;		// Number of transactions up to that time
+		uint64_t	mBalance;
+		uint64_t	mTotalSend;
+		uint64_t	mTotalReceive;
+		uint32_t	mFirstTime;				// Time of the first transaction; zero if there were none by then
+		uint32_t	mLastSendTime;
+		uint32_t	mLastReceiveTime;
+		uint32_t	mReserved;
+	};
+
+	// One entry in the transaction history of a public key
+	class KeyTransaction
+	{
+	public:
+		uint64_t	mValue;
+		uint64_t	mBalance;				// The balance after this transaction
+		uint32_t	mTimeStamp;
+		bool		mSpend;					// Spent from the key rather than received by it
+	};
+
 	// If 'analyze is true, we load previously build database files for analysis
-	static PublicKeyDatabase *create(bool analyze);
+	// If 'resume' is true (and we are not analyzing) the partially built database files are truncated back to
+	// the last consistent checkpoint and ingest continues from the block following it.
+	static PublicKeyDatabase *create(bool analyze,bool resume=false);
+
+	// Add this block to our optimized transaction database.  Returns false if ingest has to stop, which happens
+	// when a resumed run is handed a block that does not build on the checkpointed block, or that spends a
+	// transaction the database does not hold; such a block is rejected before any of it is written.
+	virtual bool addBlock(const BlockChain::Block *b) = 0;
 
-	// Add this block to our optimized transaction database
-	virtual void addBlock(const BlockChain::Block *b) = 0;
+	// Hands every block added from now on to this analyzer as well, along with the outputs its inputs spend if it
+	// asks for them.  The caller still owns the analyzer, and calls its end() once the last block has been added.
+	virtual void addBlockAnalyzer(BlockAnalyzer *analyzer) = 0;
+
+	// Returns the index of the first block which still needs to be added; zero unless we resumed from a checkpoint
+	virtual uint32_t getResumeBlockIndex(void) = 0;
 
 	virtual void buildPublicKeyDatabase(void) = 0;
+
+	// Sets how much memory (in bytes) building the public key records may use for sorting; beyond that it spills to disk
+	virtual void setMemoryBudget(uint64_t bytes) = 0;
+
+	// Sets how many threads building the public key records uses; zero (the default) means one per hardware thread
+	virtual void setThreadCount(uint32_t threadCount) = 0;
+
+	// Sets the format every report is written in; CSV unless changed
+	virtual void setReportFormat(ReportWriter::Format format) = 0;
 	
 	// Accessors methods for the public key database
 	virtual uint32_t getPublicKeyCount(void) = 0;
 	virtual void printPublicKey(uint32_t index) = 0;
 
+	// The query methods only read the memory mapped database files, so in analyze mode any number of threads may
+	// call them at once.
+
+	// Returns the index of the public key with this ASCII bitcoin address; 0xFFFFFFFF if it is not in the database.
+	// Uses PublicKeyIndex.bin, which is written at the end of ingest (and rebuilt when analyzing if it is missing).
+	virtual uint32_t lookupPublicKey(const char *address) const = 0;
+
+	// Writes the ASCII bitcoin address of this public key into 'address'
+	virtual bool getAddressAscii(uint32_t index,char *address,uint32_t maxLength) const = 0;
+
+	// Summarizes the activity of this public key up to and including 'timeStamp'
+	virtual bool getKeySummary(uint32_t index,uint32_t timeStamp,KeySummary &summary) const = 0;
+
+	// Copies up to 'maxCount' transactions of this public key, starting with transaction 'first', into 'history'.
+	// Returns how many were copied.
+	virtual uint32_t getKeyHistory(uint32_t index,uint32_t first,uint32_t maxCount,KeyTransaction *history) const = 0;
+
+	// Finds the 'maxCount' largest balances as of 'timeStamp', largest first.  Returns how many were found.
+	// Runs entirely on the calling thread, so a query server worker can call it without oversubscribing the machine.
+	virtual uint32_t getTopBalances(uint32_t maxCount,uint32_t timeStamp,uint32_t *indices,uint64_t *balances) const = 0;
+
+	// Looks up every address listed (one per line) in 'queryFileName' and writes its balance, transaction count, first and
+	// last activity and totals as of 'timeStamp' to the report 'reportFileName', in the order they were listed.
+	virtual void reportAddressQueries(const char *queryFileName,const char *reportFileName,uint32_t timeStamp) = 0;
+
+	// Writes the key index, balance, first and last activity and transaction count of every public key with any
+	// transactions as of 'timeStamp' to the report 'reportFileName'.
+	virtual void reportAddressSummaries(const char *reportFileName,uint32_t timeStamp) = 0;
+
+	// Makes one chronological pass over the transactions and saves every non-zero balance at each interval boundary
+	// to BalanceSnapshots.bin.  Historical balance reports then start from the nearest snapshot instead of the full history.
+	virtual void buildBalanceSnapshots(SnapshotInterval interval) = 0;
+
 	// Generates the top <n> balances; written to the file named 'reportFileName' on a specific date
 	virtual void reportTopBalances(const char *reportFileName,uint32_t maxReport,uint32_t timeStamp) = 0;
 
+	// Lists the first <n> public keys in the given order, with their balance, age and number of transactions as of 'timeStamp'
+	virtual void reportSortedKeys(const char *reportFileName,uint32_t maxReport,KeyOrder order,uint32_t timeStamp) = 0;
+
 	// compute the transaction statistics on a daily basis for the entire history of the blockchain
 	virtual void reportDailyTransactions(const char *reportFileName) = 0;
 
-	// Will generate a spreadsheet of bitcoin balances sorted by age of last access
-	virtual void reportByAge(const char *reportName) = 0;
+	// Groups the public keys into clusters with one owner, taking every key spent from in the same transaction to have
+	// the same owner, and writes the 'maxReport' clusters holding the most as of 'timeStamp' to the report
+	// 'reportFileName'.  The cluster of every key is saved to PublicKeyClusters.bin, which is reused until more
+	// transactions are added.
+	virtual void reportClusterBalances(const char *reportFileName,uint32_t maxReport,uint32_t timeStamp) = 0;
+
+	// Writes the number of public keys holding a balance as of 'timeStamp', and how much they hold, in each range of time
+	// since the key last sent or received to the report 'reportFileName'.  If 'keysReportFileName' is not nullptr every
+	// one of those keys is also listed there, the longest dormant first.
+	virtual void reportByAge(const char *reportFileName,const char *keysReportFileName,uint32_t timeStamp) = 0;
 
 	virtual void release(void) = 0;
 
@@ -0,0 +1,580 @@
+#include "QueryServer.h"
+#include "PublicKeyDatabase.h"
+#include "ThreadPool.h"
+#include "logging.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable:4996)
+#endif
+
+#define QUERY_SERVER_MAX_LINE		1024		// Longest request line accepted
+#define QUERY_SERVER_MAX_RESULTS	1000000		// Most history entries or top balances returned by one request
+
+namespace QUERY_SERVER
+{
+
+#ifdef _WIN32
+	typedef SOCKET SocketHandle;
+	const SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+	const int SEND_FLAGS = 0;
+
+	void closeSocket(SocketHandle s)
+	{
+		closesocket(s);
+	}
+
+	typedef WSAPOLLFD PollDescriptor;
+
+	// Blocks until at least one of the sockets has something to read (or has hung up)
+	int pollSockets(PollDescriptor *descriptors, size_t count)
+	{
+		return WSAPoll(descriptors, ULONG(count), -1);
+	}
+#else
+	typedef int SocketHandle;
+	const SocketHandle INVALID_SOCKET_HANDLE = -1;
+	const int SEND_FLAGS = MSG_NOSIGNAL;	// A client hanging up should not kill the server
+
+	void closeSocket(SocketHandle s)
+	{
+		close(s);
+	}
+
+	typedef struct pollfd PollDescriptor;
+
+	// Blocks until at least one of the sockets has something to read (or has hung up)
+	int pollSockets(PollDescriptor *descriptors, size_t count)
+	{
+		return poll(descriptors, nfds_t(count), -1);
+	}
+#endif
+
+	// Splits a request line into its space separated words
+	std::vector< std::string > splitWords(const std::string &line)
+	{
+		std::vector< std::string > ret;
+		size_t i = 0;
+		while (i < line.size())
+		{
+			while (i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r'))
+			{
+				i++;
+			}
+			size_t start = i;
+			while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r')
+			{
+				i++;
+			}
+			if (i > start)
+			{
+				ret.push_back(line.substr(start, i - start));
+			}
+		}
+		return ret;
+	}
+
+	// Parses an optional unsigned argument; 'defaultValue' if it is not there
+	uint32_t getArgument(const std::vector< std::string > &words, size_t index, uint32_t defaultValue)
+	{
+		if (index < words.size())
+		{
+			return uint32_t(strtoul(words[index].c_str(), nullptr, 10));
+		}
+		return defaultValue;
+	}
+
+	// One client connection.  The server thread reads whatever the client sends and, once there is a complete request
+	// line, marks the connection busy and hands it to the thread pool which answers every complete line received so far.
+	// The server thread leaves a busy connection alone, so only one thread at a time ever touches it.
+	class Connection
+	{
+	public:
+		Connection(const PublicKeyDatabase *database, SocketHandle socket) : mDatabase(database)
+			, mSocket(socket)
+			, mBusy(false)
+			, mClosed(false)
+			, mShutdownRequested(false)
+		{
+		}
+
+		~Connection(void)
+		{
+			closeSocket(mSocket);
+		}
+
+		SocketHandle getSocket(void) const
+		{
+			return mSocket;
+		}
+
+		bool isBusy(void) const
+		{
+			return mBusy;
+		}
+
+		void setBusy(bool state)
+		{
+			mBusy = state;
+		}
+
+		// True once the client has hung up, sent QUIT or SHUTDOWN, or can no longer be written to
+		bool isClosed(void) const
+		{
+			return mClosed;
+		}
+
+		bool isShutdownRequested(void) const
+		{
+			return mShutdownRequested;
+		}
+
+		// Reads what the client has sent; returns true if there is now at least one complete request line to serve
+		bool receive(void)
+		{
+			char buffer[QUERY_SERVER_MAX_LINE];
+			int r = recv(mSocket, buffer, sizeof(buffer), 0);
+			if (r <= 0)
+			{
+				mClosed = true;
+				return false;
+			}
+			mPending.append(buffer, size_t(r));
+			if (mPending.find('\n') != std::string::npos)
+			{
+				return true;
+			}
+			if (mPending.size() > QUERY_SERVER_MAX_LINE)
+			{
+				mClosed = true;		// Not a client which speaks this protocol
+			}
+			return false;
+		}
+
+		// Answers every complete request line received so far
+		void serveRequests(void)
+		{
+			std::string line;
+			while (!mClosed && readLine(line))
+			{
+				std::vector< std::string > words = splitWords(line);
+				if (words.empty())
+				{
+					continue;
+				}
+				const std::string &command = words[0];
+				if (command == "QUIT")
+				{
+					mClosed = true;
+				}
+				else if (command == "SHUTDOWN")
+				{
+					reply("OK\n");
+					mShutdownRequested = true;
+					mClosed = true;
+				}
+				else if (command == "BALANCE")
+				{
+					balance(words);
+				}
+				else if (command == "HISTORY")
+				{
+					history(words);
+				}
+				else if (command == "TOP")
+				{
+					top(words);
+				}
+				else
+				{
+					reply("ERROR unknown command\n");
+				}
+				if (!flush())
+				{
+					mClosed = true;
+				}
+			}
+		}
+
+	private:
+		bool lookup(const std::vector< std::string > &words, uint32_t &index)
+		{
+			if (words.size() < 2)
+			{
+				reply("ERROR missing address\n");
+				return false;
+			}
+			index = mDatabase->lookupPublicKey(words[1].c_str());
+			if (index == 0xFFFFFFFF)
+			{
+				reply("ERROR address not found\n");
+				return false;
+			}
+			return true;
+		}
+
+		void balance(const std::vector< std::string > &words)
+		{
+			uint32_t index;
+			if (!lookup(words, index))
+			{
+				return;
+			}
+			PublicKeyDatabase::KeySummary summary;
+			if (!mDatabase->getKeySummary(index, getArgument(words, 2, 0xFFFFFFFF), summary))
+			{
+				reply("ERROR no records for this address\n");
+				return;
+			}
+			reply("OK %llu %u %u %u %u %llu %llu\n", (unsigned long long)summary.mBalance, summary.mTransactionCount, summary.mFirstTime,
+				summary.mLastSendTime, summary.mLastReceiveTime, (unsigned long long)summary.mTotalSend, (unsigned long long)summary.mTotalReceive);
+		}
+
+		void history(const std::vector< std::string > &words)
+		{
+			uint32_t index;
+			if (!lookup(words, index))
+			{
+				return;
+			}
+			uint32_t first = getArgument(words, 2, 0);
+			uint32_t count = getArgument(words, 3, QUERY_SERVER_MAX_RESULTS);
+			if (count > QUERY_SERVER_MAX_RESULTS)
+			{
+				count = QUERY_SERVER_MAX_RESULTS;
+			}
+			PublicKeyDatabase::KeySummary summary;
+			if (!mDatabase->getKeySummary(index, 0xFFFFFFFF, summary))
+			{
+				reply("ERROR no records for this address\n");
+				return;
+			}
+			if (first > summary.mTransactionCount)
+			{
+				first = summary.mTransactionCount;
+			}
+			if (count > summary.mTransactionCount - first)
+			{
+				count = summary.mTransactionCount - first;
+			}
+			std::vector< PublicKeyDatabase::KeyTransaction > transactions(count);
+			count = count ? mDatabase->getKeyHistory(index, first, count, &transactions[0]) : 0;
+			reply("OK %u\n", count);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const PublicKeyDatabase::KeyTransaction &t = transactions[i];
+				reply("%u %c %llu %llu\n", t.mTimeStamp, t.mSpend ? 'S' : 'R', (unsigned long long)t.mValue, (unsigned long long)t.mBalance);
+			}
+		}
+
+		void top(const std::vector< std::string > &words)
+		{
+			uint32_t count = getArgument(words, 1, 0);
+			if (count == 0 || count > QUERY_SERVER_MAX_RESULTS)
+			{
+				reply("ERROR expected a count between 1 and %u\n", QUERY_SERVER_MAX_RESULTS);
+				return;
+			}
+			std::vector< uint32_t > indices(count);
+			std::vector< uint64_t > balances(count);
+			count = mDatabase->getTopBalances(count, getArgument(words, 2, 0xFFFFFFFF), &indices[0], &balances[0]);
+			reply("OK %u\n", count);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				char address[256];
+				if (!mDatabase->getAddressAscii(indices[i], address, sizeof(address)))
+				{
+					strcpy(address, "?");
+				}
+				reply("%s %llu\n", address, (unsigned long long)balances[i]);
+			}
+		}
+
+		// Appends to the pending reply; sent by flush once the request has been answered
+		void reply(const char *fmt, ...)
+		{
+			char scratch[QUERY_SERVER_MAX_LINE];
+			va_list args;
+			va_start(args, fmt);
+			vsnprintf(scratch, sizeof(scratch), fmt, args);
+			va_end(args);
+			mReply += scratch;
+		}
+
+		bool flush(void)
+		{
+			size_t sent = 0;
+			while (sent < mReply.size())
+			{
+				int r = send(mSocket, mReply.c_str() + sent, int(mReply.size() - sent), SEND_FLAGS);
+				if (r <= 0)
+				{
+					mReply.clear();
+					return false;
+				}
+				sent += size_t(r);
+			}
+			mReply.clear();
+			return true;
+		}
+
+		// Takes the next complete request line, without the newline, from what has been received
+		bool readLine(std::string &line)
+		{
+			size_t newline = mPending.find('\n');
+			if (newline == std::string::npos)
+			{
+				return false;
+			}
+			line = mPending.substr(0, newline);
+			mPending.erase(0, newline + 1);
+			return true;
+		}
+
+		const PublicKeyDatabase	*mDatabase;
+		SocketHandle			mSocket;
+		std::atomic< bool >		mBusy;			// Handed to the thread pool; the server thread must not touch it
+		bool					mClosed;
+		bool					mShutdownRequested;
+		std::string				mPending;		// Received but not yet consumed
+		std::string				mReply;			// Reply being assembled
+	};
+
+	class QueryServerImpl : public QueryServer
+	{
+	public:
+		QueryServerImpl(const PublicKeyDatabase *database, uint32_t threadCount) : mDatabase(database)
+			, mListen(INVALID_SOCKET_HANDLE)
+			, mWakeSend(INVALID_SOCKET_HANDLE)
+			, mWakeReceive(INVALID_SOCKET_HANDLE)
+			, mShutdown(false)
+			, mPool(nullptr)
+		{
+			mSocketName[0] = 0;
+			mThreadCount = threadCount;
+		}
+
+		virtual ~QueryServerImpl(void)
+		{
+			if (mPool)
+			{
+				mPool->release();
+			}
+			for (auto i = mConnections.begin(); i != mConnections.end(); ++i)
+			{
+				delete (*i);
+			}
+			if (mWakeSend != INVALID_SOCKET_HANDLE)
+			{
+				closeSocket(mWakeSend);
+			}
+			if (mWakeReceive != INVALID_SOCKET_HANDLE)
+			{
+				closeSocket(mWakeReceive);
+			}
+			if (mListen != INVALID_SOCKET_HANDLE)
+			{
+				closeSocket(mListen);
+				remove(mSocketName);
+			}
+#ifdef _WIN32
+			WSACleanup();
+#endif
+		}
+
+		bool open(const char *socketName)
+		{
+#ifdef _WIN32
+			WSADATA wsaData;
+			if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+			{
+				logMessage("Failed to initialize Windows sockets.\n");
+				return false;
+			}
+#endif
+			struct sockaddr_un address;
+			memset(&address, 0, sizeof(address));
+			if (strlen(socketName) >= sizeof(address.sun_path))
+			{
+				logMessage("The socket name '%s' is too long.\n", socketName);
+				return false;
+			}
+			address.sun_family = AF_UNIX;
+			strcpy(address.sun_path, socketName);
+			strncpy(mSocketName, socketName, sizeof(mSocketName) - 1);
+			mSocketName[sizeof(mSocketName) - 1] = 0;
+
+			mListen = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (mListen == INVALID_SOCKET_HANDLE)
+			{
+				logMessage("Failed to create the query server socket.\n");
+				return false;
+			}
+			remove(socketName);		// A socket file left behind by a previous server
+			if (bind(mListen, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(mListen, SOMAXCONN) != 0)
+			{
+				logMessage("Failed to listen on the socket '%s'\n", socketName);
+				closeSocket(mListen);
+				mListen = INVALID_SOCKET_HANDLE;
+				return false;
+			}
+			// A connection to ourselves which the workers write a byte to whenever they finish with a connection, so that
+			// the server thread wakes up and starts watching it again.
+			mWakeSend = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (mWakeSend == INVALID_SOCKET_HANDLE || connect(mWakeSend, (struct sockaddr *)&address, sizeof(address)) != 0)
+			{
+				logMessage("Failed to connect to the socket '%s'\n", socketName);
+				return false;
+			}
+			mWakeReceive = accept(mListen, nullptr, nullptr);
+			if (mWakeReceive == INVALID_SOCKET_HANDLE)
+			{
+				logMessage("Failed to accept a connection on the socket '%s'\n", socketName);
+				return false;
+			}
+			mPool = ThreadPool::create(mThreadCount);
+			return true;
+		}
+
+		virtual void run(void) override final
+		{
+			logMessage("Query server listening on '%s' with %d threads.\n", mSocketName, mPool->getThreadCount());
+			std::vector< PollDescriptor > descriptors;
+			std::vector< Connection * > watched;
+			while (!mShutdown)
+			{
+				descriptors.clear();
+				watched.clear();
+				addDescriptor(descriptors, mListen);
+				addDescriptor(descriptors, mWakeReceive);
+				for (auto i = mConnections.begin(); i != mConnections.end(); ++i)
+				{
+					if (!(*i)->isBusy())
+					{
+						addDescriptor(descriptors, (*i)->getSocket());
+						watched.push_back(*i);
+					}
+				}
+				if (pollSockets(&descriptors[0], descriptors.size()) < 0)
+				{
+					continue;	// Interrupted by a signal
+				}
+				if (descriptors[1].revents)
+				{
+					char buffer[256];
+					recv(mWakeReceive, buffer, sizeof(buffer), 0);
+				}
+				for (size_t i = 0; i < watched.size(); i++)
+				{
+					Connection *c = watched[i];
+					if (descriptors[i + 2].revents && c->receive())
+					{
+						c->setBusy(true);
+						mPool->addTask([this, c]()
+						{
+							c->serveRequests();
+							if (c->isShutdownRequested())
+							{
+								mShutdown = true;
+							}
+							c->setBusy(false);
+							wake();
+						});
+					}
+				}
+				if (descriptors[0].revents)
+				{
+					SocketHandle client = accept(mListen, nullptr, nullptr);
+					if (client != INVALID_SOCKET_HANDLE)
+					{
+						mConnections.push_back(new Connection(mDatabase, client));
+					}
+				}
+				removeClosedConnections();
+			}
+			mPool->waitForTasks();		// Let the requests already being answered finish
+			removeClosedConnections();
+			logMessage("Query server stopped.\n");
+		}
+
+		virtual void release(void) override final
+		{
+			delete this;
+		}
+
+	private:
+		void addDescriptor(std::vector< PollDescriptor > &descriptors, SocketHandle s)
+		{
+			PollDescriptor d;
+			memset(&d, 0, sizeof(d));
+			d.fd = s;
+			d.events = POLLIN;
+			descriptors.push_back(d);
+		}
+
+		void removeClosedConnections(void)
+		{
+			size_t keep = 0;
+			for (size_t i = 0; i < mConnections.size(); i++)
+			{
+				Connection *c = mConnections[i];
+				if (!c->isBusy() && c->isClosed())
+				{
+					delete c;
+				}
+				else
+				{
+					mConnections[keep++] = c;
+				}
+			}
+			mConnections.resize(keep);
+		}
+
+		void wake(void)
+		{
+			char wakeByte = 0;
+			send(mWakeSend, &wakeByte, 1, SEND_FLAGS);	// If the buffer is full a wake up is already pending
+		}
+
+		const PublicKeyDatabase	*mDatabase;
+		SocketHandle			mListen;
+		SocketHandle			mWakeSend;			// Written to by the workers to wake up the server thread
+		SocketHandle			mWakeReceive;
+		std::atomic< bool >		mShutdown;
+		std::vector< Connection * >	mConnections;	// Only touched by the server thread
+		ThreadPool				*mPool;
+		uint32_t				mThreadCount;
+		char					mSocketName[512];
+	};
+
+} // end of QUERY_SERVER namespace
+
+QueryServer *QueryServer::create(const PublicKeyDatabase *database, const char *socketName, uint32_t threadCount)
+{
+	QUERY_SERVER::QueryServerImpl *ret = new QUERY_SERVER::QueryServerImpl(database, threadCount);
+	if (!ret->open(socketName))
+	{
+		ret->release();
+		ret = nullptr;
+	}
+	return static_cast<QueryServer *>(ret);
+}
@@ -0,0 +1,38 @@
+#ifndef QUERY_SERVER_H
+
+#define QUERY_SERVER_H
+
+#include <stdint.h>
+
+class PublicKeyDatabase;
+
+// Serves queries against an analyze mode PublicKeyDatabase over a local (Unix domain) socket, so the database files
+// are opened once rather than for every question asked of them.  One thread watches every connection and hands each
+// request to a thread pool as it arrives, so idle clients don't tie up the workers.
+//
+// The protocol is one request per line and the reply starts with either 'OK' or 'ERROR <reason>'.  Values are in
+// satoshis and times are unix time stamps; an omitted time stamp means 'now'.
+//
+// BALANCE <address> [timeStamp]			OK <balance> <transactions> <firstTime> <lastSendTime> <lastReceiveTime> <totalSent> <totalReceived>
+// HISTORY <address> [first] [count]		OK <n>  followed by <n> lines of: <timeStamp> <S|R> <value> <balance>
+// TOP <n> [timeStamp]						OK <n>  followed by <n> lines of: <address> <balance>
+// QUIT										Closes the connection
+// SHUTDOWN									Stops the server
+class QueryServer
+{
+public:
+	// Binds the socket; returns nullptr (and logs why) if it can't.  'threadCount' of zero means one per hardware thread.
+	static QueryServer *create(const PublicKeyDatabase *database,const char *socketName,uint32_t threadCount);
+
+	// Accepts and serves connections until a client sends SHUTDOWN
+	virtual void run(void) = 0;
+
+	virtual void release(void) = 0;
+
+protected:
+	virtual ~QueryServer(void)
+	{
+	}
+};
+
+#endif
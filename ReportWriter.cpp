@@ -0,0 +1,647 @@
+#include "ReportWriter.h"
+#include "logging.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma warning(disable:4996)
+#endif
+
+#define REPORT_WRITER_BUFFER_SIZE	(1024*1024)		// Output is gathered into this much memory before each write to disk
+#define REPORT_WRITER_MAX_VALUE		64				// The most characters any number is written as
+#define REPORT_WRITER_COLUMN_BUFFER_SIZE	(64*1024)	// Each array of a columnar report is gathered into this much memory before each write
+
+namespace REPORT_WRITER
+{
+	const uint32_t SECONDS_PER_DAY = 60 * 60 * 24;
+	const uint32_t DATE_LENGTH = 10;				// yyyy-mm-dd
+	const uint64_t powersOfTen[] =
+	{
+		1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+		10000000000ULL, 100000000000ULL, 1000000000000ULL
+	};
+	const uint32_t MAX_DECIMALS = 12;
+	const uint64_t COLUMN_ALIGNMENT = ReportWriter::COLUMN_FILE_ALIGNMENT;
+
+	// Converts days since 1970-01-01 into a calendar date without going through gmtime
+	void getCivilDate(uint32_t days, uint32_t &year, uint32_t &month, uint32_t &day)
+	{
+		uint32_t z = days + 719468;
+		uint32_t era = z / 146097;
+		uint32_t dayOfEra = z - era * 146097;
+		uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+		uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+		uint32_t monthIndex = (5 * dayOfYear + 2) / 153;
+		day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+		month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+		year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+	}
+
+	class Column
+	{
+	public:
+		std::string					mName;
+		ReportWriter::ColumnType	mType;
+		uint32_t					mDecimals;
+	};
+
+	typedef std::vector< Column > ColumnVector;
+
+	class ReportWriterCSV : public ReportWriter
+	{
+	public:
+		ReportWriterCSV(FILE *fph, const std::string &fileName) : mFile(fph)
+			, mFileName(fileName)
+			, mBuffer(REPORT_WRITER_BUFFER_SIZE)
+			, mLength(0)
+			, mColumn(0)
+			, mHeaderWritten(false)
+			, mFailed(false)
+		{
+		}
+
+		virtual ~ReportWriterCSV(void)
+		{
+			close();
+		}
+
+		virtual void addColumn(const char *name, ColumnType type, uint32_t decimals) override final
+		{
+			assert(!mHeaderWritten);
+			Column c;
+			c.mName = name;
+			c.mType = type;
+			c.mDecimals = decimals < MAX_DECIMALS ? decimals : MAX_DECIMALS;
+			mColumns.push_back(c);
+		}
+
+		virtual void writeText(const char *text) override final
+		{
+			nextColumn(CT_TEXT);
+			writeField(text);
+		}
+
+		virtual void writeDate(uint32_t timeStamp) override final
+		{
+			nextColumn(CT_DATE);
+			uint32_t dayIndex = timeStamp / SECONDS_PER_DAY;
+			if (dayIndex >= mDates.size() / DATE_LENGTH)
+			{
+				mDates.resize((dayIndex + 1) * DATE_LENGTH, 0);
+			}
+			char *date = &mDates[dayIndex * DATE_LENGTH];
+			if (date[0] == 0)
+			{
+				uint32_t year, month, day;
+				getCivilDate(dayIndex, year, month, day);
+				char scratch[32];
+				snprintf(scratch, sizeof(scratch), "%04u-%02u-%02u", year, month, day);
+				memcpy(date, scratch, DATE_LENGTH);
+			}
+			reserve(DATE_LENGTH);
+			memcpy(&mBuffer[mLength], date, DATE_LENGTH);
+			mLength += DATE_LENGTH;
+		}
+
+		virtual void writeCount(uint64_t count) override final
+		{
+			nextColumn(CT_COUNT);
+			reserve(REPORT_WRITER_MAX_VALUE);
+			writeInteger(count, 0);
+		}
+
+		virtual void writeSatoshis(uint64_t satoshis) override final
+		{
+			const Column &c = nextColumn(CT_BTC);
+			reserve(REPORT_WRITER_MAX_VALUE);
+			// Round to the number of decimals wanted, then split into whole BTC and the fraction
+			uint64_t scale = c.mDecimals < 8 ? powersOfTen[8 - c.mDecimals] : 1;
+			uint64_t scaled = satoshis / scale + ((satoshis % scale) * 2 >= scale ? 1 : 0);
+			writeFixed(scaled, c.mDecimals > 8 ? 8 : c.mDecimals);
+			for (uint32_t i = 8; i < c.mDecimals; i++)
+			{
+				mBuffer[mLength++] = '0';
+			}
+		}
+
+		virtual void writeReal(double value) override final
+		{
+			const Column &c = nextColumn(CT_REAL);
+			reserve(REPORT_WRITER_MAX_VALUE);
+			double scaled = fabs(value) * double(powersOfTen[c.mDecimals]);
+			if (scaled < 9.0e15)
+			{
+				if (value < 0 && uint64_t(scaled + 0.5))
+				{
+					mBuffer[mLength++] = '-';
+				}
+				writeFixed(uint64_t(scaled + 0.5), c.mDecimals);
+			}
+			else
+			{
+				// Too large to format exactly as an integer, or not a number at all
+				char scratch[512];
+				int length = snprintf(scratch, sizeof(scratch), "%.*f", int(c.mDecimals), value);
+				if (length > 0 && length < int(sizeof(scratch)))
+				{
+					reserve(uint32_t(length));
+					memcpy(&mBuffer[mLength], scratch, size_t(length));
+					mLength += size_t(length);
+				}
+			}
+		}
+
+		virtual void endRow(void) override final
+		{
+			assert(mColumn == mColumns.size());
+			reserve(1);
+			mBuffer[mLength++] = '\n';
+			mColumn = 0;
+		}
+
+		virtual bool release(void) override final
+		{
+			bool ret = close();
+			delete this;
+			return ret;
+		}
+
+	private:
+		// Starts the next value of the row; the header goes out before the first value of the first row
+		const Column &nextColumn(ColumnType type)
+		{
+			writeHeader();
+			assert(mColumn < mColumns.size() && mColumns[mColumn].mType == type);
+			if (mColumn)
+			{
+				reserve(1);
+				mBuffer[mLength++] = ',';
+			}
+			return mColumns[mColumn++];
+		}
+
+		void writeHeader(void)
+		{
+			if (mHeaderWritten)
+			{
+				return;
+			}
+			mHeaderWritten = true;
+			for (size_t i = 0; i < mColumns.size(); i++)
+			{
+				if (i)
+				{
+					reserve(1);
+					mBuffer[mLength++] = ',';
+				}
+				writeField(mColumns[i].mName.c_str());
+			}
+			reserve(1);
+			mBuffer[mLength++] = '\n';
+		}
+
+		// Text is quoted if it contains a comma or a quote
+		void writeField(const char *text)
+		{
+			size_t length = strlen(text);
+			bool quote = strpbrk(text, ",\"") != nullptr;
+			reserve(uint32_t(length * 2 + 2));
+			if (!quote)
+			{
+				memcpy(&mBuffer[mLength], text, length);
+				mLength += length;
+				return;
+			}
+			mBuffer[mLength++] = '"';
+			for (size_t i = 0; i < length; i++)
+			{
+				if (text[i] == '"')
+				{
+					mBuffer[mLength++] = '"';
+				}
+				mBuffer[mLength++] = text[i];
+			}
+			mBuffer[mLength++] = '"';
+		}
+
+		// Writes 'value' with at least 'minimumDigits' digits, padding with leading zeros
+		void writeInteger(uint64_t value, uint32_t minimumDigits)
+		{
+			char digits[24];
+			uint32_t count = 0;
+			do
+			{
+				digits[count++] = char('0' + value % 10);
+				value /= 10;
+			} while (value);
+			while (count < minimumDigits)
+			{
+				digits[count++] = '0';
+			}
+			while (count)
+			{
+				mBuffer[mLength++] = digits[--count];
+			}
+		}
+
+		// Writes 'value' / 10^decimals with exactly 'decimals' digits after the decimal point
+		void writeFixed(uint64_t value, uint32_t decimals)
+		{
+			if (decimals == 0)
+			{
+				writeInteger(value, 0);
+				return;
+			}
+			writeInteger(value / powersOfTen[decimals], 0);
+			mBuffer[mLength++] = '.';
+			writeInteger(value % powersOfTen[decimals], decimals);
+		}
+
+		// Makes sure there is room for 'length' more characters
+		void reserve(uint32_t length)
+		{
+			if (mLength + length > mBuffer.size())
+			{
+				flush();
+				if (length > mBuffer.size())
+				{
+					mBuffer.resize(length);
+				}
+			}
+		}
+
+		void flush(void)
+		{
+			if (mLength)
+			{
+				if (fwrite(&mBuffer[0], 1, mLength, mFile) != mLength)
+				{
+					mFailed = true;
+				}
+				mLength = 0;
+			}
+		}
+
+		// Returns false if any of the report could not be written
+		bool close(void)
+		{
+			if (mFile == nullptr)
+			{
+				return true;
+			}
+			writeHeader();
+			flush();
+			if (fclose(mFile) != 0)
+			{
+				mFailed = true;
+			}
+			mFile = nullptr;
+			if (mFailed)
+			{
+				logMessage("Failed to write the report file '%s'\n", mFileName.c_str());
+			}
+			return !mFailed;
+		}
+
+		FILE					*mFile;
+		std::string				mFileName;
+		std::vector< char >		mBuffer;
+		size_t					mLength;			// Characters waiting in mBuffer
+		ColumnVector			mColumns;
+		size_t					mColumn;			// The column the next value goes in
+		bool					mHeaderWritten;
+		bool					mFailed;			// A write to the file failed
+		std::vector< char >		mDates;				// yyyy-mm-dd for each day since 1970 formatted so far; zero if not yet
+	};
+
+	// Holds one of the arrays of a columnar file in a temporary file until the report is closed; writes to it are
+	// gathered into a small buffer, so a report never needs more memory than that per array however many rows it has
+	class ColumnStream
+	{
+	public:
+		ColumnStream(void) : mFile(nullptr)
+			, mLength(0)
+			, mFailed(false)
+		{
+		}
+
+		// The temporary file is only created once the buffer first fills up
+		void append(const void *data, size_t length)
+		{
+			if (mBuffer.size() + length > REPORT_WRITER_COLUMN_BUFFER_SIZE)
+			{
+				flush();
+			}
+			const uint8_t *bytes = static_cast<const uint8_t *>(data);
+			mBuffer.insert(mBuffer.end(), bytes, bytes + length);
+			mLength += length;
+		}
+
+		// Copies everything appended onto the end of 'fph'
+		bool copyTo(FILE *fph)
+		{
+			if (mFile)
+			{
+				flush();
+				if (mFailed || fseek(mFile, 0, SEEK_SET) != 0)
+				{
+					return false;
+				}
+				std::vector< uint8_t > buffer(REPORT_WRITER_COLUMN_BUFFER_SIZE);
+				for (uint64_t remaining = mLength; remaining;)
+				{
+					size_t length = size_t(remaining < buffer.size() ? remaining : buffer.size());
+					if (fread(&buffer[0], 1, length, mFile) != length || fwrite(&buffer[0], 1, length, fph) != length)
+					{
+						return false;
+					}
+					remaining -= length;
+				}
+				return true;
+			}
+			return mBuffer.empty() || fwrite(&mBuffer[0], 1, mBuffer.size(), fph) == mBuffer.size();
+		}
+
+		// Closes and deletes the temporary file
+		void close(void)
+		{
+			if (mFile)
+			{
+				fclose(mFile);
+				remove(mFileName.c_str());
+				mFile = nullptr;
+			}
+		}
+
+		std::string				mFileName;		// The temporary file, if it is needed
+		FILE					*mFile;
+		std::vector< uint8_t >	mBuffer;		// Appended and not yet written to the temporary file
+		uint64_t				mLength;		// Total bytes appended
+		bool					mFailed;
+
+	private:
+		void flush(void)
+		{
+			if (mBuffer.empty() || mFailed)
+			{
+				return;
+			}
+			if (mFile == nullptr)
+			{
+				mFile = fopen(mFileName.c_str(), "wb+");
+			}
+			if (mFile == nullptr || fwrite(&mBuffer[0], 1, mBuffer.size(), mFile) != mBuffer.size())
+			{
+				mFailed = true;
+			}
+			mBuffer.clear();
+		}
+	};
+
+	// Each column's values, and text for CT_TEXT, are streamed to their own temporary file, and these are copied
+	// into place when the report is released
+	class ColumnData : public Column
+	{
+	public:
+		ColumnStream	mValues;
+		ColumnStream	mText;			// CT_TEXT only; mValues holds the offset of each row's text in here
+	};
+
+	typedef std::vector< ColumnData > ColumnDataVector;
+
+	class ReportWriterColumns : public ReportWriter
+	{
+	public:
+		ReportWriterColumns(FILE *fph, const std::string &fileName) : mFile(fph)
+			, mFileName(fileName)
+			, mColumn(0)
+			, mRowCount(0)
+		{
+		}
+
+		virtual ~ReportWriterColumns(void)
+		{
+			close();
+		}
+
+		virtual void addColumn(const char *name, ColumnType type, uint32_t decimals) override final
+		{
+			assert(mRowCount == 0 && mColumn == 0);
+			ColumnData c;
+			c.mName = name;
+			c.mType = type;
+			c.mDecimals = decimals;
+			char suffix[64];
+			snprintf(suffix, sizeof(suffix), ".%u.values", uint32_t(mColumns.size()));
+			c.mValues.mFileName = mFileName + suffix;
+			snprintf(suffix, sizeof(suffix), ".%u.text", uint32_t(mColumns.size()));
+			c.mText.mFileName = mFileName + suffix;
+			mColumns.push_back(c);
+			if (type == CT_TEXT)
+			{
+				append(mColumns.back(), uint64_t(0));
+			}
+		}
+
+		virtual void writeText(const char *text) override final
+		{
+			ColumnData &c = nextColumn(CT_TEXT);
+			c.mText.append(text, strlen(text));
+			append(c, c.mText.mLength);
+		}
+
+		virtual void writeDate(uint32_t timeStamp) override final
+		{
+			append(nextColumn(CT_DATE), timeStamp);
+		}
+
+		virtual void writeCount(uint64_t count) override final
+		{
+			append(nextColumn(CT_COUNT), count);
+		}
+
+		virtual void writeSatoshis(uint64_t satoshis) override final
+		{
+			append(nextColumn(CT_BTC), satoshis);
+		}
+
+		virtual void writeReal(double value) override final
+		{
+			append(nextColumn(CT_REAL), value);
+		}
+
+		virtual void endRow(void) override final
+		{
+			assert(mColumn == mColumns.size());
+			mColumn = 0;
+			mRowCount++;
+		}
+
+		virtual bool release(void) override final
+		{
+			bool ret = close();
+			delete this;
+			return ret;
+		}
+
+	private:
+		ColumnData &nextColumn(ColumnType type)
+		{
+			assert(mColumn < mColumns.size() && mColumns[mColumn].mType == type);
+			return mColumns[mColumn++];
+		}
+
+		// Values are stored in the byte order of the host, which is little endian on every platform this builds for
+		template <class T> void append(ColumnData &c, T value)
+		{
+			c.mValues.append(&value, sizeof(T));
+		}
+
+		uint64_t align(uint64_t offset)
+		{
+			return (offset + COLUMN_ALIGNMENT - 1) & ~(COLUMN_ALIGNMENT - 1);
+		}
+
+		// Pads the file out to 'offset' with zeros
+		bool padTo(uint64_t &position, uint64_t offset)
+		{
+			static const uint8_t zeros[COLUMN_ALIGNMENT] = { 0 };
+			while (position < offset)
+			{
+				uint64_t pad = offset - position < COLUMN_ALIGNMENT ? offset - position : COLUMN_ALIGNMENT;
+				if (fwrite(zeros, 1, size_t(pad), mFile) != size_t(pad))
+				{
+					return false;
+				}
+				position += pad;
+			}
+			return true;
+		}
+
+		// Writes the file and deletes the temporary ones; returns false if any of it could not be written
+		bool close(void)
+		{
+			if (mFile == nullptr)
+			{
+				return true;
+			}
+			bool ret = writeFile();
+			for (auto i = mColumns.begin(); i != mColumns.end(); ++i)
+			{
+				(*i).mValues.close();
+				(*i).mText.close();
+			}
+			if (fclose(mFile) != 0)
+			{
+				ret = false;
+			}
+			mFile = nullptr;
+			if (!ret)
+			{
+				logMessage("Failed to write the report file '%s'\n", mFileName.c_str());
+			}
+			return ret;
+		}
+
+		bool writeFile(void)
+		{
+			assert(mColumn == 0);
+			ColumnFileHeader header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.mMagic, "B21COLS", 8);
+			header.mVersion = COLUMN_FILE_VERSION;
+			header.mColumnCount = uint32_t(mColumns.size());
+			header.mRowCount = mRowCount;
+
+			// Lay out every array on its own page boundary, after the schema
+			std::vector< ColumnFileColumn > schema(mColumns.size());
+			uint64_t offset = sizeof(ColumnFileHeader) + sizeof(ColumnFileColumn) * schema.size();
+			for (size_t i = 0; i < mColumns.size(); i++)
+			{
+				const ColumnData &c = mColumns[i];
+				ColumnFileColumn &s = schema[i];
+				memset(&s, 0, sizeof(s));
+				strncpy(s.mName, c.mName.c_str(), COLUMN_NAME_LENGTH - 1);
+				s.mType = c.mType;
+				s.mDecimals = c.mDecimals;
+				s.mDataOffset = align(offset);
+				s.mDataLength = c.mValues.mLength;
+				offset = s.mDataOffset + s.mDataLength;
+				if (c.mType == CT_TEXT)
+				{
+					s.mTextOffset = align(offset);
+					s.mTextLength = c.mText.mLength;
+					offset = s.mTextOffset + s.mTextLength;
+				}
+			}
+
+			if (fwrite(&header, sizeof(header), 1, mFile) != 1 || (!schema.empty() && fwrite(&schema[0], sizeof(ColumnFileColumn) * schema.size(), 1, mFile) != 1))
+			{
+				return false;
+			}
+			uint64_t position = sizeof(ColumnFileHeader) + sizeof(ColumnFileColumn) * schema.size();
+			for (size_t i = 0; i < mColumns.size(); i++)
+			{
+				ColumnData &c = mColumns[i];
+				const ColumnFileColumn &s = schema[i];
+				if (!padTo(position, s.mDataOffset) || !c.mValues.copyTo(mFile))
+				{
+					return false;
+				}
+				position += s.mDataLength;
+				if (c.mType == CT_TEXT)
+				{
+					if (!padTo(position, s.mTextOffset) || !c.mText.copyTo(mFile))
+					{
+						return false;
+					}
+					position += s.mTextLength;
+				}
+			}
+			return true;
+		}
+
+		FILE				*mFile;
+		std::string			mFileName;
+		ColumnDataVector	mColumns;
+		size_t				mColumn;			// The column the next value goes in
+		uint64_t			mRowCount;
+	};
+
+} // end of REPORT_WRITER namespace
+
+ReportWriter *ReportWriter::create(const char *fileName, Format format)
+{
+	std::string name = fileName;
+	if (format == RF_COLUMNS)
+	{
+		size_t dot = name.find_last_of('.');
+		size_t slash = name.find_last_of("/\\");
+		if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+		{
+			name.resize(dot);
+		}
+		name += ".columns";
+	}
+	FILE *fph = fopen(name.c_str(), "wb");
+	if (fph == nullptr)
+	{
+		logMessage("Failed to open report file '%s' for write access\n", name.c_str());
+		return nullptr;
+	}
+	ReportWriter *ret = nullptr;
+	if (format == RF_COLUMNS)
+	{
+		ret = static_cast<ReportWriter *>(new REPORT_WRITER::ReportWriterColumns(fph, name));
+	}
+	else
+	{
+		ret = static_cast<ReportWriter *>(new REPORT_WRITER::ReportWriterCSV(fph, name));
+	}
+	return ret;
+}
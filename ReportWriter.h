@@ -0,0 +1,93 @@
+#ifndef REPORT_WRITER_H
+
+#define REPORT_WRITER_H
+
+#include <stdint.h>
+
+// Writes a report.  The columns are declared up front, then each row is written one value per column in the same
+// order, followed by endRow.
+//
+// RF_CSV writes a CSV file.  Values are formatted straight into a large output buffer without going through printf;
+// satoshi amounts are formatted as BTC using integer arithmetic, and dates are formatted once per day.
+//
+// RF_COLUMNS writes the same report as a self describing columnar binary file which can be memory mapped and used in
+// place.  It starts with a ColumnFileHeader followed by one ColumnFileColumn per column, and each column's values are
+// stored as one contiguous little endian array starting on a COLUMN_FILE_ALIGNMENT boundary:
+//
+//		CT_TEXT		(rowCount+1) uint64 offsets into the column's text, which follows separately (not zero terminated)
+//		CT_DATE		uint32 unix time stamps
+//		CT_COUNT	uint64
+//		CT_BTC		uint64 satoshis; 'decimals' is only a hint for displaying them
+//		CT_REAL		double
+class ReportWriter
+{
+public:
+	enum Format
+	{
+		RF_CSV,
+		RF_COLUMNS
+	};
+
+	enum ColumnType
+	{
+		CT_TEXT,			// writeText
+		CT_DATE,			// writeDate; a unix time stamp written as yyyy-mm-dd
+		CT_COUNT,			// writeCount; an unsigned integer
+		CT_BTC,				// writeSatoshis; an amount in satoshis written in BTC
+		CT_REAL				// writeReal
+	};
+
+	enum
+	{
+		COLUMN_FILE_VERSION = 1,
+		COLUMN_FILE_ALIGNMENT = 4096,
+		COLUMN_NAME_LENGTH = 64
+	};
+
+	class ColumnFileHeader
+	{
+	public:
+		char		mMagic[8];				// "B21COLS"
+		uint32_t	mVersion;				// COLUMN_FILE_VERSION
+		uint32_t	mColumnCount;
+		uint64_t	mRowCount;
+	};
+
+	class ColumnFileColumn
+	{
+	public:
+		char		mName[COLUMN_NAME_LENGTH];	// Zero terminated
+		uint32_t	mType;					// ColumnType
+		uint32_t	mDecimals;
+		uint64_t	mDataOffset;			// Where the values start in the file
+		uint64_t	mDataLength;			// Bytes of values
+		uint64_t	mTextOffset;			// CT_TEXT only; where the text starts in the file
+		uint64_t	mTextLength;
+	};
+
+	// Creates the report file; returns nullptr (and logs why) if it can't.  RF_COLUMNS replaces the extension of
+	// 'fileName' with '.columns'.
+	static ReportWriter *create(const char *fileName,Format format=RF_CSV);
+
+	// Declares the next column.  'decimals' is how many digits to write after the decimal point for CT_BTC and CT_REAL.
+	virtual void addColumn(const char *name,ColumnType type,uint32_t decimals=6) = 0;
+
+	virtual void writeText(const char *text) = 0;
+	virtual void writeDate(uint32_t timeStamp) = 0;
+	virtual void writeCount(uint64_t count) = 0;
+	virtual void writeSatoshis(uint64_t satoshis) = 0;
+	virtual void writeReal(double value) = 0;
+
+	// Ends the current row; every column must have been written
+	virtual void endRow(void) = 0;
+
+	// Flushes and closes the file.  Returns false (and logs why) if any of the report could not be written.
+	virtual bool release(void) = 0;
+
+protected:
+	virtual ~ReportWriter(void)
+	{
+	}
+};
+
+#endif
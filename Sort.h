@@ -0,0 +1,263 @@
+#ifndef SORT_H
+
+#define SORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+#include "ThreadPool.h"
+
+// Sorting routines templated on the element type and the comparator, so every comparison is inlined at the call site
+// rather than being a virtual call.  'less(a,b)' returns true if 'a' sorts before 'b'.
+namespace SORT
+{
+	const size_t INSERTION_SORT_THRESHOLD = 16;			// Ranges this short are finished off with an insertion sort
+	const size_t PARALLEL_SORT_MIN_COUNT = 65536;		// Fewest elements worth handing to each thread of a parallel sort
+
+	template <typename T, typename Less>
+	void insertionSort(T *data, size_t count, Less &less)
+	{
+		for (size_t i = 1; i < count; i++)
+		{
+			T value = data[i];
+			size_t j = i;
+			while (j > 0 && less(value, data[j - 1]))
+			{
+				data[j] = data[j - 1];
+				j--;
+			}
+			data[j] = value;
+		}
+	}
+
+	template <typename T, typename Less>
+	void siftDown(T *data, size_t root, size_t count, Less &less)
+	{
+		for (;;)
+		{
+			size_t child = root * 2 + 1;
+			if (child >= count)
+			{
+				break;
+			}
+			if (child + 1 < count && less(data[child], data[child + 1]))
+			{
+				child++;
+			}
+			if (!less(data[root], data[child]))
+			{
+				break;
+			}
+			std::swap(data[root], data[child]);
+			root = child;
+		}
+	}
+
+	template <typename T, typename Less>
+	void heapSort(T *data, size_t count, Less &less)
+	{
+		if (count < 2)
+		{
+			return;
+		}
+		for (size_t i = count / 2; i-- > 0;)
+		{
+			siftDown(data, i, count, less);
+		}
+		for (size_t last = count - 1; last > 0; last--)
+		{
+			std::swap(data[0], data[last]);
+			siftDown(data, 0, last, less);
+		}
+	}
+
+	// Moves the median of a, b and c into 'result'
+	template <typename T, typename Less>
+	void moveMedianToFirst(T *result, T *a, T *b, T *c, Less &less)
+	{
+		if (less(*a, *b))
+		{
+			if (less(*b, *c))
+			{
+				std::swap(*result, *b);
+			}
+			else if (less(*a, *c))
+			{
+				std::swap(*result, *c);
+			}
+			else
+			{
+				std::swap(*result, *a);
+			}
+		}
+		else if (less(*a, *c))
+		{
+			std::swap(*result, *a);
+		}
+		else if (less(*b, *c))
+		{
+			std::swap(*result, *c);
+		}
+		else
+		{
+			std::swap(*result, *b);
+		}
+	}
+
+	// Partitions [first,last) around 'pivot'; which must lie outside of the range.  The median of three guarantees there
+	// are elements on both sides which stop the scans, so they need no bounds checks.
+	template <typename T, typename Less>
+	T *unguardedPartition(T *first, T *last, const T &pivot, Less &less)
+	{
+		for (;;)
+		{
+			while (less(*first, pivot))
+			{
+				++first;
+			}
+			--last;
+			while (less(pivot, *last))
+			{
+				--last;
+			}
+			if (!(first < last))
+			{
+				return first;
+			}
+			std::swap(*first, *last);
+			++first;
+		}
+	}
+
+	template <typename T, typename Less>
+	void introSortLoop(T *data, size_t count, uint32_t depthLimit, Less &less)
+	{
+		while (count > INSERTION_SORT_THRESHOLD)
+		{
+			if (depthLimit == 0)
+			{
+				heapSort(data, count, less);	// Quicksort is going quadratic on this input
+				return;
+			}
+			depthLimit--;
+			moveMedianToFirst(data, data + 1, data + count / 2, data + count - 1, less);
+			T *cut = unguardedPartition(data + 1, data + count, *data, less);
+			size_t leftCount = size_t(cut - data);
+			introSortLoop(cut, count - leftCount, depthLimit, less);
+			count = leftCount;
+		}
+		insertionSort(data, count, less);
+	}
+
+	// Introsort; quicksort with a median of three pivot which falls back to heapsort if it recurses too deeply.  Not stable.
+	template <typename T, typename Less>
+	void introSort(T *data, size_t count, Less less)
+	{
+		uint32_t depthLimit = 0;
+		for (size_t c = count; c > 1; c >>= 1)
+		{
+			depthLimit += 2;
+		}
+		introSortLoop(data, count, depthLimit, less);
+	}
+
+	// Stable LSD radix sort, smallest key first, where 'key(element)' returns an unsigned integer (uint32_t or uint64_t).
+	// 'scratch' is resized to match and the result ends up back in 'data'.  A pass where every element has the same
+	// digit is skipped, so keys which only use their low bits cost fewer passes.
+	template <typename T, typename Key>
+	void radixSort(std::vector< T > &data, std::vector< T > &scratch, Key key)
+	{
+		typedef typename std::decay< decltype(key(data[0])) >::type KeyType;
+		const uint32_t RADIX_BITS = 11;
+		const uint32_t RADIX_SIZE = 1 << RADIX_BITS;
+		size_t count = data.size();
+		if (count < 2)
+		{
+			return;
+		}
+		scratch.resize(count);
+		std::vector< size_t > buckets(RADIX_SIZE);
+		for (uint32_t shift = 0; shift < sizeof(KeyType) * 8; shift += RADIX_BITS)
+		{
+			std::fill(buckets.begin(), buckets.end(), 0);
+			for (size_t i = 0; i < count; i++)
+			{
+				buckets[(key(data[i]) >> shift) & (RADIX_SIZE - 1)]++;
+			}
+			if (buckets[(key(data[0]) >> shift) & (RADIX_SIZE - 1)] == count)
+			{
+				continue;
+			}
+			size_t total = 0;
+			for (uint32_t i = 0; i < RADIX_SIZE; i++)
+			{
+				size_t c = buckets[i];
+				buckets[i] = total;
+				total += c;
+			}
+			for (size_t i = 0; i < count; i++)
+			{
+				scratch[buckets[(key(data[i]) >> shift) & (RADIX_SIZE - 1)]++] = data[i];
+			}
+			data.swap(scratch);
+		}
+	}
+
+	// Sorts large arrays across the threads of 'pool'.  Each thread introsorts one chunk and then the sorted chunks are
+	// merged pairwise, each round of merges also running in parallel.  Small arrays are simply introsorted.
+	template <typename T, typename Less>
+	void parallelMergeSort(T *data, size_t count, Less less, ThreadPool *pool)
+	{
+		size_t chunks = pool ? pool->getThreadCount() : 1;
+		if (chunks > count / PARALLEL_SORT_MIN_COUNT)
+		{
+			chunks = count / PARALLEL_SORT_MIN_COUNT;
+		}
+		if (chunks < 2)
+		{
+			introSort(data, count, less);
+			return;
+		}
+		std::vector< size_t > bounds;
+		for (size_t i = 0; i <= chunks; i++)
+		{
+			bounds.push_back(count * i / chunks);
+		}
+		pool->parallelFor(uint32_t(chunks), [&](uint32_t c)
+		{
+			introSort(data + bounds[c], bounds[c + 1] - bounds[c], less);
+		});
+
+		std::vector< T > scratch(count);
+		T *source = data;
+		T *dest = &scratch[0];
+		while (bounds.size() > 2)
+		{
+			size_t runs = bounds.size() - 1;
+			pool->parallelFor(uint32_t((runs + 1) / 2), [&](uint32_t p)
+			{
+				size_t first = bounds[p * 2];
+				size_t middle = bounds[std::min(size_t(p) * 2 + 1, runs)];
+				size_t last = bounds[std::min(size_t(p) * 2 + 2, runs)];
+				std::merge(source + first, source + middle, source + middle, source + last, dest + first, less);
+			});
+			std::vector< size_t > merged;
+			for (size_t i = 0; i < runs; i += 2)
+			{
+				merged.push_back(bounds[i]);
+			}
+			merged.push_back(count);
+			bounds.swap(merged);
+			std::swap(source, dest);
+		}
+		if (source != data)
+		{
+			std::copy(source, source + count, data);
+		}
+	}
+}
+
+#endif
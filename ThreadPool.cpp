@@ -0,0 +1,125 @@
+#include "ThreadPool.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <vector>
+
+namespace THREAD_POOL
+{
+
+	class ThreadPoolImpl : public ThreadPool
+	{
+	public:
+		ThreadPoolImpl(uint32_t threadCount) : mPending(0)
+			, mExit(false)
+		{
+			if (threadCount == 0)
+			{
+				threadCount = getHardwareThreadCount();
+			}
+			for (uint32_t i = 0; i < threadCount; i++)
+			{
+				mThreads.push_back(std::thread([this]() { workerThread(); }));
+			}
+		}
+
+		virtual ~ThreadPoolImpl(void)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mExit = true;
+			}
+			mWork.notify_all();
+			for (auto i = mThreads.begin(); i != mThreads.end(); ++i)
+			{
+				(*i).join();
+			}
+		}
+
+		virtual uint32_t getThreadCount(void) const override final
+		{
+			return uint32_t(mThreads.size());
+		}
+
+		virtual void addTask(std::function<void(void)> task) override final
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mTasks.push(task);
+				mPending++;
+			}
+			mWork.notify_one();
+		}
+
+		virtual void waitForTasks(void) override final
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mDone.wait(lock, [this]() { return mPending == 0; });
+		}
+
+		virtual void parallelFor(uint32_t count, std::function<void(uint32_t)> task) override final
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				addTask([task, i]() { task(i); });
+			}
+			waitForTasks();
+		}
+
+		virtual void release(void) override final
+		{
+			delete this;
+		}
+
+	private:
+		void workerThread(void)
+		{
+			for (;;)
+			{
+				std::function<void(void)> task;
+				{
+					std::unique_lock<std::mutex> lock(mMutex);
+					mWork.wait(lock, [this]() { return mExit || !mTasks.empty(); });
+					if (mTasks.empty())
+					{
+						return; // only exit once the queue has drained
+					}
+					task = mTasks.front();
+					mTasks.pop();
+				}
+				task();
+				{
+					std::lock_guard<std::mutex> lock(mMutex);
+					mPending--;
+					if (mPending == 0)
+					{
+						mDone.notify_all();
+					}
+				}
+			}
+		}
+
+		std::vector< std::thread >					mThreads;
+		std::queue< std::function<void(void)> >		mTasks;
+		std::mutex									mMutex;
+		std::condition_variable						mWork;		// Signalled when a task is queued (or the pool is shutting down)
+		std::condition_variable						mDone;		// Signalled when the last outstanding task completes
+		uint32_t									mPending;	// Tasks queued or running
+		bool										mExit;
+	};
+
+} // end of THREAD_POOL namespace
+
+ThreadPool *ThreadPool::create(uint32_t threadCount)
+{
+	THREAD_POOL::ThreadPoolImpl *ret = new THREAD_POOL::ThreadPoolImpl(threadCount);
+	return static_cast<ThreadPool *>(ret);
+}
+
+uint32_t ThreadPool::getHardwareThreadCount(void)
+{
+	uint32_t ret = std::thread::hardware_concurrency();
+	return ret ? ret : 1;
+}
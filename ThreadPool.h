@@ -0,0 +1,39 @@
+#ifndef THREAD_POOL_H
+
+#define THREAD_POOL_H
+
+#include <stdint.h>
+#include <functional>
+
+// A fixed set of worker threads which run tasks handed to them.
+// Used to spread the heavier database builds and queries across all of the available cores.
+class ThreadPool
+{
+public:
+	// Creates a pool with this many worker threads; zero means one per hardware thread
+	static ThreadPool *create(uint32_t threadCount);
+
+	// Returns the number of hardware threads available on this machine (at least one)
+	static uint32_t getHardwareThreadCount(void);
+
+	// Number of worker threads in the pool
+	virtual uint32_t getThreadCount(void) const = 0;
+
+	// Queues a task to be run on one of the worker threads
+	virtual void addTask(std::function<void(void)> task) = 0;
+
+	// Blocks until every task queued so far has completed
+	virtual void waitForTasks(void) = 0;
+
+	// Runs task(index) for every index in [0,count) across the worker threads and waits for all of them to finish
+	virtual void parallelFor(uint32_t count, std::function<void(uint32_t)> task) = 0;
+
+	virtual void release(void) = 0;
+
+protected:
+	virtual ~ThreadPool(void)
+	{
+	}
+};
+
+#endif
@@ -9,6 +9,7 @@
 #include "RIPEMD160.h"
 
 #include "PublicKeyDatabase.h"
+#include "QueryServer.h"
 
 
 #ifdef WIN32
@@ -27,6 +28,26 @@ int main(int argc,const char **argv)
 	const char *dataPath = ".";
 	searchForTextLength = 0;
 	bool rebuildPublicKeyDatabase = false;
+	bool resume = false;
+	uint32_t memoryBudget = 0;
+	uint32_t threadCount = 0;
+	bool buildSnapshots = false;
+	PublicKeyDatabase::SnapshotInterval snapshotInterval = PublicKeyDatabase::SI_MONTHLY;
+	const char *balancesAt = nullptr;
+	uint32_t balancesAtTime = 0;
+	bool sortKeys = false;
+	PublicKeyDatabase::KeyOrder keyOrder = PublicKeyDatabase::KO_BALANCE;
+	const char *keyOrderName = nullptr;
+	const char *address = nullptr;
+	const char *serveSocket = nullptr;
+	const char *queryFile = nullptr;
+	const char *queryOutput = "AddressQuery.csv";
+	bool addressSummary = false;
+	bool reportByAge = false;
+	bool keysByAge = false;
+	bool clusters = false;
+	bool ingestReports = false;
+	ReportWriter::Format reportFormat = ReportWriter::RF_CSV;
 	int i = 1;
 	while ( i < argc )
 	{
@@ -62,6 +83,202 @@ int main(int argc,const char **argv)
 			{
 				rebuildPublicKeyDatabase = true;
 			}
+			else if (strcmp(option, "-resume") == 0)
+			{
+				resume = true;
+			}
+			else if (strcmp(option, "-memory_budget") == 0)
+			{
+				i++;
+				if (i < argc)
+				{
+					memoryBudget = atoi(argv[i]);
+					if (memoryBudget < 1)
+					{
+						printf("Invalid memory_budget value '%s'\n", argv[i]);
+						memoryBudget = 0;
+					}
+					else
+					{
+						printf("Memory budget set to %d MB\r\n", memoryBudget);
+					}
+				}
+				else
+				{
+					printf("Error parsing option '-memory_budget', missing size in megabytes.\n");
+				}
+			}
+			else if (strcmp(option, "-threads") == 0)
+			{
+				i++;
+				if (i < argc)
+				{
+					threadCount = atoi(argv[i]);
+					printf("Thread count set to %d\r\n", threadCount);
+				}
+				else
+				{
+					printf("Error parsing option '-threads', missing thread count.\n");
+				}
+			}
+			else if (strcmp(option, "-snapshots") == 0)
+			{
+				i++;
+				if (i < argc)
+				{
+					buildSnapshots = true;
+					if (strcmp(argv[i], "daily") == 0)
+					{
+						snapshotInterval = PublicKeyDatabase::SI_DAILY;
+					}
+					else if (strcmp(argv[i], "weekly") == 0)
+					{
+						snapshotInterval = PublicKeyDatabase::SI_WEEKLY;
+					}
+					else if (strcmp(argv[i], "monthly") == 0)
+					{
+						snapshotInterval = PublicKeyDatabase::SI_MONTHLY;
+					}
+					else
+					{
+						printf("Invalid snapshots interval '%s'; expected daily, weekly or monthly\n", argv[i]);
+						buildSnapshots = false;
+					}
+				}
+				else
+				{
+					printf("Error parsing option '-snapshots', missing interval.\n");
+				}
+			}
+			else if (strcmp(option, "-balances_at") == 0)
+			{
+				i++;
+				if (i < argc)
+				{
+					uint32_t year, month, day;
+					if (sscanf(argv[i], "%u-%u-%u", &year, &month, &day) == 3 && month >= 1 && month <= 12 && day >= 1 && day <= 31)
+					{
+						struct tm date;
+						memset(&date, 0, sizeof(date));
+						date.tm_year = year - 1900;
+						date.tm_mon = month - 1;
+						date.tm_mday = day;
+						balancesAt = argv[i];
+						balancesAtTime = uint32_t(_mkgmtime(&date)) + (60 * 60 * 24 - 1);	// the balances at the end of that day
+					}
+					else
+					{
+						printf("Invalid balances_at date '%s'; expected yyyy-mm-dd\n", argv[i]);
+					}
+				}
+				else
+				{
+					printf("Error parsing option '-balances_at', missing date.\n");
+				}
+			}
+			else if (strcmp(option, "-sort_keys") == 0)
+			{
+				i++;
+				if (i < argc)
+				{
+					sortKeys = true;
+					keyOrderName = argv[i];
+					if (strcmp(argv[i], "balance") == 0)
+					{
+						keyOrder = PublicKeyDatabase::KO_BALANCE;
+					}
+					else if (strcmp(argv[i], "age") == 0)
+					{
+						keyOrder = PublicKeyDatabase::KO_AGE;
+					}
+					else if (strcmp(argv[i], "transactions") == 0)
+					{
+						keyOrder = PublicKeyDatabase::KO_TRANSACTION_COUNT;
+					}
+					else
+					{
+						printf("Invalid sort_keys order '%s'; expected balance, age or transactions\n", argv[i]);
+						sortKeys = false;
+					}
+				}
+				else
+				{
+					printf("Error parsing option '-sort_keys', missing order.\n");
+				}
+			}
+			else if (strcmp(option, "-address") == 0)
+			{
+				i++;
+				if (i < argc)
+				{
+					address = argv[i];
+				}
+				else
+				{
+					printf("Error parsing option '-address', missing bitcoin address.\n");
+				}
+			}
+			else if (strcmp(option, "-serve") == 0)
+			{
+				i++;
+				if (i < argc)
+				{
+					serveSocket = argv[i];
+				}
+				else
+				{
+					printf("Error parsing option '-serve', missing socket name.\n");
+				}
+			}
+			else if (strcmp(option, "-query_file") == 0)
+			{
+				i++;
+				if (i < argc)
+				{
+					queryFile = argv[i];
+				}
+				else
+				{
+					printf("Error parsing option '-query_file', missing file name.\n");
+				}
+			}
+			else if (strcmp(option, "-out") == 0)
+			{
+				i++;
+				if (i < argc)
+				{
+					queryOutput = argv[i];
+				}
+				else
+				{
+					printf("Error parsing option '-out', missing file name.\n");
+				}
+			}
+			else if (strcmp(option, "-address_summary") == 0)
+			{
+				addressSummary = true;
+			}
+			else if (strcmp(option, "-by_age") == 0)
+			{
+				reportByAge = true;
+			}
+			else if (strcmp(option, "-keys_by_age") == 0)
+			{
+				reportByAge = true;
+				keysByAge = true;
+			}
+			else if (strcmp(option, "-clusters") == 0)
+			{
+				clusters = true;
+			}
+			else if (strcmp(option, "-ingest_reports") == 0)
+			{
+				ingestReports = true;
+			}
+			else if (strcmp(option, "-columns") == 0)
+			{
+				reportFormat = ReportWriter::RF_COLUMNS;
+			}
 			else if (strcmp(option, "-text") == 0)
 			{
 				i++;
@@ -103,9 +320,15 @@ int main(int argc,const char **argv)
 		i++;
 	}
 
-	PublicKeyDatabase *p = PublicKeyDatabase::create(analyze);
+	PublicKeyDatabase *p = PublicKeyDatabase::create(analyze,resume);
 	if (p)
 	{
+		if (memoryBudget)
+		{
+			p->setMemoryBudget(uint64_t(memoryBudget) * 1024 * 1024);
+		}
+		p->setThreadCount(threadCount);
+		p->setReportFormat(reportFormat);
 		if (analyze)
 		{
 			if (rebuildPublicKeyDatabase)
@@ -113,6 +336,62 @@ int main(int argc,const char **argv)
 				printf("Rebuilding the public-key database.\r\n");
 				p->buildPublicKeyDatabase();
 			}
+			else if (serveSocket)
+			{
+				QueryServer *server = QueryServer::create(p, serveSocket, threadCount);
+				if (server)
+				{
+					server->run();
+					server->release();
+				}
+			}
+			else if (buildSnapshots || balancesAt || sortKeys || address || queryFile || addressSummary || reportByAge || clusters)
+			{
+				if (address)
+				{
+					uint32_t index = p->lookupPublicKey(address);
+					if (index == 0xFFFFFFFF)
+					{
+						printf("Address '%s' was not found in the public key database.\n", address);
+					}
+					else
+					{
+						p->printPublicKey(index);
+					}
+				}
+				if (queryFile)
+				{
+					p->reportAddressQueries(queryFile, queryOutput, balancesAt ? balancesAtTime : 0xFFFFFFFF);
+				}
+				if (buildSnapshots)
+				{
+					p->buildBalanceSnapshots(snapshotInterval);
+				}
+				if (addressSummary)
+				{
+					p->reportAddressSummaries("AddressSummary.csv", balancesAt ? balancesAtTime : 0xFFFFFFFF);
+				}
+				if (reportByAge)
+				{
+					p->reportByAge("ByAge.csv", keysByAge ? "KeysByAge.csv" : nullptr, balancesAt ? balancesAtTime : 0xFFFFFFFF);
+				}
+				if (clusters)
+				{
+					p->reportClusterBalances("TopClusters.csv", 50000, balancesAt ? balancesAtTime : 0xFFFFFFFF);
+				}
+				if (balancesAt)
+				{
+					char reportName[512];
+					snprintf(reportName, sizeof(reportName), "TopBalances-%s.csv", balancesAt);
+					p->reportTopBalances(reportName, 50000, balancesAtTime);
+				}
+				if (sortKeys)
+				{
+					char reportName[512];
+					snprintf(reportName, sizeof(reportName), "KeysBy-%s.csv", keyOrderName);
+					p->reportSortedKeys(reportName, 50000, keyOrder, balancesAt ? balancesAtTime : 0xFFFFFFFF);
+				}
+			}
 			else
 			{
 				p->reportDailyTransactions("Transactions.csv");
@@ -146,7 +425,25 @@ int main(int argc,const char **argv)
 				printf("Now building the blockchain\r\n");
 				uint32_t ret = b->buildBlockChain();
 				printf("Found %d blocks.\r\n", ret);
-				for (uint32_t i = 0; i < ret; i++)
+				b->setResumeBlockIndex(p->getResumeBlockIndex());
+				// The ingest reports are computed from the blocks as they are added, so they only cover this run's blocks
+				BlockAnalyzer *analyzers[2] = { nullptr, nullptr };
+				if (ingestReports)
+				{
+					analyzers[0] = BlockAnalyzer::createDailyStatistics("IngestDaily.csv", reportFormat);
+					analyzers[1] = BlockAnalyzer::createOutputValues("IngestOutputValues.csv", reportFormat);
+					for (uint32_t j = 0; j < 2; j++)
+					{
+						p->addBlockAnalyzer(analyzers[j]);
+					}
+				}
+				bool failed = false;
+				if (p->getResumeBlockIndex() > ret)
+				{
+					printf("The blockchain only has %d blocks but the checkpoint is at block %d; run again without -resume to rebuild the database.\r\n", ret, p->getResumeBlockIndex());
+					failed = true;
+				}
+				for (uint32_t i = p->getResumeBlockIndex(); !failed && i < ret; i++)
 				{
 					if (((i + 1) % 100) == 0)
 					{
@@ -160,7 +457,11 @@ int main(int argc,const char **argv)
 					}
 					else
 					{
-						p->addBlock(block);
+						if (!p->addBlock(block))
+						{
+							failed = true;
+							break;
+						}
 
 						if (kbhit())
 						{
@@ -174,8 +475,23 @@ int main(int argc,const char **argv)
 					}
 				}
 				printf("Completed parsing the blockchain.\r\n");
-				printf("Now building the public-key records database.\r\n");
-				p->buildPublicKeyDatabase();
+				for (uint32_t j = 0; j < 2; j++)
+				{
+					if (analyzers[j])
+					{
+						analyzers[j]->end();
+						analyzers[j]->release();
+					}
+				}
+				if (failed)
+				{
+					printf("Ingest stopped; the public-key records database was not built.\r\n");
+				}
+				else
+				{
+					printf("Now building the public-key records database.\r\n");
+					p->buildPublicKeyDatabase();
+				}
 				b->release(); // release the blockchain parser
 			}
 		}